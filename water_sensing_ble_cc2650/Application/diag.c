@@ -0,0 +1,300 @@
+/*
+ * Runtime performance counters, see diag.h.
+ *
+ * Build options:
+ *   HEAPMGR_METRICS  ICall heap figures, needs HEAPMGR_SIZE to be set too.
+ *   DIAG_CPU_LOAD    CPU idle figure, needs the ti.sysbios.utils.Load module
+ *                    enabled in the app .cfg.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+
+#include <ti/sysbios/knl/Task.h>
+#include <ti/sysbios/hal/Hwi.h>
+#ifdef DIAG_CPU_LOAD
+#include <ti/sysbios/utils/Load.h>
+#endif
+
+#include <icall.h>
+
+#include <diag_service.h>
+
+#include "diag.h"
+#include "trace.h"
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Fails to compile if the counter block no longer matches the length of
+// the Counters characteristic, grow DIAGSERVICE_COUNTERS_LEN with a new
+// counter.
+typedef char diag_blockLenCheck[(DIAG_BLOCK_LEN ==
+                                 DIAGSERVICE_COUNTERS_LEN) ? 1 : -1];
+
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+
+// Task objects of the application and GAPRole tasks.
+extern Task_Struct przTask;
+extern Task_Struct gapRoleTask;
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static diag_block_t diagBlock;
+
+// Current number of messages in the application queue.
+static uint16_t diagMsgQueueDepth = 0;
+
+// Alarm bits already handed out by Diag_takeNewAlarms.
+static uint8_t diagAlarmsReported = 0;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Get the stack usage of a task.
+ *
+ *          Task_stat finds the high-water mark from the stack fill pattern,
+ *          so it is the deepest the stack has ever been, not the current
+ *          depth.
+ *
+ * @param   pTask - task to inspect
+ * @param   pUsed - stack high-water mark in bytes
+ * @param   pSize - stack size in bytes
+ *
+ * @return  TRUE if the high-water mark is past DIAG_STACK_ALARM_PCT.
+ */
+static uint8_t Diag_stackUsage(Task_Struct *pTask, uint16_t *pUsed,
+                               uint16_t *pSize)
+{
+  Task_Stat stat;
+
+  Task_stat(Task_handle(pTask), &stat);
+
+  *pUsed = (uint16_t)stat.used;
+  *pSize = (uint16_t)stat.stackSize;
+
+  return (stat.used * 100 >= stat.stackSize * DIAG_STACK_ALARM_PCT);
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Clear all counters.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Diag_init(void)
+{
+  UInt key = Hwi_disable();
+  uint8_t assertCause = diagBlock.assertCause;
+  uint8_t assertSubcause = diagBlock.assertSubcause;
+  uint8_t asserted = diagBlock.alarms & DIAG_ALARM_STACK_ASSERT;
+
+  memset(&diagBlock, 0, sizeof(diagBlock));
+  diagMsgQueueDepth = 0;
+  diagAlarmsReported = 0;
+
+  // The stack may assert before the application task has started.
+  diagBlock.assertCause = asserted ? assertCause : DIAG_NOT_AVAILABLE_8;
+  diagBlock.assertSubcause = asserted ? assertSubcause : DIAG_NOT_AVAILABLE_8;
+  diagBlock.alarms = asserted;
+  Hwi_restore(key);
+}
+
+
+/*
+ * @brief   Count an event.
+ *
+ * @note    May be called from Hwi, Swi or Task context.
+ *
+ * @param   counter - the event to count
+ *
+ * @return  None.
+ */
+void Diag_count(diag_counter_t counter)
+{
+  UInt key;
+
+  if (counter < DIAG_NUM_COUNTERS)
+  {
+    key = Hwi_disable();
+    diagBlock.counter[counter]++;
+    Hwi_restore(key);
+  }
+}
+
+
+/*
+ * @brief   Track a message put on the application queue.
+ *
+ * @note    May be called from Hwi, Swi or Task context.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Diag_msgEnqueued(void)
+{
+  UInt key = Hwi_disable();
+
+  diagMsgQueueDepth++;
+  if (diagMsgQueueDepth > diagBlock.appMsgQueueHwm)
+  {
+    diagBlock.appMsgQueueHwm = diagMsgQueueDepth;
+  }
+
+  Hwi_restore(key);
+}
+
+
+/*
+ * @brief   Track a message taken off the application queue, and how long
+ *          it waited there.
+ *
+ * @param   msgClass - class of the message, app_msg_class_t
+ * @param   waitUs   - time from enqueue to dequeue in microseconds
+ *
+ * @return  None.
+ */
+void Diag_msgDequeued(uint8_t msgClass, uint32_t waitUs)
+{
+  UInt key = Hwi_disable();
+
+  if (diagMsgQueueDepth)
+  {
+    diagMsgQueueDepth--;
+  }
+
+  Hwi_restore(key);
+
+  if (msgClass < DIAG_NUM_MSG_CLASSES)
+  {
+    if (waitUs > diagBlock.msgWaitMaxUs[msgClass])
+    {
+      diagBlock.msgWaitMaxUs[msgClass] = waitUs;
+    }
+
+    // Exponential moving average, weight 1/8.
+    diagBlock.msgWaitAvgUs[msgClass] +=
+      ((int32_t)(waitUs - diagBlock.msgWaitAvgUs[msgClass])) / 8;
+  }
+}
+
+
+/*
+ * @brief   Record a stack assert.
+ *
+ *          Out of memory asserts return to the stack, so the node keeps
+ *          running and the cause can be read out afterwards.
+ *
+ * @param   cause    - assert cause, see hal_assert.h
+ * @param   subcause - assert subcause, see hal_assert.h
+ *
+ * @return  None.
+ */
+void Diag_recordAssert(uint8_t cause, uint8_t subcause)
+{
+  UInt key = Hwi_disable();
+
+  diagBlock.assertCause = cause;
+  diagBlock.assertSubcause = subcause;
+  diagBlock.alarms |= DIAG_ALARM_STACK_ASSERT;
+
+  Hwi_restore(key);
+
+  TRACE2(TRACE_STACK_ASSERT, cause, subcause);
+}
+
+
+/*
+ * @brief   Sample heap, stack and CPU usage into the counter block.
+ *
+ * @note    Task_stat walks the stack fill pattern, so keep this off the
+ *          sample path and call it at the diagnostics refresh rate.
+ *
+ * @param   None.
+ *
+ * @return  Pointer to the DIAG_BLOCK_LEN byte counter block.
+ */
+const diag_block_t *Diag_update(void)
+{
+#if defined(HEAPMGR_METRICS) && defined(HEAPMGR_SIZE) && (HEAPMGR_SIZE > 0)
+  uint32_t blkMax, blkCnt, blkFree, memAlo, memMax, memUB;
+
+  ICall_getHeapMgrGetMetrics(&blkMax, &blkCnt, &blkFree,
+                             &memAlo, &memMax, &memUB);
+
+  diagBlock.heapSize = HEAPMGR_SIZE;
+  diagBlock.heapFree = (uint16_t)(HEAPMGR_SIZE - memAlo);
+  diagBlock.heapMinFree = (uint16_t)(HEAPMGR_SIZE - memMax);
+
+  if (memMax * 100 >= (uint32_t)HEAPMGR_SIZE * DIAG_HEAP_ALARM_PCT)
+  {
+    diagBlock.alarms |= DIAG_ALARM_HEAP;
+  }
+#else
+  diagBlock.heapSize = DIAG_NOT_AVAILABLE_16;
+  diagBlock.heapFree = DIAG_NOT_AVAILABLE_16;
+  diagBlock.heapMinFree = DIAG_NOT_AVAILABLE_16;
+#endif
+
+  uint16_t used, size;
+
+  if (Diag_stackUsage(&przTask, &used, &size))
+  {
+    diagBlock.alarms |= DIAG_ALARM_APP_STACK;
+  }
+  diagBlock.appStackHwm = used;
+  diagBlock.appStackSize = size;
+
+  if (Diag_stackUsage(&gapRoleTask, &used, &size))
+  {
+    diagBlock.alarms |= DIAG_ALARM_GAPROLE_STACK;
+  }
+  diagBlock.gapRoleStackHwm = used;
+  diagBlock.gapRoleStackSize = size;
+
+#ifdef DIAG_CPU_LOAD
+  diagBlock.cpuIdlePct = (uint8_t)(100 - Load_getCPULoad());
+#else
+  diagBlock.cpuIdlePct = DIAG_NOT_AVAILABLE_8;
+#endif
+
+  return &diagBlock;
+}
+
+
+/*
+ * @brief   Get the alarms raised since the last call.
+ *
+ * @param   None.
+ *
+ * @return  DIAG_ALARM_* bits not reported before.
+ */
+uint8_t Diag_takeNewAlarms(void)
+{
+  uint8_t newAlarms = diagBlock.alarms & ~diagAlarmsReported;
+
+  diagAlarmsReported |= newAlarms;
+
+  return newAlarms;
+}
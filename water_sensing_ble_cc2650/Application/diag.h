@@ -0,0 +1,114 @@
+/*
+ * Runtime performance counters.
+ *
+ * Event counters are bumped from wherever the event happens (any context),
+ * while the resource figures (heap, task stacks, CPU load) are sampled when
+ * the counter block is refreshed. The block is published read-only through
+ * the diagnostics service so node health can be checked without a debugger.
+ */
+#ifndef DIAG_H
+#define DIAG_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Reported for figures that are not available in this build.
+#define DIAG_NOT_AVAILABLE_16      0xFFFF
+#define DIAG_NOT_AVAILABLE_8       0xFF
+
+// Soft alarm thresholds, in percent of the stack or heap in use. Raised well
+// before exhaustion so the allocation can be grown before anything breaks.
+#ifndef DIAG_STACK_ALARM_PCT
+#define DIAG_STACK_ALARM_PCT       85
+#endif
+
+#ifndef DIAG_HEAP_ALARM_PCT
+#define DIAG_HEAP_ALARM_PCT        90
+#endif
+
+// Application message classes, APP_NUM_MSG_CLASSES in project_zero.h. A
+// number so it sizes the Counters characteristic, project_zero.c checks
+// that the two agree.
+#define DIAG_NUM_MSG_CLASSES       3
+
+// Alarm bits, latched until reset.
+#define DIAG_ALARM_APP_STACK       0x01
+#define DIAG_ALARM_GAPROLE_STACK   0x02
+#define DIAG_ALARM_HEAP            0x04
+#define DIAG_ALARM_STACK_ASSERT    0x08
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Event counters. Only append, the index is part of the over-the-air layout.
+typedef enum
+{
+  DIAG_CNT_SAMPLES_TAKEN = 0,   /* Sensor Controller samples processed       */
+  DIAG_CNT_SAMPLES_DROPPED,     /* Sample messages lost to allocation errors */
+  DIAG_CNT_ALERT_COALESCED,     /* ALERTs reporting SC output overflow       */
+  DIAG_CNT_NOTI_FAILURES,       /* Characteristic updates the stack rejected */
+  DIAG_CNT_RECONNECTS,          /* Connections established after the first   */
+  DIAG_CNT_NOTI_SUPERSEDED,     /* Staged values replaced before being sent  */
+  DIAG_CNT_NOTI_RETRIED,        /* Values queued waiting for stack buffers   */
+  DIAG_CNT_NOTI_DROPPED,        /* Queued values never sent                  */
+  DIAG_CNT_SC_TORN_READS,       /* SC output copies changed while read       */
+  DIAG_CNT_ROLLUP_DROPPED,      /* Rollups lost waiting for the flash        */
+  DIAG_NUM_COUNTERS
+} diag_counter_t;
+
+// Counter block, as exposed over the air (little endian, packed).
+#pragma pack(push, 1)
+typedef struct
+{
+  uint32_t counter[DIAG_NUM_COUNTERS]; // Indexed by diag_counter_t
+  uint16_t appMsgQueueHwm;             // Most messages ever waiting in app queue
+  uint16_t heapFree;                   // ICall heap bytes free now
+  uint16_t heapMinFree;                // ICall heap bytes free at worst
+  uint16_t appStackHwm;                // Bytes of app task stack ever used
+  uint16_t gapRoleStackHwm;            // Bytes of GAPRole task stack ever used
+  uint8_t  cpuIdlePct;                 // Idle time over the last Load window
+  uint16_t appStackSize;               // App task stack size in bytes
+  uint16_t gapRoleStackSize;           // GAPRole task stack size in bytes
+  uint16_t heapSize;                   // ICall heap size in bytes
+  uint8_t  alarms;                     // DIAG_ALARM_* bits
+  uint8_t  assertCause;                // Last stack assert, 0xFF if none
+  uint8_t  assertSubcause;
+  uint32_t msgWaitMaxUs[DIAG_NUM_MSG_CLASSES]; // Longest time a message of
+                                               // the class waited in its queue
+  uint32_t msgWaitAvgUs[DIAG_NUM_MSG_CLASSES]; // Moving average of the wait,
+                                               // over about 8 messages
+} diag_block_t;
+#pragma pack(pop)
+
+#define DIAG_BLOCK_LEN             (sizeof(diag_block_t))
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Diag_init(void);
+
+// Safe from any context.
+void Diag_count(diag_counter_t counter);
+void Diag_msgEnqueued(void);
+
+// Task context only.
+void Diag_msgDequeued(uint8_t msgClass, uint32_t waitUs);
+
+// Called from the stack assert handler.
+void Diag_recordAssert(uint8_t cause, uint8_t subcause);
+
+// Sample resource usage into the counter block. Task context only.
+const diag_block_t *Diag_update(void);
+
+// Alarm bits raised since the last call, to be reported once.
+uint8_t Diag_takeNewAlarms(void);
+
+#endif /* DIAG_H */
@@ -0,0 +1,201 @@
+/*
+ * Sample latency instrumentation, see latency.h.
+ *
+ * Timestamps come from the xdc Timestamp provider, which on CC26xx is
+ * derived from the RTC and keeps running in standby.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+#include <xdc/runtime/Types.h>
+#include <xdc/runtime/Timestamp.h>
+
+#include <diag_service.h>
+
+#include "latency.h"
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Fails to compile if the histogram block no longer matches the length of
+// the Latency Histogram characteristic. Adding a stage changes both.
+typedef char latency_blockLenCheck[(LATENCY_HIST_BLOCK_LEN ==
+                                    DIAGSERVICE_LATENCYHIST_LEN) ? 1 : -1];
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// Timestamp of the most recent ALERT, written from Hwi context.
+static volatile uint32_t latencyAlertStamp = 0;
+
+// ALERT timestamp of the sample currently being processed by the task.
+static uint32_t latencySampleStamp = 0;
+static uint8_t  latencySampleValid = FALSE;
+
+// Timestamp provider frequency in Hz.
+static uint32_t latencyFreqHz = 0;
+
+static latency_hist_t latencyHist[LATENCY_NUM_STAGES];
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Find the histogram bucket for a latency.
+ *
+ * @param   us - latency in microseconds
+ *
+ * @return  Bucket index, 0 .. LATENCY_NUM_BUCKETS-1
+ */
+static uint8_t Latency_bucket(uint32_t us)
+{
+  uint8_t log2 = 0;
+
+  while (us >>= 1)
+  {
+    log2++;
+  }
+
+  if (log2 < LATENCY_BUCKET0_LOG2)
+  {
+    return 0;
+  }
+
+  log2 -= LATENCY_BUCKET0_LOG2 - 1;
+
+  return (log2 < LATENCY_NUM_BUCKETS) ? log2 : LATENCY_NUM_BUCKETS - 1;
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Initialize the latency histograms.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Latency_init(void)
+{
+  Types_FreqHz freq;
+
+  Timestamp_getFreq(&freq);
+  latencyFreqHz = freq.lo;
+
+  Latency_reset();
+}
+
+
+/*
+ * @brief   Timestamp a Sensor Controller ALERT.
+ *
+ * @note    Runs in Hwi context.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Latency_markAlert(void)
+{
+  latencyAlertStamp = Timestamp_get32();
+}
+
+
+/*
+ * @brief   Start tracking the sample belonging to the last ALERT.
+ *
+ *          SC_processTaskAlert acknowledges the ALERT event only after
+ *          queueing the characteristic updates of the sample, so they are
+ *          queued before the next ALERT message can be and a single latched
+ *          timestamp covers every stage of the sample.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Latency_beginSample(void)
+{
+  latencySampleStamp = latencyAlertStamp;
+  latencySampleValid = TRUE;
+}
+
+
+/*
+ * @brief   Record the time elapsed since the ALERT of the current sample.
+ *
+ *          UPDATE_CHARVAL is recorded once per characteristic update
+ *          and NOTI_QUEUED once per value of the sample handed to the
+ *          stack while connected, so a sample contributes one count per
+ *          published channel to those stages. Values sent by a later
+ *          retry are not recorded.
+ *
+ * @param   stage - the stage that has just been reached
+ *
+ * @return  None.
+ */
+void Latency_record(latency_stage_t stage)
+{
+  latency_hist_t *pHist;
+  uint32_t us;
+  uint8_t bucket;
+
+  if (!latencySampleValid || stage >= LATENCY_NUM_STAGES || !latencyFreqHz)
+  {
+    return;
+  }
+
+  us = (uint32_t)(((uint64_t)(Timestamp_get32() - latencySampleStamp)
+                   * 1000000) / latencyFreqHz);
+
+  pHist = &latencyHist[stage];
+  bucket = Latency_bucket(us);
+
+  if (pHist->bucket[bucket] != 0xFFFF)
+  {
+    pHist->bucket[bucket]++;
+  }
+
+  if (us > pHist->maxUs)
+  {
+    pHist->maxUs = us;
+  }
+}
+
+
+/*
+ * @brief   Get the histograms of all stages.
+ *
+ * @param   None.
+ *
+ * @return  Pointer to LATENCY_NUM_STAGES histograms, LATENCY_HIST_BLOCK_LEN
+ *          bytes in total.
+ */
+const latency_hist_t *Latency_getHistograms(void)
+{
+  return latencyHist;
+}
+
+
+/*
+ * @brief   Clear all histograms.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Latency_reset(void)
+{
+  memset(latencyHist, 0, sizeof(latencyHist));
+}
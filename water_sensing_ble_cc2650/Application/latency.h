@@ -0,0 +1,79 @@
+/*
+ * Sample latency instrumentation.
+ *
+ * Every Sensor Controller sample is timestamped when the ALERT interrupt
+ * fires, and again as it moves through the application:
+ *
+ *   SC_taskAlertHwiCb -> dequeue in app task -> user_updateCharVal
+ *                     -> notification queued by GATTServApp_ProcessCharCfg,
+ *                        at the end of the connection event while connected,
+ *                        right away when sampling is aligned to the events
+ *
+ * The elapsed time from the ALERT to each stage is accumulated into a
+ * log2-bucketed histogram kept in RAM, which is published through the
+ * diagnostics service.
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Number of histogram buckets per stage.
+#define LATENCY_NUM_BUCKETS        16
+
+// Bucket 0 holds everything below 2^LATENCY_BUCKET0_LOG2 us (256 us). Bucket
+// n covers [2^(n+7), 2^(n+8)) us, and the last bucket also collects overflow
+// (>= ~4.2 s).
+#define LATENCY_BUCKET0_LOG2       8
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Points in the sample path where latency is measured, relative to the
+// Sensor Controller ALERT interrupt.
+typedef enum
+{
+  LATENCY_STAGE_DEQUEUE = 0,    /* ALERT message dequeued by the app task    */
+  LATENCY_STAGE_UPDATE_CHARVAL, /* user_updateCharVal entered                */
+  LATENCY_STAGE_NOTI_QUEUED,    /* Notification handed to the stack          */
+  LATENCY_NUM_STAGES
+} latency_stage_t;
+
+// Histogram of one stage, as exposed over the air (little endian, packed).
+#pragma pack(push, 1)
+typedef struct
+{
+  uint32_t maxUs;                        // Worst case seen, in microseconds
+  uint16_t bucket[LATENCY_NUM_BUCKETS];  // Saturating sample counts
+} latency_hist_t;
+#pragma pack(pop)
+
+// Size of the complete histogram block for all stages.
+#define LATENCY_HIST_BLOCK_LEN     (LATENCY_NUM_STAGES * sizeof(latency_hist_t))
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Latency_init(void);
+
+// Called from the Sensor Controller ALERT Hwi. Must stay cheap.
+void Latency_markAlert(void);
+
+// Called in Task context when the ALERT message is taken off the queue.
+// Latches the ALERT timestamp for the sample now being processed.
+void Latency_beginSample(void);
+
+void Latency_record(latency_stage_t stage);
+const latency_hist_t *Latency_getHistograms(void);
+void Latency_reset(void);
+
+#endif /* LATENCY_H */
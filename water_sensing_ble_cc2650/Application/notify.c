@@ -0,0 +1,357 @@
+/*
+ * Staged characteristic updates, see notify.h.
+ *
+ * Slots are kept in the order they were first staged, so a flush sends the
+ * characteristics in the order their samples arrived. The retry queue is a
+ * ring in the same order; once one value is waiting for buffers everything
+ * newer queues behind it, so a peer never sees readings out of order.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+
+#include <bcomdef.h>
+
+#include "notify.h"
+#include "latency.h"
+#include "diag.h"
+#include "trace.h"
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+  notifySetParamFxn_t setParamFxn;
+  uint8_t  paramID;
+  uint8_t  len;
+  uint8_t  value[NOTIFY_MAX_VALUE_LEN];
+} notify_slot_t;
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static notify_slot_t notifySlot[NOTIFY_MAX_STAGED];
+static uint8_t notifyNumStaged = 0;
+
+// Values the stack had no buffers for, oldest at notifyRetryHead.
+static notify_slot_t notifyRetry[NOTIFY_RETRY_DEPTH];
+static uint8_t notifyRetryHead = 0;
+static uint8_t notifyRetryCount = 0;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Add a value to the tail of the retry queue, dropping the oldest
+ *          one if the queue is full.
+ *
+ * @param   pSlot - value to queue, copied
+ *
+ * @return  None.
+ */
+static void Notify_queueRetry(const notify_slot_t *pSlot)
+{
+  if (notifyRetryCount == NOTIFY_RETRY_DEPTH)
+  {
+    TRACE1(TRACE_NOTI_DROPPED, notifyRetry[notifyRetryHead].paramID);
+    Diag_count(DIAG_CNT_NOTI_DROPPED);
+
+    notifyRetryHead = (notifyRetryHead + 1) % NOTIFY_RETRY_DEPTH;
+    notifyRetryCount--;
+  }
+
+  notifyRetry[(notifyRetryHead + notifyRetryCount) % NOTIFY_RETRY_DEPTH] =
+    *pSlot;
+  notifyRetryCount++;
+
+  Diag_count(DIAG_CNT_NOTI_RETRIED);
+}
+
+/*
+ * @brief   Send a value, queueing it for retry if the stack is out of
+ *          buffers or older values are already waiting.
+ *
+ * @param   pSlot - value to send
+ *
+ * @return  TRUE if the service took the value.
+ */
+static uint8_t Notify_send(const notify_slot_t *pSlot)
+{
+  uint8_t status;
+
+  if (notifyRetryCount != 0)
+  {
+    Notify_queueRetry(pSlot);
+    return FALSE;
+  }
+
+  status = pSlot->setParamFxn(pSlot->paramID, pSlot->len,
+                              (void *)pSlot->value);
+  if (status == SUCCESS)
+  {
+    return TRUE;
+  }
+
+  if (Notify_isRetryable(status))
+  {
+    Notify_queueRetry(pSlot);
+  }
+  else
+  {
+    Diag_count(DIAG_CNT_NOTI_FAILURES);
+  }
+
+  return FALSE;
+}
+
+/*
+ * @brief   Send queued values, oldest first, until the stack runs out of
+ *          buffers again.
+ *
+ * @param   None.
+ *
+ * @return  Number of values the service took.
+ */
+static uint8_t Notify_retry(void)
+{
+  uint8_t sent = 0;
+
+  while (notifyRetryCount != 0)
+  {
+    notify_slot_t *pSlot = &notifyRetry[notifyRetryHead];
+    uint8_t status = pSlot->setParamFxn(pSlot->paramID, pSlot->len,
+                                        pSlot->value);
+
+    if (Notify_isRetryable(status))
+    {
+      break;
+    }
+
+    if (status == SUCCESS)
+    {
+      sent++;
+    }
+    else
+    {
+      Diag_count(DIAG_CNT_NOTI_FAILURES);
+    }
+
+    notifyRetryHead = (notifyRetryHead + 1) % NOTIFY_RETRY_DEPTH;
+    notifyRetryCount--;
+  }
+
+  return sent;
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Drop everything staged or queued.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Notify_init(void)
+{
+  memset(notifySlot, 0, sizeof(notifySlot));
+  notifyNumStaged = 0;
+
+  notifyRetryHead = 0;
+  notifyRetryCount = 0;
+}
+
+/*
+ * @brief   Stage a characteristic value for the next flush.
+ *
+ * @param   setParamFxn - SetParameter function of the service
+ * @param   paramID     - characteristic
+ * @param   pValue      - value, copied
+ * @param   len         - value length
+ *
+ * @return  TRUE if staged, FALSE if the value has to be written directly.
+ */
+uint8_t Notify_stage(notifySetParamFxn_t setParamFxn, uint8_t paramID,
+                     const uint8_t *pValue, uint16_t len)
+{
+  notify_slot_t *pSlot = NULL;
+  uint8_t i;
+
+  if (len > NOTIFY_MAX_VALUE_LEN)
+  {
+    return FALSE;
+  }
+
+  for (i = 0; i < notifyNumStaged; i++)
+  {
+    if (notifySlot[i].setParamFxn == setParamFxn &&
+        notifySlot[i].paramID == paramID)
+    {
+      // Only the newest reading of a characteristic is worth sending.
+      Diag_count(DIAG_CNT_NOTI_SUPERSEDED);
+      pSlot = &notifySlot[i];
+      break;
+    }
+  }
+
+  if (pSlot == NULL)
+  {
+    if (notifyNumStaged == NOTIFY_MAX_STAGED)
+    {
+      return FALSE;
+    }
+
+    pSlot = &notifySlot[notifyNumStaged++];
+    pSlot->setParamFxn = setParamFxn;
+    pSlot->paramID = paramID;
+  }
+
+  pSlot->len = (uint8_t)len;
+  memcpy(pSlot->value, pValue, len);
+
+  return TRUE;
+}
+
+/*
+ * @brief   Write a characteristic value now. If the stack is out of
+ *          buffers, or older values already wait for them, the value is
+ *          queued and sent by a later flush.
+ *
+ * @param   setParamFxn - SetParameter function of the service
+ * @param   paramID     - characteristic
+ * @param   pValue      - value, copied
+ * @param   len         - value length
+ *
+ * @return  None.
+ */
+void Notify_write(notifySetParamFxn_t setParamFxn, uint8_t paramID,
+                  const uint8_t *pValue, uint16_t len)
+{
+  notify_slot_t slot;
+
+  // Too long to queue, one try only.
+  if (len > NOTIFY_MAX_VALUE_LEN)
+  {
+    if (setParamFxn(paramID, len, (void *)pValue) == SUCCESS)
+    {
+      Latency_record(LATENCY_STAGE_NOTI_QUEUED);
+    }
+    else
+    {
+      Diag_count(DIAG_CNT_NOTI_FAILURES);
+    }
+    return;
+  }
+
+  slot.setParamFxn = setParamFxn;
+  slot.paramID = paramID;
+  slot.len = (uint8_t)len;
+  memcpy(slot.value, pValue, len);
+
+  if (Notify_send(&slot))
+  {
+    Latency_record(LATENCY_STAGE_NOTI_QUEUED);
+  }
+}
+
+/*
+ * @brief   Retry the values waiting for stack buffers, then write all
+ *          staged values to their services, which sends the notifications
+ *          to subscribed peers.
+ *
+ * @param   None.
+ *
+ * @return  Number of values written successfully.
+ */
+uint8_t Notify_flush(void)
+{
+  uint8_t sent = Notify_retry();
+  uint8_t i;
+
+  // Retried values belong to earlier samples, only the staged ones count
+  // towards the latency of the current one.
+  for (i = 0; i < notifyNumStaged; i++)
+  {
+    if (Notify_send(&notifySlot[i]))
+    {
+      Latency_record(LATENCY_STAGE_NOTI_QUEUED);
+      sent++;
+    }
+  }
+
+  notifyNumStaged = 0;
+
+  return sent;
+}
+
+/*
+ * @brief   Give up on the values queued for the closed connection. They
+ *          are still written to their services, in order, so the
+ *          characteristics read back the newest values.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Notify_connectionClosed(void)
+{
+  uint8_t i;
+
+  while (notifyRetryCount != 0)
+  {
+    notify_slot_t *pSlot = &notifyRetry[notifyRetryHead];
+
+    pSlot->setParamFxn(pSlot->paramID, pSlot->len, pSlot->value);
+    Diag_count(DIAG_CNT_NOTI_DROPPED);
+
+    notifyRetryHead = (notifyRetryHead + 1) % NOTIFY_RETRY_DEPTH;
+    notifyRetryCount--;
+  }
+
+  for (i = 0; i < notifyNumStaged; i++)
+  {
+    notifySlot[i].setParamFxn(notifySlot[i].paramID, notifySlot[i].len,
+                              notifySlot[i].value);
+  }
+
+  notifyNumStaged = 0;
+}
+
+/*
+ * @brief   Check for values waiting to be flushed or retried.
+ *
+ * @param   None.
+ *
+ * @return  TRUE if anything is staged or queued.
+ */
+uint8_t Notify_pending(void)
+{
+  return (notifyNumStaged != 0 || notifyRetryCount != 0);
+}
+
+/*
+ * @brief   Check whether a SetParameter status means the stack was out of
+ *          buffers, so the same value may go through later.
+ *
+ * @param   status - status returned by the service
+ *
+ * @return  TRUE if worth retrying.
+ */
+uint8_t Notify_isRetryable(uint8_t status)
+{
+  return (status == blePending || status == MSG_BUFFER_NOT_AVAIL ||
+          status == bleMemAllocError || status == bleNoResources);
+}
@@ -0,0 +1,78 @@
+/*
+ * Staged characteristic updates.
+ *
+ * While connected, sensor values are not handed to the stack as they are
+ * produced. The newest value of each characteristic is kept in a staging
+ * slot and all staged values are flushed in one burst when a connection
+ * event ends, so the notifications of a sample period go out together in
+ * the next connection event instead of trickling over several.
+ *
+ * A notification the stack cannot take because its TX buffers are full is
+ * not lost: the value goes into a bounded retry queue and is sent again when
+ * the next connection event ends, ahead of anything newer. When the queue
+ * is full the oldest entry is dropped and counted. The queue belongs to the
+ * current connection and is emptied when it closes.
+ *
+ * Task context only.
+ */
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Characteristics that can be staged at the same time.
+#define NOTIFY_MAX_STAGED          8
+
+// Largest characteristic value that can be staged, a sample record.
+#define NOTIFY_MAX_VALUE_LEN       20
+
+// Values waiting for stack buffers at most.
+#ifndef NOTIFY_RETRY_DEPTH
+#define NOTIFY_RETRY_DEPTH         16
+#endif
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Service SetParameter function the staged value is written with.
+typedef uint8_t (*notifySetParamFxn_t)(uint8_t paramID, uint16_t len,
+                                       void *pValue);
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Notify_init(void);
+
+// Stage a value, replacing one of the same characteristic not yet flushed.
+// Returns FALSE if it could not be staged and must be written directly.
+uint8_t Notify_stage(notifySetParamFxn_t setParamFxn, uint8_t paramID,
+                     const uint8_t *pValue, uint16_t len);
+
+// Write a value now, or queue it for retry if the stack is out of buffers.
+void Notify_write(notifySetParamFxn_t setParamFxn, uint8_t paramID,
+                  const uint8_t *pValue, uint16_t len);
+
+// Retry queued values, then write all staged values to their services.
+// Returns the number written successfully, failures are counted in the
+// diagnostics.
+uint8_t Notify_flush(void);
+
+// The connection closed: what is queued can no longer be delivered.
+void Notify_connectionClosed(void);
+
+// TRUE while anything waits for the next flush.
+uint8_t Notify_pending(void);
+
+// TRUE if a SetParameter status means the stack was out of buffers.
+uint8_t Notify_isRetryable(uint8_t status);
+
+#endif /* NOTIFY_H */
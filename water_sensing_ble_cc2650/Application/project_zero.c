@@ -34,12 +34,15 @@
  * INCLUDES
  */
 #include <ble_service.h>
+#include <diag_service.h>
 #include <string.h>
 
 
+#include <ti/sysbios/BIOS.h>
 #include <ti/sysbios/knl/Task.h>
 #include <ti/sysbios/knl/Semaphore.h>
 #include <ti/sysbios/knl/Queue.h>
+#include <ti/sysbios/knl/Event.h>
 
 #include <ti/drivers/PIN.h>
 #include <ti/mw/display/Display.h>
@@ -64,6 +67,14 @@
 
 #include "Board.h"
 #include "project_zero.h"
+#include "latency.h"
+#include "diag.h"
+#include "trace.h"
+#include "notify.h"
+#include "samplelog.h"
+#include "stats.h"
+#include "rollup.h"
+#include "tput.h"
 
 // Bluetooth Developer Studio services
 
@@ -95,6 +106,16 @@
 #define PRZ_PERIODIC_EVT                      0x0004
 #define PRZ_CONN_EVT_END_EVT                  0x0008
 
+// Event bit per application message class, set while its queue has work.
+#define PRZ_MSG_CLASS_EVT(c)                  (Event_Id_00 << (c))
+#define PRZ_ALL_MSG_CLASS_EVTS                (PRZ_MSG_CLASS_EVT(APP_NUM_MSG_CLASSES) - 1)
+
+// Stack messages handled per round of the task loop.
+#define PRZ_STACK_MSG_BUDGET                  4
+
+// How often the diagnostics characteristics are refreshed [ms]
+#define PRZ_DIAG_REFRESH_PERIOD               1000
+
 /*********************************************************************
  * TYPEDEFS
  */
@@ -107,6 +128,12 @@ typedef struct
   uint32   numComparison;
 } passcode_req_t;
 
+// Fails to compile if the diagnostics keep wait stats for another number
+// of message classes than there are, grow DIAG_NUM_MSG_CLASSES with a new
+// class.
+typedef char prz_msgClassCheck[(DIAG_NUM_MSG_CLASSES ==
+                                APP_NUM_MSG_CLASSES) ? 1 : -1];
+
 
 /*********************************************************************
  * LOCAL VARIABLES
@@ -118,9 +145,24 @@ static ICall_EntityID selfEntity;
 // Semaphore globally used to post events to the application thread
 static ICall_Semaphore sem;
 
-// Queue object used for application messages.
-static Queue_Struct applicationMsgQ;
-static Queue_Handle hApplicationMsgQ;
+// Queue objects used for application messages, one per app_msg_class_t.
+static Queue_Struct applicationMsgQ[APP_NUM_MSG_CLASSES];
+static Queue_Handle hApplicationMsgQ[APP_NUM_MSG_CLASSES];
+
+// Event bits of the classes with messages waiting. Posted with every
+// message, taken by the task loop and kept in przPendingEvts until the
+// class queue has been worked off.
+static Event_Struct przEvent;
+static Event_Handle hPrzEvent;
+static uint32_t przPendingEvts = 0;
+
+// Application messages handled per round of the task loop, by class.
+static const uint8_t przMsgClassBudget[APP_NUM_MSG_CLASSES] =
+{
+  4,  // APP_MSG_CLASS_GATT
+  8,  // APP_MSG_CLASS_SENSOR, an ALERT and the updates it produces
+  1,  // APP_MSG_CLASS_HOUSEKEEPING
+};
 
 // Task configuration
 Task_Struct przTask;
@@ -160,6 +202,13 @@ static uint8_t attDeviceName[GAP_DEVICE_NAME_LEN] = "Water Sensing BLE";
 static gattMsgEvent_t *pAttRsp = NULL;
 static uint8_t rspTxRetry = 0;
 
+// Current connection, and whether the stack reports its connection events.
+static uint16_t przConnHandle = INVALID_CONNHANDLE;
+static uint8_t connEvtNoticeOn = FALSE;
+
+// Clock used to periodically copy diagnostics into the diagnostics service.
+static Clock_Struct diagClock;
+
 
 /* Pin driver handles */
 static PIN_Handle ledPinHandle;
@@ -187,7 +236,11 @@ Display_Handle dispHandle;
 static void ProjectZero_init( void );
 static void ProjectZero_taskFxn(UArg a0, UArg a1);
 
+static uint8_t user_processStackMsgs(uint8_t budget);
+static uint8_t user_processMsgClass(app_msg_class_t msgClass, uint8_t budget);
 static void user_processApplicationMessage(app_msg_t *pMsg);
+static app_msg_class_t user_msgClass(app_msg_types_t type);
+static void user_postAppMsg(app_msg_t *pMsg);
 static uint8_t ProjectZero_processStackMsg(ICall_Hdr *pMsg);
 static uint8_t ProjectZero_processGATTMsg(gattMsgEvent_t *pMsg);
 
@@ -208,9 +261,23 @@ static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid, uin
 
 // Task context handlers for generated services.
 static void user_BleService_CfgChangeHandler(char_data_t *pCharData);
+static void user_BleService_ValueChangeHandler(char_data_t *pCharData);
+static void user_DiagService_ValueChangeHandler(char_data_t *pCharData);
 
 // Task handler for sending notifications.
 static void user_updateCharVal(char_data_t *pCharData);
+static void user_updateConnEvtNotice(void);
+static void user_connectionClosed(void);
+static void user_sendGapFill(void);
+static void user_sendStats(void);
+static void user_sendHistory(void);
+static void user_publishSampleRange(void);
+static void user_runThroughputTest(void);
+static void user_stopThroughputTest(void);
+
+// Diagnostics
+static void user_diagClockSwiFxn(UArg arg);
+static void user_refreshDiagnostics(void);
 
 // Utility functions
 static char *Util_getLocalNameStr(const uint8_t *data);
@@ -240,8 +307,14 @@ static gapBondCBs_t user_bondMgrCBs =
 // The type BleServiceCBs_t is defined in ble_service.h
 static bleServiceCBs_t user_Ble_ServiceCBs =
 {
-  .pfnChangeCb    = NULL, // No writable chars in BLE Service, so no change handler.
-  //.pfnChangeCb = user_service_ValueChangeCB, // Noti/ind configuration callback handler
+  .pfnChangeCb    = user_service_ValueChangeCB, // Characteristic value change callback handler
+};
+
+// Diagnostics Service callback handler.
+// The type diagServiceCBs_t is defined in diag_service.h
+static diagServiceCBs_t user_Diag_ServiceCBs =
+{
+  .pfnChangeCb    = user_service_ValueChangeCB, // Characteristic value change callback handler
 };
 
 
@@ -287,15 +360,24 @@ static void ProjectZero_init(void)
   // so that the application can send and receive messages via ICall to Stack.
   ICall_registerApp(&selfEntity, &sem);
 
-  //Log_info0("Initializing the user task, hardware, BLE stack and services.");
+  Trace_init();
+  TRACE0(TRACE_APP_INIT);
 
   // Open display. By default this is disabled via the predefined symbol Display_DISABLE_ALL.
   dispHandle = Display_open(Display_Type_LCD, NULL);
 
-  // Initialize queue for application messages.
+  // Initialize queues for application messages, one per class, and the
+  // event bits telling which of them have messages.
   // Note: Used to transfer control to application thread from e.g. interrupts.
-  Queue_construct(&applicationMsgQ, NULL);
-  hApplicationMsgQ = Queue_handle(&applicationMsgQ);
+  uint8_t i;
+  for (i = 0; i < APP_NUM_MSG_CLASSES; i++)
+  {
+    Queue_construct(&applicationMsgQ[i], NULL);
+    hApplicationMsgQ[i] = Queue_handle(&applicationMsgQ[i]);
+  }
+  Event_construct(&przEvent, NULL);
+  hPrzEvent = Event_handle(&przEvent);
+  Diag_init();
 
   // ******************************************************************
   // Hardware initialization
@@ -304,7 +386,7 @@ static void ProjectZero_init(void)
   // Open LED pins
   ledPinHandle = PIN_open(&ledPinState, ledPinTable);
   if(!ledPinHandle) {
-    //Log_error0("Error initializing board LED pins");
+    TRACE0(TRACE_ERR_LED_PINS);
     Task_exit();
   }
 
@@ -397,6 +479,23 @@ static void ProjectZero_init(void)
   BleService_SetParameter(BLESERVICE_TURBIDITYVALUE, BLESERVICE_TURBIDITYVALUE_LEN, initVal);
   BleService_SetParameter(BLESERVICE_PHVALUE, BLESERVICE_PHVALUE_LEN, initVal);
 
+  // Diagnostics service, refreshed from diagClock.
+  DiagService_AddService();
+  DiagService_RegisterAppCBs(&user_Diag_ServiceCBs);
+  DiagService_SetParameter(DIAGSERVICE_TRACE, DIAGSERVICE_TRACE_LEN,
+                           Trace_getBuffer());
+  Latency_init();
+  Notify_init();
+  SampleLog_init();
+  user_publishSampleRange();
+  Stats_init();
+  Rollup_init();
+  user_refreshDiagnostics();
+
+  Util_constructClock(&diagClock, user_diagClockSwiFxn,
+                      PRZ_DIAG_REFRESH_PERIOD, PRZ_DIAG_REFRESH_PERIOD,
+                      TRUE, 0);
+
   // Start the stack in Peripheral mode.
   VOID GAPRole_StartDevice(&user_gapRoleCBs);
 
@@ -430,6 +529,11 @@ static void ProjectZero_init(void)
  *          some RTOS and Stack APIs are not available in callbacks and so the
  *          actions that may need to be taken is dispatched to this Task.
  *
+ *          Stack messages are handled first, then application messages by
+ *          class (app_msg_class_t), each class from its own queue. Every
+ *          source has a budget per round of the loop, see
+ *          PRZ_STACK_MSG_BUDGET and przMsgClassBudget.
+ *
  * @param   a0, a1 - not used.
  *
  * @return  None.
@@ -445,61 +549,160 @@ static void ProjectZero_taskFxn(UArg a0, UArg a1)
     // Waits for a signal to the semaphore associated with the calling thread.
     // Note that the semaphore associated with a thread is signaled when a
     // message is queued to the message receive queue of the thread or when
-    // ICall_signal() function is called onto the semaphore.
+    // ICall_signal() function is called onto the semaphore. Application
+    // messages post it too, after setting the event bit of their class.
     ICall_Errno errno = ICall_wait(ICALL_TIMEOUT_FOREVER);
 
     if (errno == ICALL_ERRNO_SUCCESS)
     {
-      ICall_EntityID dest;
-      ICall_ServiceEnum src;
-      ICall_HciExtEvt *pMsg = NULL;
+      uint8_t more;
 
-      // Check if we got a signal because of a stack message
-      if (ICall_fetchServiceMsg(&src, &dest,
-                                (void **)&pMsg) == ICALL_ERRNO_SUCCESS)
+      // Work through the stack messages and the message classes in order
+      // of priority, each up to its budget, and go round again while any
+      // has more. A burst in one class holds up the others for at most one
+      // budget, so e.g. formatting samples can't stall ATT handling.
+      do
       {
-        uint8 safeToDealloc = TRUE;
+        uint8_t c;
+
+        przPendingEvts |= Event_pend(hPrzEvent, Event_Id_NONE,
+                                     PRZ_ALL_MSG_CLASS_EVTS, BIOS_NO_WAIT);
 
-        if ((src == ICALL_SERVICE_CLASS_BLE) && (dest == selfEntity))
+        more = user_processStackMsgs(PRZ_STACK_MSG_BUDGET);
+
+        for (c = 0; c < APP_NUM_MSG_CLASSES; c++)
         {
-          ICall_Stack_Event *pEvt = (ICall_Stack_Event *)pMsg;
+          if (!(przPendingEvts & PRZ_MSG_CLASS_EVT(c)))
+          {
+            continue;
+          }
 
-          // Check for event flags received (event signature 0xffff)
-          if (pEvt->signature == 0xffff)
+          if (user_processMsgClass((app_msg_class_t)c, przMsgClassBudget[c]))
           {
-            // Event received when a connection event is completed
-            if (pEvt->event_flag & PRZ_CONN_EVT_END_EVT)
-            {
-              // Try to retransmit pending ATT Response (if any)
-              ProjectZero_sendAttRsp();
-            }
+            more = TRUE;
           }
-          else // It's a message from the stack and not an event.
+          else
           {
-            // Process inter-task message
-            safeToDealloc = ProjectZero_processStackMsg((ICall_Hdr *)pMsg);
+            przPendingEvts &= ~PRZ_MSG_CLASS_EVT(c);
           }
         }
+      } while (more);
 
-        if (pMsg && safeToDealloc)
-        {
-          ICall_freeMsg(pMsg);
-        }
+      // Samples timed to arrive just before a connection event, and
+      // samples a peer asked for, are sent right away to go out in the
+      // next event.
+      uint8_t urgent = SC_execSensorAnswered();
+      if ((urgent || SC_connEvtSynced()) && Notify_pending())
+      {
+        Notify_flush();
+        user_updateConnEvtNotice();
       }
+    }
+  }
+}
 
-      // Process messages sent from another task or another context.
-      while (!Queue_empty(hApplicationMsgQ))
-      {
-        app_msg_t *pMsg = Queue_dequeue(hApplicationMsgQ);
 
-        // Process application-layer message probably sent from ourselves.
-        user_processApplicationMessage(pMsg);
+/*
+ * @brief   Handle messages from the BLE Stack.
+ *
+ * @param   budget  Most messages to handle now.
+ *
+ * @return  TRUE if the budget ran out, so more may be waiting.
+ */
+static uint8_t user_processStackMsgs(uint8_t budget)
+{
+  while (budget--)
+  {
+    ICall_EntityID dest;
+    ICall_ServiceEnum src;
+    ICall_HciExtEvt *pMsg = NULL;
+
+    // Check if we got a signal because of a stack message
+    if (ICall_fetchServiceMsg(&src, &dest,
+                              (void **)&pMsg) != ICALL_ERRNO_SUCCESS)
+    {
+      return FALSE;
+    }
+
+    uint8 safeToDealloc = TRUE;
+
+    if ((src == ICALL_SERVICE_CLASS_BLE) && (dest == selfEntity))
+    {
+      ICall_Stack_Event *pEvt = (ICall_Stack_Event *)pMsg;
 
-        // Free the received message.
-        ICall_free(pMsg);
+      // Check for event flags received (event signature 0xffff)
+      if (pEvt->signature == 0xffff)
+      {
+        // Event received when a connection event is completed
+        if (pEvt->event_flag & PRZ_CONN_EVT_END_EVT)
+        {
+          // Try to retransmit pending ATT Response (if any)
+          ProjectZero_sendAttRsp();
+
+          // Send the characteristic updates staged since the last
+          // connection event in one burst.
+          Notify_flush();
+
+          // Statistics of the windows that ended, then resend records
+          // a central asked for, with what room is left.
+          user_sendStats();
+          user_sendGapFill();
+          user_sendHistory();
+          user_runThroughputTest();
+
+          // Keep the sampling tick in phase with the connection events.
+          if (SC_connEvtSyncPending())
+          {
+            uint16_t connInterval = 0;
+            GAPRole_GetParameter(GAPROLE_CONN_INTERVAL, &connInterval);
+            SC_connEvtEnd(connInterval);
+          }
+          user_updateConnEvtNotice();
+        }
+      }
+      else // It's a message from the stack and not an event.
+      {
+        // Process inter-task message
+        safeToDealloc = ProjectZero_processStackMsg((ICall_Hdr *)pMsg);
       }
     }
+
+    if (pMsg && safeToDealloc)
+    {
+      ICall_freeMsg(pMsg);
+    }
   }
+
+  return TRUE;
+}
+
+
+/*
+ * @brief   Handle the messages of one class, oldest first.
+ *
+ * @param   msgClass  Class to handle.
+ * @param   budget    Most messages to handle now.
+ *
+ * @return  TRUE if messages are left in the class queue.
+ */
+static uint8_t user_processMsgClass(app_msg_class_t msgClass, uint8_t budget)
+{
+  Queue_Handle hQueue = hApplicationMsgQ[msgClass];
+
+  while (budget-- && !Queue_empty(hQueue))
+  {
+    app_msg_t *pMsg = Queue_dequeue(hQueue);
+    Diag_msgDequeued(msgClass,
+                     (Clock_getTicks() - pMsg->enqTick) * Clock_tickPeriod);
+
+    // Process application-layer message probably sent from ourselves.
+    user_processApplicationMessage(pMsg);
+
+    // Free the received message.
+    ICall_free(pMsg);
+  }
+
+  return !Queue_empty(hQueue);
 }
 
 
@@ -526,7 +729,12 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
     case APP_MSG_SERVICE_WRITE: /* Message about received value write */
       /* Call different handler per service */
       switch(pCharData->svcUUID) {
-
+        case BLESERVICE_SERV_UUID:
+          user_BleService_ValueChangeHandler(pCharData);
+          break;
+        case DIAGSERVICE_SERV_UUID:
+          user_DiagService_ValueChangeHandler(pCharData);
+          break;
       }
       break;
 
@@ -550,9 +758,7 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
     case APP_MSG_SEND_PASSCODE: /* Message about pairing PIN request */
       {
         passcode_req_t *pReq = (passcode_req_t *)pMsg->pdu;
-        //Log_info2("BondMgr Requested passcode. We are %s passcode %06d",
-        //          (IArg)(pReq->uiInputs?"Sending":"Displaying"),
-        //          DEFAULT_PASSCODE);
+        TRACE1(TRACE_PASSCODE_REQ, pReq->uiInputs);
         // Send passcode response.
         GAPBondMgr_PasscodeRsp(pReq->connHandle, SUCCESS, DEFAULT_PASSCODE);
       }
@@ -562,7 +768,32 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
       break;
 
     case APP_MSG_SC_TASK_ALERT:
+      Latency_beginSample();
+      Latency_record(LATENCY_STAGE_DEQUEUE);
       SC_processTaskAlert();
+      user_publishSampleRange();
+      // While connected they go out after the sample, at the connection
+      // event end.
+      if (przConnHandle == INVALID_CONNHANDLE)
+      {
+        user_sendStats();
+      }
+      break;
+
+    case APP_MSG_SC_CTRL_RETRY:
+      SC_processCtrlRetry();
+      break;
+
+    case APP_MSG_SC_PH_READ:
+      SC_processPhRead();
+      break;
+
+    case APP_MSG_DIAG_REFRESH:
+      user_refreshDiagnostics();
+      break;
+
+    case APP_MSG_ROLLUP_STORE:
+      Rollup_store();
       break;
 
   }
@@ -618,39 +849,53 @@ static void user_processGapStateChangeEvt(gaprole_States_t newState)
 
         // Display device address
         char *cstr_ownAddress = Util_convertBdAddr2Str(ownAddress);
-        //Log_info1("GAP is started. Our address: \x1b[32m%s\x1b[0m", (IArg)cstr_ownAddress);
+        TRACE0(TRACE_GAP_STARTED);
       }
       break;
 
     case GAPROLE_ADVERTISING:
-      //Log_info0("Advertising");
+      TRACE0(TRACE_GAP_ADVERTISING);
       break;
 
     case GAPROLE_CONNECTED:
       {
+        static uint8_t everConnected = FALSE;
         uint8_t peerAddress[B_ADDR_LEN];
 
+        if (everConnected)
+        {
+          Diag_count(DIAG_CNT_RECONNECTS);
+        }
+        everConnected = TRUE;
+
         GAPRole_GetParameter(GAPROLE_CONN_BD_ADDR, peerAddress);
+        GAPRole_GetParameter(GAPROLE_CONNHANDLE, &przConnHandle);
+
+        // Align sampling to this connection's events.
+        SC_connectionChanged(TRUE);
+        user_updateConnEvtNotice();
 
         char *cstr_peerAddress = Util_convertBdAddr2Str(peerAddress);
-        //Log_info1("Connected. Peer address: \x1b[32m%s\x1b[0m", (IArg)cstr_peerAddress);
+        TRACE0(TRACE_GAP_CONNECTED);
        }
       break;
 
     case GAPROLE_CONNECTED_ADV:
-      //Log_info0("Connected and advertising");
+      TRACE0(TRACE_GAP_CONNECTED_ADV);
       break;
 
     case GAPROLE_WAITING:
-     // Log_info0("Disconnected / Idle");
+      TRACE0(TRACE_GAP_WAITING);
+      user_connectionClosed();
       break;
 
     case GAPROLE_WAITING_AFTER_TIMEOUT:
-     // Log_info0("Connection timed out");
+      TRACE0(TRACE_GAP_TIMEOUT);
+      user_connectionClosed();
       break;
 
     case GAPROLE_ERROR:
-     // Log_info0("Error");
+      TRACE0(TRACE_GAP_ERROR);
       break;
 
     default:
@@ -688,13 +933,11 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
     break;
   }
 
+  TRACE2(TRACE_CCCD_CHANGE, pCharData->paramID, configValue);
+
   switch (pCharData->paramID)
   {
     case BLESERVICE_TEMPERATUREVALUE:
-    //  Log_info3("CCCD Change msg: %s %s: %s",
-    //            (IArg)"BLE Service",
-    //            (IArg)"Stream",
-    //            (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
@@ -702,10 +945,6 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
       break;
 
     case BLESERVICE_PRESSUREVALUE:
-    //  Log_info3("CCCD Change msg: %s %s: %s",
-    //            (IArg)"BLE Service",
-    //            (IArg)"Stream",
-    //            (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
@@ -713,10 +952,6 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
       break;
 
     case BLESERVICE_FLOWVALUE:
-     // Log_info3("CCCD Change msg: %s %s: %s",
-     //           (IArg)"BLE Service",
-     //           (IArg)"Stream",
-     //           (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
@@ -724,10 +959,6 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
       break;
 
     case BLESERVICE_CONDUCTIVITYVALUE:
-     // Log_info3("CCCD Change msg: %s %s: %s",
-     //           (IArg)"BLE Service",
-     //           (IArg)"Stream",
-     //           (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
@@ -735,20 +966,12 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
       break;
 
     case BLESERVICE_TURBIDITYVALUE:
-     // Log_info3("CCCD Change msg: %s %s: %s",
-     //           (IArg)"BLE Service",
-     //           (IArg)"Stream",
-     //           (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
       // ...
 
     case BLESERVICE_PHVALUE:
-     // Log_info3("CCCD Change msg: %s %s: %s",
-     //           (IArg)"BLE Service",
-     //           (IArg)"Stream",
-     //           (IArg)configValString);
       // -------------------------
       // Do something useful with configValue here. It tells you whether someone
       // wants to know the state of this characteristic.
@@ -759,6 +982,103 @@ void user_BleService_CfgChangeHandler(char_data_t *pCharData)
 
 
 
+/*
+ * @brief   Handle a write request sent from a peer device to a characteristic
+ *          in the BLE Service.
+ *
+ * @param   pCharData  pointer to malloc'd char write data
+ *
+ * @return  None.
+ */
+void user_BleService_ValueChangeHandler(char_data_t *pCharData)
+{
+  switch (pCharData->paramID)
+  {
+    case BLESERVICE_GAPFILL:
+      {
+        uint8_t *pData = pCharData->data;
+        uint32_t first = BUILD_UINT32(pData[0], pData[1], pData[2], pData[3]);
+        uint32_t last = BUILD_UINT32(pData[4], pData[5], pData[6], pData[7]);
+        uint16_t found = SampleLog_requestResend(first, last);
+
+        TRACE2(TRACE_GAP_FILL, found, first);
+        user_updateConnEvtNotice();
+      }
+      break;
+
+    case BLESERVICE_SAMPLENOW:
+      SC_execSensor();
+      break;
+
+    case BLESERVICE_STATS:
+      {
+        const stats_rec_t *pRes = Stats_getResult(pCharData->data[0],
+                                                  pCharData->data[1]);
+        if (pRes != NULL)
+        {
+          BleService_SetParameter(BLESERVICE_STATS_SELECTED,
+                                  BLESERVICE_STATS_LEN, (void *)pRes);
+        }
+      }
+      break;
+
+    case BLESERVICE_HISTORY:
+      {
+        history_query_t query;
+        uint8_t res;
+
+        memcpy(&query, pCharData->data, sizeof(query));
+        res = Rollup_query(&query);
+
+        TRACE2(TRACE_HISTORY_QUERY, res, query.fromSec);
+        user_updateConnEvtNotice();
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+/*
+ * @brief   Handle a write request sent from a peer device to a characteristic
+ *          in the Diagnostics Service.
+ *
+ * @param   pCharData  pointer to malloc'd char write data
+ *
+ * @return  None.
+ */
+void user_DiagService_ValueChangeHandler(char_data_t *pCharData)
+{
+  switch (pCharData->paramID)
+  {
+    case DIAGSERVICE_TRACE:
+      Trace_control(pCharData->data[0]);
+      break;
+
+    case DIAGSERVICE_TPUT:
+      if (pCharData->data[0] == TPUT_CMD_START &&
+          przConnHandle != INVALID_CONNHANDLE)
+      {
+        Tput_start(przConnHandle);
+
+        // Fill the stack buffers now rather than a connection event later.
+        user_runThroughputTest();
+        user_updateConnEvtNotice();
+      }
+      else if (pCharData->data[0] == TPUT_CMD_STOP)
+      {
+        user_stopThroughputTest();
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+
 /*
  * @brief   Process an incoming BLE stack message.
  *
@@ -788,7 +1108,7 @@ static uint8_t ProjectZero_processStackMsg(ICall_Hdr *pMsg)
         {
           case HCI_COMMAND_COMPLETE_EVENT_CODE:
             // Process HCI Command Complete Event
-           // Log_info0("HCI Command Complete Event received");
+            TRACE0(TRACE_HCI_CMD_COMPLETE);
             break;
 
           default:
@@ -816,14 +1136,15 @@ static uint8_t ProjectZero_processGATTMsg(gattMsgEvent_t *pMsg)
   // See if GATT server was unable to transmit an ATT response
   if (pMsg->hdr.status == blePending)
   {
-    //Log_warning1("Outgoing RF FIFO full. Re-schedule transmission of msg with opcode 0x%02x",
-    //  pMsg->method);
+    TRACE1(TRACE_ATT_RSP_PENDING, pMsg->method);
 
     // No HCI buffer was available. Let's try to retransmit the response
     // on the next connection event.
     if (HCI_EXT_ConnEventNoticeCmd(pMsg->connHandle, selfEntity,
                                    PRZ_CONN_EVT_END_EVT) == SUCCESS)
     {
+      connEvtNoticeOn = TRUE;
+
       // First free any pending response
       ProjectZero_freeAttRsp(FAILURE);
 
@@ -841,18 +1162,17 @@ static uint8_t ProjectZero_processGATTMsg(gattMsgEvent_t *pMsg)
     // The app is informed in case it wants to drop the connection.
 
     // Log the opcode of the message that caused the violation.
-    //Log_error1("Flow control violated. Opcode of offending ATT msg: 0x%02x",
-    //  pMsg->msg.flowCtrlEvt.opcode);
+    TRACE1(TRACE_ATT_FLOW_CTRL, pMsg->msg.flowCtrlEvt.opcode);
   }
   else if (pMsg->method == ATT_MTU_UPDATED_EVENT)
   {
     // MTU size updated
-   // Log_info1("MTU Size change: %d bytes", pMsg->msg.mtuEvt.MTU);
+    TRACE1(TRACE_MTU_UPDATED, pMsg->msg.mtuEvt.MTU);
   }
   else
   {
     // Got an expected GATT message from a peer.
-   // Log_info1("Recevied GATT Message. Opcode: 0x%02x", pMsg->method);
+    TRACE1(TRACE_GATT_MSG, pMsg->method);
   }
 
   // Free message payload. Needed only for ATT Protocol messages
@@ -895,17 +1215,17 @@ static void ProjectZero_sendAttRsp(void)
     status = GATT_SendRsp(pAttRsp->connHandle, pAttRsp->method, &(pAttRsp->msg));
     if ((status != blePending) && (status != MSG_BUFFER_NOT_AVAIL))
     {
-      // Disable connection event end notice
-      HCI_EXT_ConnEventNoticeCmd(pAttRsp->connHandle, selfEntity, 0);
-
       // We're done with the response message
       ProjectZero_freeAttRsp(status);
+
+      // Disable connection event end notice, unless staged updates still
+      // wait for it
+      user_updateConnEvtNotice();
     }
     else
     {
       // Continue retrying
-      //Log_warning2("Retrying message with opcode 0x%02x. Attempt %d",
-      //  pAttRsp->method, rspTxRetry);
+      TRACE2(TRACE_ATT_RSP_RETRY, pAttRsp->method, rspTxRetry);
     }
   }
 }
@@ -925,13 +1245,11 @@ static void ProjectZero_freeAttRsp(uint8_t status)
     // See if the response was sent out successfully
     if (status == SUCCESS)
     {
-     // Log_info2("Sent message with opcode 0x%02x. Attempt %d",
-     //   pAttRsp->method, rspTxRetry);
+      TRACE2(TRACE_ATT_RSP_SENT, pAttRsp->method, rspTxRetry);
     }
     else
     {
-    //  Log_error2("Gave up message with opcode 0x%02x. Status: %d",
-    //    pAttRsp->method, status);
+      TRACE2(TRACE_ATT_RSP_FAILED, pAttRsp->method, status);
 
       // Free response payload
       GATT_bm_free(&pAttRsp->msg, pAttRsp->method);
@@ -968,7 +1286,7 @@ static void ProjectZero_freeAttRsp(uint8_t status)
  */
 static void user_gapStateChangeCB(gaprole_States_t newState)
 {
- // Log_info1("(CB) GAP State change: %d, Sending msg to app.", (IArg)newState);
+  TRACE1(TRACE_GAP_STATE_CB, newState);
   user_enqueueRawAppMsg( APP_MSG_GAP_STATE_CHANGE, (uint8_t *)&newState, sizeof(newState) );
 }
 
@@ -1012,24 +1330,24 @@ static void user_gapBondMgr_pairStateCB(uint16_t connHandle, uint8_t state,
 {
   if (state == GAPBOND_PAIRING_STATE_STARTED)
   {
-  //  Log_info0("Pairing started");
+    TRACE0(TRACE_PAIRING_STARTED);
   }
   else if (state == GAPBOND_PAIRING_STATE_COMPLETE)
   {
     if (status == SUCCESS)
     {
-    //  Log_info0("Pairing completed successfully.");
+      TRACE0(TRACE_PAIRING_COMPLETE);
     }
     else
     {
-    //  Log_error1("Pairing failed. Error: %02x", status);
+      TRACE1(TRACE_PAIRING_FAILED, status);
     }
   }
   else if (state == GAPBOND_PAIRING_STATE_BONDED)
   {
     if (status == SUCCESS)
     {
-    // Log_info0("Re-established pairing from stored bond info.");
+      TRACE0(TRACE_PAIRING_BONDED);
     }
   }
 }
@@ -1042,8 +1360,7 @@ static void user_service_ValueChangeCB( uint16_t connHandle, uint16_t svcUuid,
                                         uint16_t len )
 {
   // See the service header file to compare paramID with characteristic.
- // Log_info2("(CB) Characteristic value change: svc(0x%04x) paramID(%d). "
- //           "Sending msg to app.", (IArg)svcUuid, (IArg)paramID);
+  TRACE2(TRACE_CHAR_WRITE_CB, paramID, svcUuid);
   user_enqueueCharDataMsg(APP_MSG_SERVICE_WRITE, connHandle, svcUuid, paramID,
                           pValue, len);
 }
@@ -1055,8 +1372,7 @@ static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid,
                                       uint8_t paramID, uint8_t *pValue,
                                       uint16_t len )
 {
- // Log_info2("(CB) Char config change: svc(0x%04x) paramID(%d). "
- //           "Sending msg to app.", (IArg)svcUuid, (IArg)paramID);
+  TRACE2(TRACE_CHAR_CFG_CB, paramID, svcUuid);
   user_enqueueCharDataMsg(APP_MSG_SERVICE_CFG, connHandle, svcUuid,
                           paramID, pValue, len);
 }
@@ -1065,6 +1381,19 @@ static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid,
  *  Callbacks from Swi-context
  *****************************************************************************/
 
+/*
+ * @brief  Diagnostics refresh clock handler.
+ *
+ *         Service values can't be updated from Swi context, so hand the work
+ *         to the application task.
+ *
+ * @param  arg - not used
+ */
+static void user_diagClockSwiFxn(UArg arg)
+{
+  user_enqueueRawAppMsg(APP_MSG_DIAG_REFRESH, NULL, 0);
+}
+
 
 /*
  *  Callbacks from Hwi-context
@@ -1079,6 +1408,55 @@ static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid,
  ****************************************************************************
  *****************************************************************************/
 
+/*
+ * @brief  Get the class of an application message, which sets the queue
+ *         it waits in and its priority.
+ *
+ * @param  type  Type of the message.
+ *
+ * @return The class.
+ */
+static app_msg_class_t user_msgClass(app_msg_types_t type)
+{
+  switch (type)
+  {
+    case APP_MSG_SC_TASK_ALERT:
+    case APP_MSG_SC_CTRL_READY:
+    case APP_MSG_SC_CTRL_RETRY:
+    case APP_MSG_SC_PH_READ:
+    case APP_MSG_UPDATE_CHARVAL:
+      return APP_MSG_CLASS_SENSOR;
+
+    case APP_MSG_DIAG_REFRESH:
+    case APP_MSG_ROLLUP_STORE:
+      return APP_MSG_CLASS_HOUSEKEEPING;
+
+    default:
+      return APP_MSG_CLASS_GATT;
+  }
+}
+
+/*
+ * @brief  Put a message on the queue of its class and wake the task.
+ *
+ * @note   May be called from Hwi, Swi or Task context.
+ *
+ * @param  pMsg  Message, type and payload filled in.
+ */
+static void user_postAppMsg(app_msg_t *pMsg)
+{
+  app_msg_class_t msgClass = user_msgClass(pMsg->type);
+
+  pMsg->enqTick = Clock_getTicks();
+
+  // Enqueue the message using pointer to queue node element.
+  Queue_enqueue(hApplicationMsgQ[msgClass], &pMsg->_elem);
+  Diag_msgEnqueued();
+  // Let application know there's a message, and of which class.
+  Event_post(hPrzEvent, PRZ_MSG_CLASS_EVT(msgClass));
+  Semaphore_post(sem);
+}
+
 /*
  * @brief  Generic message constructor for characteristic data.
  *
@@ -1127,10 +1505,12 @@ void user_enqueueCharDataMsg( app_msg_types_t appMsgType,
     memcpy(pCharData->data, pValue, readLen);
     // Update pCharData with how much data we received.
     pCharData->dataLen = readLen;
-    // Enqueue the message using pointer to queue node element.
-    Queue_enqueue(hApplicationMsgQ, &pMsg->_elem);
-    // Let application know there's a message.
-    Semaphore_post(sem);
+    user_postAppMsg(pMsg);
+  }
+  else if (appMsgType == APP_MSG_SC_TASK_ALERT ||
+           appMsgType == APP_MSG_UPDATE_CHARVAL)
+  {
+    Diag_count(DIAG_CNT_SAMPLES_DROPPED);
   }
 }
 
@@ -1156,10 +1536,12 @@ void user_enqueueRawAppMsg(app_msg_types_t appMsgType, uint8_t *pData,
     // Copy data into message
     memcpy(pMsg->pdu, pData, len);
 
-    // Enqueue the message using pointer to queue node element.
-    Queue_enqueue(hApplicationMsgQ, &pMsg->_elem);
-    // Let application know there's a message.
-    Semaphore_post(sem);
+    user_postAppMsg(pMsg);
+  }
+  else if (appMsgType == APP_MSG_SC_TASK_ALERT ||
+           appMsgType == APP_MSG_UPDATE_CHARVAL)
+  {
+    Diag_count(DIAG_CNT_SAMPLES_DROPPED);
   }
 }
 
@@ -1174,13 +1556,258 @@ void user_enqueueRawAppMsg(app_msg_types_t appMsgType, uint8_t *pData,
  */
 static void user_updateCharVal(char_data_t *pCharData)
 {
+  Latency_record(LATENCY_STAGE_UPDATE_CHARVAL);
+
   bStatus_t (*setParamFxn)(uint8_t, uint16_t, void*) = NULL;
   switch(pCharData->svcUUID) {
   case    BLESERVICE_SERV_UUID: setParamFxn = BleService_SetParameter;    break;
   }
 
-  if (setParamFxn != NULL) {
-    setParamFxn(pCharData->paramID, pCharData->dataLen, pCharData->data);
+  if (setParamFxn == NULL) {
+    return;
+  }
+
+  if (przConnHandle == INVALID_CONNHANDLE)
+  {
+    // Nobody to notify, just keep the characteristic current.
+    if (setParamFxn(pCharData->paramID, pCharData->dataLen, pCharData->data) != SUCCESS)
+    {
+      Diag_count(DIAG_CNT_NOTI_FAILURES);
+    }
+    return;
+  }
+
+  // Hold the value until the connection event ends so all updates of a
+  // sample period are sent in the same connection event. If it can't be
+  // staged, send it now; it is queued for retry on the next connection
+  // event if the stack is out of buffers.
+  if (!Notify_stage(setParamFxn, pCharData->paramID, pCharData->data,
+                    pCharData->dataLen))
+  {
+    Notify_write(setParamFxn, pCharData->paramID, pCharData->data,
+                 pCharData->dataLen);
+  }
+
+  user_updateConnEvtNotice();
+}
+
+
+/*
+ * @brief  Turn the connection event end notice on while a staged or queued
+ *         update, a gap fill, the throughput test, sampling alignment or an
+ *         ATT response waits for it, and off otherwise so the task is
+ *         not woken every connection event for nothing.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_updateConnEvtNotice(void)
+{
+  uint8_t wanted = (pAttRsp != NULL || Notify_pending() ||
+                    SampleLog_nextResend() != NULL ||
+                    Stats_nextPublish() != NULL ||
+                    Rollup_queryPending() ||
+                    Tput_isRunning() || SC_connEvtSyncPending()) ? TRUE : FALSE;
+
+  if (przConnHandle == INVALID_CONNHANDLE || wanted == connEvtNoticeOn)
+  {
+    return;
+  }
+
+  if (HCI_EXT_ConnEventNoticeCmd(przConnHandle, selfEntity,
+                                 wanted ? PRZ_CONN_EVT_END_EVT : 0) == SUCCESS)
+  {
+    connEvtNoticeOn = wanted;
+  }
+}
+
+
+/*
+ * @brief  Forget the connection. Values still staged or waiting for a retry
+ *         are written to the services so their characteristics read back
+ *         current.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_connectionClosed(void)
+{
+  przConnHandle = INVALID_CONNHANDLE;
+  connEvtNoticeOn = FALSE;
+
+  Notify_connectionClosed();
+  SampleLog_cancelResend();
+  Rollup_cancelQuery();
+  user_stopThroughputTest();
+  SC_connectionChanged(FALSE);
+}
+
+
+/*
+ * @brief  Resend the records of a gap fill request until the stack runs out
+ *         of buffers; the rest goes out after the next connection event.
+ *         Live updates go first, so nothing is resent while any wait.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_sendGapFill(void)
+{
+  const sample_rec_t *pRec;
+
+  if (Notify_pending())
+  {
+    return;
+  }
+
+  while ((pRec = SampleLog_nextResend()) != NULL)
+  {
+    uint8_t status = BleService_SetParameter(BLESERVICE_RECORD,
+                                             BLESERVICE_RECORD_LEN,
+                                             (void *)pRec);
+    if (Notify_isRetryable(status))
+    {
+      break;
+    }
+
+    SampleLog_resendDone();
+  }
+}
+
+
+/*
+ * @brief  Notify the statistics of the windows that ended until the stack
+ *         runs out of buffers; the rest goes out after the next connection
+ *         event. Live updates go first, so nothing is sent while any wait.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_sendStats(void)
+{
+  const stats_rec_t *pRes;
+
+  if (Notify_pending())
+  {
+    return;
+  }
+
+  while ((pRes = Stats_nextPublish()) != NULL)
+  {
+    uint8_t status = BleService_SetParameter(BLESERVICE_STATS,
+                                             BLESERVICE_STATS_LEN,
+                                             (void *)pRes);
+    if (Notify_isRetryable(status))
+    {
+      break;
+    }
+
+    Stats_publishDone();
+  }
+}
+
+
+/*
+ * @brief  Send the answer to a history query until the stack runs out of
+ *         buffers; the rest goes out after the next connection event.
+ *         Live updates go first, so nothing is sent while any wait.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_sendHistory(void)
+{
+  const history_rec_t *pRec;
+
+  if (Notify_pending())
+  {
+    return;
+  }
+
+  while ((pRec = Rollup_nextQueryRec()) != NULL)
+  {
+    uint8_t status = BleService_SetParameter(BLESERVICE_HISTORY,
+                                             BLESERVICE_HISTORY_LEN,
+                                             (void *)pRec);
+    if (Notify_isRetryable(status))
+    {
+      break;
+    }
+
+    Rollup_queryRecDone();
+  }
+}
+
+
+/*
+ * @brief  Push throughput test notifications while the test runs, and
+ *         publish the report if it ended because the peer unsubscribed.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_runThroughputTest(void)
+{
+  if (Tput_isRunning())
+  {
+    Tput_onConnEvt();
+
+    if (!Tput_isRunning())
+    {
+      DiagService_SetParameter(DIAGSERVICE_TPUT, DIAGSERVICE_TPUT_LEN,
+                               Tput_getReport());
+    }
+  }
+}
+
+
+/*
+ * @brief  End the throughput test, if running, and publish its report.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_stopThroughputTest(void)
+{
+  if (Tput_isRunning())
+  {
+    Tput_stop();
+    DiagService_SetParameter(DIAGSERVICE_TPUT, DIAGSERVICE_TPUT_LEN,
+                             Tput_getReport());
+  }
+}
+
+
+/*
+ * @brief  Show the sequence numbers still available for gap fill on the
+ *         GapFill characteristic.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_publishSampleRange(void)
+{
+  sample_range_t range;
+
+  SampleLog_getRange(&range);
+  BleService_SetParameter(BLESERVICE_GAPFILL, BLESERVICE_GAPFILL_LEN, &range);
+}
+
+
+/*
+ * @brief  Copy the current diagnostics into the diagnostics service.
+ *
+ * @note   Must run in Task context in case BLE Stack APIs are invoked.
+ */
+static void user_refreshDiagnostics(void)
+{
+  const diag_block_t *pDiag = Diag_update();
+  uint8_t newAlarms = Diag_takeNewAlarms();
+
+  DiagService_SetParameter(DIAGSERVICE_LATENCYHIST, DIAGSERVICE_LATENCYHIST_LEN,
+                           Latency_getHistograms());
+  DiagService_SetParameter(DIAGSERVICE_COUNTERS, DIAGSERVICE_COUNTERS_LEN,
+                           pDiag);
+
+  // Soft alarm: tell a subscribed peer as soon as a stack or the heap gets
+  // close to its limit, while there is still room to react.
+  if (newAlarms)
+  {
+    TRACE1(TRACE_RESOURCE_ALARM, newAlarms);
+    DiagService_SetParameter(DIAGSERVICE_ALARM, DIAGSERVICE_ALARM_LEN,
+                             &pDiag->alarms);
   }
 }
 
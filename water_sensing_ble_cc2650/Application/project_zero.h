@@ -63,17 +63,43 @@ typedef enum
   APP_MSG_SEND_PASSCODE,       /* A pass-code/PIN is requested during pairing */
   APP_MSG_SC_TASK_ALERT,       /* Sensor Controller generated Task Alert      */
   APP_MSG_SC_CTRL_READY,       /* Sensor Controller generated Ctrl Ready      */
-  APP_MSG_SC_EXEC_RANGER,      /* Sensor Controller execute ranger task once  */
+  APP_MSG_SC_CTRL_RETRY,       /* Sensor Controller control interface retry   */
+  APP_MSG_SC_PH_READ,          /* A read of the pH probe is done              */
+  APP_MSG_DIAG_REFRESH,        /* Time to refresh the diagnostics service     */
+  APP_MSG_ROLLUP_STORE,        /* Rollups wait to be written to flash         */
 } app_msg_types_t;
 
+// Classes of application messages, each with its own queue. Listed by
+// priority, highest first. Messages from the BLE Stack come before all.
+typedef enum
+{
+  APP_MSG_CLASS_GATT = 0,      /* Peer writes, GAP state and pairing          */
+  APP_MSG_CLASS_SENSOR,        /* Sensor Controller events and sample updates */
+  APP_MSG_CLASS_HOUSEKEEPING,  /* Diagnostics refresh, rollup storage        */
+  APP_NUM_MSG_CLASSES
+} app_msg_class_t;
+
 // Struct for messages sent to the application task
 typedef struct
 {
   Queue_Elem       _elem;
   app_msg_types_t  type;
+  uint32_t         enqTick;    // Clock tick when enqueued
   uint8_t          pdu[];
 } app_msg_t;
 
+// Sensor Controller control requests, see SC_ctrlRequest.
+typedef enum
+{
+  SC_CTRL_START = 0,           /* Start the tasks                             */
+  SC_CTRL_STOP,                /* Stop the tasks                              */
+  SC_CTRL_EXECUTE,             /* Run the execution code of the tasks once    */
+} sc_ctrl_op_t;
+
+// Called when a control request is done. result is a SCIF_RESULT_T.
+typedef void (*scCtrlDoneCb_t)(sc_ctrl_op_t op, uint16_t bvTaskIds,
+                               uint8_t result);
+
 // Struct for messages about characteristic data
 typedef struct
 {
@@ -116,8 +142,17 @@ void user_toggleLED(uint8_t n);
 // SC Task
 void SC_init(void);
 void SC_processCtrlReady(void);
+void SC_processCtrlRetry(void);
+void SC_processPhRead(void);
+uint8_t SC_ctrlRequest(sc_ctrl_op_t op, uint16_t bvTaskIds,
+                       scCtrlDoneCb_t pfnDone);
 void SC_processTaskAlert(void);
-void SC_execRanger(void);
+void SC_execSensor(void);
+uint8_t SC_execSensorAnswered(void);
+void SC_connEvtEnd(uint16_t connInterval);
+uint8_t SC_connEvtSyncPending(void);
+uint8_t SC_connEvtSynced(void);
+void SC_connectionChanged(uint8_t connected);
 
 
 /*********************************************************************
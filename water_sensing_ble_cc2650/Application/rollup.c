@@ -0,0 +1,867 @@
+/*
+ * Downsampled sample history in external flash, see rollup.h.
+ *
+ * Each resolution keeps a running rollup in RAM. A sample goes into the
+ * finest one; when a rollup's period is over it is stored and merged into
+ * the next coarser rollup, so a day is built from hours and an hour from
+ * minutes without going back to flash.
+ *
+ * A ring is a run of flash pages holding ROLLUP_RECS_PER_PAGE rollups
+ * each, written in time order. The page the next rollup starts is erased
+ * first, dropping the oldest rollups, which is why a ring has one page
+ * more than its retention needs. Nothing but the rollups is stored: at
+ * init the newest page is the one whose first rollup is the newest, and
+ * the first erased slot in it is where writing goes on.
+ *
+ * The flash is opened for each access and closed again, so the OAD target
+ * can still take it for a download. Finished rollups wait in RAM, one per
+ * resolution, until Rollup_store writes them from a housekeeping message,
+ * so page erases never hold up the sample path. While the OAD target has
+ * the flash, or an erase or write fails, they keep waiting.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+
+#include <driverlib/aon_rtc.h>
+
+#include <ti/mw/extflash/ExtFlash.h>
+#include <ext_flash_layout.h>
+
+#include "rollup.h"
+#include "stats.h"
+#include "diag.h"
+
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// OAD image slots, see ext_flash_layout.h. Layouts that do not give the
+// stack and recovery image sizes use slots the size of the application's.
+#ifdef EFL_SIZE_IMAGE_BLE
+#define ROLLUP_SIZE_IMAGE_BLE      EFL_SIZE_IMAGE_BLE
+#else
+#define ROLLUP_SIZE_IMAGE_BLE      EFL_SIZE_IMAGE_APP
+#endif
+#ifdef EFL_SIZE_RECOVERY
+#define ROLLUP_SIZE_RECOVERY       EFL_SIZE_RECOVERY
+#else
+#define ROLLUP_SIZE_RECOVERY       EFL_SIZE_IMAGE_APP
+#endif
+
+#define ROLLUP_END_IMAGE_APP       (EFL_ADDR_IMAGE_APP + EFL_SIZE_IMAGE_APP)
+#define ROLLUP_END_IMAGE_BLE       (EFL_ADDR_IMAGE_BLE + ROLLUP_SIZE_IMAGE_BLE)
+#define ROLLUP_END_RECOVERY        (EFL_ADDR_RECOVERY + ROLLUP_SIZE_RECOVERY)
+#define ROLLUP_END_IMAGES          ((ROLLUP_END_IMAGE_APP > ROLLUP_END_IMAGE_BLE) ? \
+                                    ROLLUP_END_IMAGE_APP : ROLLUP_END_IMAGE_BLE)
+
+// External flash kept for rollups: above the application and stack
+// images, and below the recovery image if it sits at the top of the flash,
+// else above it too.
+#ifndef ROLLUP_FLASH_BASE
+#if ROLLUP_END_RECOVERY >= EFL_FLASH_SIZE || ROLLUP_END_RECOVERY <= ROLLUP_END_IMAGES
+#define ROLLUP_FLASH_BASE          ROLLUP_END_IMAGES
+#else
+#define ROLLUP_FLASH_BASE          ROLLUP_END_RECOVERY
+#endif
+#endif
+
+#ifndef ROLLUP_FLASH_END
+#if ROLLUP_END_RECOVERY >= EFL_FLASH_SIZE
+#define ROLLUP_FLASH_END           EFL_ADDR_RECOVERY
+#else
+#define ROLLUP_FLASH_END           EFL_FLASH_SIZE
+#endif
+#endif
+
+#define ROLLUP_OVERLAPS(addr, size) \
+  ((addr) < ROLLUP_FLASH_END && (addr) + (size) > ROLLUP_FLASH_BASE)
+
+#if ROLLUP_OVERLAPS(EFL_ADDR_IMAGE_APP, EFL_SIZE_IMAGE_APP) || \
+    ROLLUP_OVERLAPS(EFL_ADDR_IMAGE_BLE, ROLLUP_SIZE_IMAGE_BLE) || \
+    ROLLUP_OVERLAPS(EFL_ADDR_RECOVERY, ROLLUP_SIZE_RECOVERY) || \
+    ROLLUP_FLASH_BASE % EFL_PAGE_SIZE != 0 || \
+    ROLLUP_FLASH_END > EFL_FLASH_SIZE
+#error "Rollup flash overlaps an OAD image or is not page aligned"
+#endif
+
+// Stored rollup, sizeof(rollup_rec_t). A number so it can size the rings
+// in #if.
+#define ROLLUP_REC_LEN             38
+#define ROLLUP_RECS_PER_PAGE       (EFL_PAGE_SIZE / ROLLUP_REC_LEN)
+
+// Pages of a ring: enough for the retention, plus the one being erased.
+#define ROLLUP_RING_PAGES(retainS, resS) \
+  ((((retainS) / (resS)) + ROLLUP_RECS_PER_PAGE - 1) / ROLLUP_RECS_PER_PAGE + 1)
+
+#define ROLLUP_PAGES_FINE    ROLLUP_RING_PAGES(ROLLUP_RETAIN_FINE_S, ROLLUP_RES_FINE_S)
+#define ROLLUP_PAGES_MEDIUM  ROLLUP_RING_PAGES(ROLLUP_RETAIN_MEDIUM_S, ROLLUP_RES_MEDIUM_S)
+#define ROLLUP_PAGES_COARSE  ROLLUP_RING_PAGES(ROLLUP_RETAIN_COARSE_S, ROLLUP_RES_COARSE_S)
+
+#if (ROLLUP_FLASH_BASE + (ROLLUP_PAGES_FINE + ROLLUP_PAGES_MEDIUM + \
+     ROLLUP_PAGES_COARSE) * EFL_PAGE_SIZE) > ROLLUP_FLASH_END
+#error "Rollup retention does not fit in the external flash"
+#endif
+
+// startSec of an erased slot.
+#define ROLLUP_ERASED              0xFFFFFFFF
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Rollup as stored in flash, all channels.
+#pragma pack(push, 1)
+typedef struct
+{
+  uint32_t startSec;
+  uint32_t count;
+  uint16_t min[STATS_NUM_CHANNELS];
+  uint16_t max[STATS_NUM_CHANNELS];
+  uint16_t mean[STATS_NUM_CHANNELS];
+} rollup_rec_t;
+#pragma pack(pop)
+
+// Fails to compile if ROLLUP_REC_LEN is not the size of rollup_rec_t.
+typedef char rollup_recLenCheck[(sizeof(rollup_rec_t) ==
+                                 ROLLUP_REC_LEN) ? 1 : -1];
+
+// Rollup in progress, or a single sample to merge.
+typedef struct
+{
+  uint32_t index;  // History seconds / period
+  uint32_t count;  // Samples so far, 0 before the first
+  int32_t  min[STATS_NUM_CHANNELS];
+  int32_t  max[STATS_NUM_CHANNELS];
+  int64_t  sum[STATS_NUM_CHANNELS];
+} rollup_acc_t;
+
+typedef struct
+{
+  uint32_t base;       // Flash address of the first page
+  uint32_t slots;      // Rollups the pages hold
+  uint32_t head;       // Slot the next rollup goes to
+  uint32_t count;      // Rollups held, the newest just before head
+  uint32_t oldestSec;  // startSec of the oldest one
+} rollup_ring_t;
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static const uint32_t rollupPeriod[ROLLUP_NUM_RES] =
+{
+  ROLLUP_RES_FINE_S,
+  ROLLUP_RES_MEDIUM_S,
+  ROLLUP_RES_COARSE_S
+};
+
+static const uint16_t rollupPages[ROLLUP_NUM_RES] =
+{
+  ROLLUP_PAGES_FINE,
+  ROLLUP_PAGES_MEDIUM,
+  ROLLUP_PAGES_COARSE
+};
+
+static rollup_ring_t rollupRing[ROLLUP_NUM_RES];
+static rollup_acc_t rollupAcc[ROLLUP_NUM_RES];
+
+// Rollups waiting for the flash, bit per resolution.
+static rollup_rec_t rollupUnwritten[ROLLUP_NUM_RES];
+static uint8_t rollupUnwrittenMask = 0;
+
+// History seconds at RTC second 0 of this boot.
+static uint32_t rollupTimeBase = 0;
+
+// FALSE if the flash could not be read at init, nothing is stored then.
+static uint8_t rollupReady = FALSE;
+
+// Query being answered: rollups left from rollupQuerySlot on, the channel
+// of the current one and the record waiting to be sent.
+static uint8_t rollupQueryActive = FALSE;
+static uint8_t rollupQueryRes = 0;
+static uint32_t rollupQuerySlot = 0;
+static uint32_t rollupQueryLeft = 0;
+static uint32_t rollupQueryTo = 0;
+static uint8_t rollupQueryCh = 0;
+static rollup_rec_t rollupQueryRollup;
+static history_rec_t rollupQueryRec;
+static uint8_t rollupQueryRecValid = FALSE;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Get the flash address of a ring slot.
+ *
+ * @param   pRing - ring
+ * @param   slot  - slot, 0 .. slots - 1
+ *
+ * @return  The address.
+ */
+static uint32_t Rollup_slotAddr(const rollup_ring_t *pRing, uint32_t slot)
+{
+  return pRing->base + (slot / ROLLUP_RECS_PER_PAGE) * EFL_PAGE_SIZE +
+         (slot % ROLLUP_RECS_PER_PAGE) * ROLLUP_REC_LEN;
+}
+
+/*
+ * @brief   Get the slot of the n-th rollup held, the oldest being 0.
+ *
+ * @param   pRing - ring
+ * @param   n     - rollup, 0 .. count - 1
+ *
+ * @return  The slot.
+ */
+static uint32_t Rollup_nthSlot(const rollup_ring_t *pRing, uint32_t n)
+{
+  return (pRing->head + pRing->slots - pRing->count + n) % pRing->slots;
+}
+
+/*
+ * @brief   Get a channel value of a stored rollup back.
+ *
+ * @param   ch    - STATS_CH_*
+ * @param   value - as stored
+ *
+ * @return  The value, sign extended for temperature.
+ */
+static int32_t Rollup_decode(uint8_t ch, uint16_t value)
+{
+  return (ch == STATS_CH_TEMPERATURE) ? (int16_t)value : value;
+}
+
+/*
+ * @brief   Read the start of the rollup in a slot. The flash must be open.
+ *
+ * @param   pRing - ring
+ * @param   slot  - slot
+ *
+ * @return  Its startSec, ROLLUP_ERASED if the slot is empty.
+ */
+static uint32_t Rollup_readStart(const rollup_ring_t *pRing, uint32_t slot)
+{
+  uint32_t startSec = ROLLUP_ERASED;
+
+  ExtFlash_read(Rollup_slotAddr(pRing, slot), sizeof(startSec),
+                (uint8_t *)&startSec);
+
+  return startSec;
+}
+
+/*
+ * @brief   Find where writing a ring goes on after a reboot, and the end
+ *          of its newest rollup. The flash must be open.
+ *
+ * @param   res - ROLLUP_RES_*
+ *
+ * @return  History seconds the newest rollup ends at, 0 if none.
+ */
+static uint32_t Rollup_recoverRing(uint8_t res)
+{
+  rollup_ring_t *pRing = &rollupRing[res];
+  uint32_t newestSec = 0;
+  uint16_t headPage = 0;
+  uint16_t validPages = 0;
+  uint16_t used;
+  uint16_t page;
+
+  for (page = 0; page < rollupPages[res]; page++)
+  {
+    uint32_t startSec = Rollup_readStart(pRing, page * ROLLUP_RECS_PER_PAGE);
+
+    if (startSec == ROLLUP_ERASED)
+    {
+      continue;
+    }
+
+    if (validPages == 0 || startSec > newestSec)
+    {
+      newestSec = startSec;
+      headPage = page;
+    }
+    validPages++;
+  }
+
+  if (validPages == 0)
+  {
+    return 0;
+  }
+
+  // The pages before the newest one are full
+  for (used = 1; used < ROLLUP_RECS_PER_PAGE; used++)
+  {
+    if (Rollup_readStart(pRing, headPage * ROLLUP_RECS_PER_PAGE + used) ==
+        ROLLUP_ERASED)
+    {
+      break;
+    }
+  }
+
+  pRing->head = (headPage * ROLLUP_RECS_PER_PAGE + used) % pRing->slots;
+  pRing->count = (uint32_t)(validPages - 1) * ROLLUP_RECS_PER_PAGE + used;
+  pRing->oldestSec = Rollup_readStart(pRing, Rollup_nthSlot(pRing, 0));
+
+  newestSec = Rollup_readStart(pRing, Rollup_nthSlot(pRing, pRing->count - 1));
+
+  return newestSec + rollupPeriod[res];
+}
+
+/*
+ * @brief   Append a rollup to its ring, erasing the oldest page first when
+ *          a new page is started. The flash must be open.
+ *
+ * @param   res  - ROLLUP_RES_*
+ * @param   pRec - rollup
+ *
+ * @return  TRUE if written. If not, the ring is unchanged and writing the
+ *          same rollup again is safe.
+ */
+static uint8_t Rollup_ringWrite(uint8_t res, const rollup_rec_t *pRec)
+{
+  rollup_ring_t *pRing = &rollupRing[res];
+
+  if (pRing->head % ROLLUP_RECS_PER_PAGE == 0)
+  {
+    if (!ExtFlash_erase(Rollup_slotAddr(pRing, pRing->head), EFL_PAGE_SIZE))
+    {
+      return FALSE;
+    }
+
+    if (pRing->count > pRing->slots - ROLLUP_RECS_PER_PAGE)
+    {
+      pRing->count = pRing->slots - ROLLUP_RECS_PER_PAGE;
+      pRing->oldestSec = Rollup_readStart(pRing, Rollup_nthSlot(pRing, 0));
+    }
+  }
+
+  // A failed write leaves the slot erased or partly programmed with the
+  // same bytes, so it is simply retried.
+  if (!ExtFlash_write(Rollup_slotAddr(pRing, pRing->head),
+                      sizeof(rollup_rec_t), (const uint8_t *)pRec))
+  {
+    return FALSE;
+  }
+
+  if (pRing->count == 0)
+  {
+    pRing->oldestSec = pRec->startSec;
+  }
+
+  pRing->head = (pRing->head + 1) % pRing->slots;
+  pRing->count++;
+
+  return TRUE;
+}
+
+static void Rollup_merge(uint8_t res, uint32_t startSec,
+                         const rollup_acc_t *pFrom);
+static uint32_t Rollup_findFrom(const rollup_ring_t *pRing, uint32_t timeSec);
+
+/*
+ * @brief   Store a finished rollup and merge it into the next coarser one.
+ *
+ * @param   res - ROLLUP_RES_*
+ *
+ * @return  None.
+ */
+static void Rollup_end(uint8_t res)
+{
+  rollup_acc_t *pAcc = &rollupAcc[res];
+  rollup_rec_t *pRec = &rollupUnwritten[res];
+  int64_t n = pAcc->count;
+  uint8_t ch;
+
+  // The flash was busy for a whole period
+  if (rollupUnwrittenMask & (1 << res))
+  {
+    Diag_count(DIAG_CNT_ROLLUP_DROPPED);
+  }
+
+  pRec->startSec = pAcc->index * rollupPeriod[res];
+  pRec->count = pAcc->count;
+
+  for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+  {
+    int64_t sum = pAcc->sum[ch];
+
+    pRec->min[ch] = (uint16_t)pAcc->min[ch];
+    pRec->max[ch] = (uint16_t)pAcc->max[ch];
+    pRec->mean[ch] = (uint16_t)((sum >= 0) ? (sum + n / 2) / n :
+                                             (sum - n / 2) / n);
+  }
+
+  rollupUnwrittenMask |= 1 << res;
+
+  if (res + 1 < ROLLUP_NUM_RES)
+  {
+    Rollup_merge(res + 1, pRec->startSec, pAcc);
+  }
+
+  pAcc->count = 0;
+}
+
+/*
+ * @brief   Merge samples into the rollup of a resolution, ending it first
+ *          if they are past its period.
+ *
+ * @param   res      - ROLLUP_RES_*
+ * @param   startSec - history seconds the samples start at
+ * @param   pFrom    - samples, a finer rollup or a single one
+ *
+ * @return  None.
+ */
+static void Rollup_merge(uint8_t res, uint32_t startSec,
+                         const rollup_acc_t *pFrom)
+{
+  rollup_acc_t *pAcc = &rollupAcc[res];
+  uint32_t index = startSec / rollupPeriod[res];
+  uint8_t ch;
+
+  if (pAcc->count != 0 && index != pAcc->index)
+  {
+    Rollup_end(res);
+  }
+
+  if (pAcc->count == 0)
+  {
+    pAcc->index = index;
+
+    for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+    {
+      pAcc->min[ch] = pFrom->min[ch];
+      pAcc->max[ch] = pFrom->max[ch];
+      pAcc->sum[ch] = 0;
+    }
+  }
+
+  pAcc->count += pFrom->count;
+
+  for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+  {
+    pAcc->sum[ch] += pFrom->sum[ch];
+
+    if (pFrom->min[ch] < pAcc->min[ch])
+    {
+      pAcc->min[ch] = pFrom->min[ch];
+    }
+    if (pFrom->max[ch] > pAcc->max[ch])
+    {
+      pAcc->max[ch] = pFrom->max[ch];
+    }
+  }
+}
+
+/*
+ * @brief   Rebuild the unfinished rollup of a resolution after a reboot,
+ *          from the finer rollups stored since its last one. The flash
+ *          must be open.
+ *
+ * @param   res    - ROLLUP_RES_*, not the finest
+ * @param   endSec - history seconds its newest stored rollup ends at
+ *
+ * @return  None.
+ */
+static void Rollup_replay(uint8_t res, uint32_t endSec)
+{
+  const rollup_ring_t *pFine = &rollupRing[res - 1];
+  uint32_t n;
+
+  for (n = Rollup_findFrom(pFine, endSec); n < pFine->count; n++)
+  {
+    rollup_rec_t rec;
+    rollup_acc_t acc;
+    uint8_t ch;
+
+    ExtFlash_read(Rollup_slotAddr(pFine, Rollup_nthSlot(pFine, n)),
+                  sizeof(rec), (uint8_t *)&rec);
+
+    acc.count = rec.count;
+
+    for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+    {
+      acc.min[ch] = Rollup_decode(ch, rec.min[ch]);
+      acc.max[ch] = Rollup_decode(ch, rec.max[ch]);
+      acc.sum[ch] = (int64_t)Rollup_decode(ch, rec.mean[ch]) * rec.count;
+    }
+
+    Rollup_merge(res, rec.startSec, &acc);
+  }
+}
+
+/*
+ * @brief   Find the first rollup held that starts at or after a time, by
+ *          bisection. The flash must be open.
+ *
+ * @param   pRing   - ring
+ * @param   timeSec - history seconds
+ *
+ * @return  Its index, the oldest being 0, count if there is none.
+ */
+static uint32_t Rollup_findFrom(const rollup_ring_t *pRing, uint32_t timeSec)
+{
+  uint32_t lo = 0;
+  uint32_t hi = pRing->count;
+
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (Rollup_readStart(pRing, Rollup_nthSlot(pRing, mid)) < timeSec)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Find the newest rollups in flash and carry on from them.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Rollup_init(void)
+{
+  uint32_t endSec[ROLLUP_NUM_RES];
+  uint32_t base = ROLLUP_FLASH_BASE;
+  uint8_t res;
+
+  memset(rollupRing, 0, sizeof(rollupRing));
+  memset(rollupAcc, 0, sizeof(rollupAcc));
+  rollupUnwrittenMask = 0;
+  rollupTimeBase = 0;
+  Rollup_cancelQuery();
+
+  for (res = 0; res < ROLLUP_NUM_RES; res++)
+  {
+    rollupRing[res].base = base;
+    rollupRing[res].slots = (uint32_t)rollupPages[res] * ROLLUP_RECS_PER_PAGE;
+    base += (uint32_t)rollupPages[res] * EFL_PAGE_SIZE;
+  }
+
+  rollupReady = ExtFlash_open() ? TRUE : FALSE;
+  if (!rollupReady)
+  {
+    return;
+  }
+
+  for (res = 0; res < ROLLUP_NUM_RES; res++)
+  {
+    endSec[res] = Rollup_recoverRing(res);
+
+    if (endSec[res] > rollupTimeBase)
+    {
+      rollupTimeBase = endSec[res];
+    }
+  }
+
+  // Coarsest first: a rollup the replay finishes is merged into the next
+  // coarser one, which then must not replay it again. Only the samples of
+  // the unfinished finest rollup are lost.
+  for (res = ROLLUP_NUM_RES - 1; res > 0; res--)
+  {
+    Rollup_replay(res, endSec[res]);
+  }
+
+  ExtFlash_close();
+  Rollup_store();
+}
+
+/*
+ * @brief   Add a sample to the finest rollup. The rollups it ends wait for
+ *          Rollup_store.
+ *
+ * @param   pRec - sample
+ *
+ * @return  TRUE if rollups wait to be stored.
+ */
+uint8_t Rollup_add(const sample_rec_t *pRec)
+{
+  rollup_acc_t sample;
+  uint8_t ch;
+
+  if (!rollupReady)
+  {
+    return FALSE;
+  }
+
+  sample.count = 1;
+
+  for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+  {
+    int32_t value = Stats_channelValue(pRec, ch);
+
+    sample.min[ch] = value;
+    sample.max[ch] = value;
+    sample.sum[ch] = value;
+  }
+
+  Rollup_merge(ROLLUP_RES_FINE, Rollup_now(), &sample);
+
+  return (rollupUnwrittenMask != 0) ? TRUE : FALSE;
+}
+
+/*
+ * @brief   Write the rollups waiting for the flash, erasing ring pages as
+ *          needed. Those that can't be written now stay waiting.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Rollup_store(void)
+{
+  uint8_t res;
+
+  if (rollupUnwrittenMask == 0 || !ExtFlash_open())
+  {
+    return;
+  }
+
+  for (res = 0; res < ROLLUP_NUM_RES; res++)
+  {
+    if ((rollupUnwrittenMask & (1 << res)) &&
+        Rollup_ringWrite(res, &rollupUnwritten[res]))
+    {
+      rollupUnwrittenMask &= ~(1 << res);
+    }
+  }
+
+  ExtFlash_close();
+}
+
+/*
+ * @brief   Get the time rollups are stamped with.
+ *
+ * @param   None.
+ *
+ * @return  History seconds now.
+ */
+uint32_t Rollup_now(void)
+{
+  return rollupTimeBase + AONRTCSecGet();
+}
+
+/*
+ * @brief   Pick the resolution to answer a query from and queue the
+ *          answer. The finest resolution that holds the start of the range
+ *          in no more than the rollups asked for is used, else the
+ *          coarsest one with anything in it.
+ *
+ * @param   pQuery - query
+ *
+ * @return  The resolution picked.
+ */
+uint8_t Rollup_query(const history_query_t *pQuery)
+{
+  rollup_ring_t *pRing;
+  uint32_t first = 0;
+  uint32_t last = 0;
+  uint8_t busy = FALSE;
+  uint8_t res;
+
+  Rollup_cancelQuery();
+  rollupQueryRes = ROLLUP_RES_FINE;
+
+  for (res = 0; res < ROLLUP_NUM_RES; res++)
+  {
+    uint32_t fromSec;
+    uint32_t estimate = 0;
+
+    pRing = &rollupRing[res];
+    if (pRing->count == 0)
+    {
+      continue;
+    }
+
+    rollupQueryRes = res;
+
+    fromSec = (pQuery->fromSec > pRing->oldestSec) ? pQuery->fromSec :
+                                                     pRing->oldestSec;
+    if (pQuery->toSec > fromSec)
+    {
+      estimate = (pQuery->toSec - fromSec) / rollupPeriod[res] + 1;
+    }
+
+    if (pRing->oldestSec <= pQuery->fromSec &&
+        estimate <= pQuery->maxRecords)
+    {
+      break;
+    }
+  }
+
+  pRing = &rollupRing[rollupQueryRes];
+
+  // The rollup the range starts in, then those starting before its end.
+  if (pRing->count != 0 && pQuery->toSec > pQuery->fromSec)
+  {
+    if (ExtFlash_open())
+    {
+      uint32_t fromSec = pQuery->fromSec -
+                         pQuery->fromSec % rollupPeriod[rollupQueryRes];
+
+      first = Rollup_findFrom(pRing, fromSec);
+      last = Rollup_findFrom(pRing, pQuery->toSec);
+      ExtFlash_close();
+    }
+    else
+    {
+      busy = TRUE;
+    }
+  }
+
+  rollupQuerySlot = Rollup_nthSlot(pRing, first);
+  rollupQueryLeft = last - first;
+  rollupQueryTo = pQuery->toSec;
+  rollupQueryCh = 0;
+
+  memset(&rollupQueryRec, 0, sizeof(rollupQueryRec));
+  rollupQueryRec.startSec = Rollup_now();
+  rollupQueryRec.resolution = rollupQueryRes;
+  rollupQueryRec.channel = busy ? ROLLUP_CH_BUSY : ROLLUP_CH_QUERY;
+  rollupQueryRec.count = rollupQueryLeft;
+  rollupQueryRecValid = TRUE;
+  rollupQueryActive = TRUE;
+
+  return rollupQueryRes;
+}
+
+/*
+ * @brief   Check for a query being answered.
+ *
+ * @param   None.
+ *
+ * @return  TRUE while records are left to send.
+ */
+uint8_t Rollup_queryPending(void)
+{
+  return rollupQueryActive;
+}
+
+/*
+ * @brief   Get the next record of the answer to the query, reading the
+ *          next rollup from flash when its channels are done.
+ *
+ * @param   None.
+ *
+ * @return  The record, NULL if the answer is complete or the flash busy.
+ */
+const history_rec_t *Rollup_nextQueryRec(void)
+{
+  if (!rollupQueryActive)
+  {
+    return NULL;
+  }
+
+  if (rollupQueryRecValid)
+  {
+    return &rollupQueryRec;
+  }
+
+  if (rollupQueryCh == 0)
+  {
+    if (rollupQueryLeft == 0)
+    {
+      rollupQueryActive = FALSE;
+      return NULL;
+    }
+
+    if (!ExtFlash_open())
+    {
+      return NULL;
+    }
+
+    if (!ExtFlash_read(Rollup_slotAddr(&rollupRing[rollupQueryRes],
+                                       rollupQuerySlot),
+                       sizeof(rollupQueryRollup),
+                       (uint8_t *)&rollupQueryRollup))
+    {
+      ExtFlash_close();
+      return NULL;
+    }
+    ExtFlash_close();
+
+    // Overwritten since the query, by rollups newer than asked for
+    if (rollupQueryRollup.startSec == ROLLUP_ERASED ||
+        rollupQueryRollup.startSec >= rollupQueryTo)
+    {
+      rollupQueryActive = FALSE;
+      return NULL;
+    }
+  }
+
+  rollupQueryRec.startSec = rollupQueryRollup.startSec;
+  rollupQueryRec.resolution = rollupQueryRes;
+  rollupQueryRec.channel = rollupQueryCh;
+  rollupQueryRec.count = rollupQueryRollup.count;
+  rollupQueryRec.min = rollupQueryRollup.min[rollupQueryCh];
+  rollupQueryRec.max = rollupQueryRollup.max[rollupQueryCh];
+  rollupQueryRec.mean = rollupQueryRollup.mean[rollupQueryCh];
+  rollupQueryRecValid = TRUE;
+
+  return &rollupQueryRec;
+}
+
+/*
+ * @brief   Move on to the next record of the answer to the query.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Rollup_queryRecDone(void)
+{
+  if (!rollupQueryRecValid)
+  {
+    return;
+  }
+
+  rollupQueryRecValid = FALSE;
+
+  if (rollupQueryRec.channel == ROLLUP_CH_QUERY ||
+      rollupQueryRec.channel == ROLLUP_CH_BUSY)
+  {
+    return;
+  }
+
+  if (++rollupQueryCh == STATS_NUM_CHANNELS)
+  {
+    rollupQueryCh = 0;
+    rollupQuerySlot = (rollupQuerySlot + 1) % rollupRing[rollupQueryRes].slots;
+    rollupQueryLeft--;
+  }
+}
+
+/*
+ * @brief   Stop answering the query.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Rollup_cancelQuery(void)
+{
+  rollupQueryActive = FALSE;
+  rollupQueryRecValid = FALSE;
+  rollupQueryLeft = 0;
+}
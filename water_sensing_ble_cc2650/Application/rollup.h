@@ -0,0 +1,91 @@
+/*
+ * Downsampled sample history in external flash.
+ *
+ * Raw samples at 1 Hz fill the external flash in days, so long deployments
+ * keep rollups instead: the min, max and mean of every channel over fixed
+ * periods at three resolutions, 1 min, 1 h and 1 day by default. Each
+ * resolution has its own ring of flash pages, sized for its retention, and
+ * the coarser rollups are built from the finer ones as they complete.
+ *
+ * Rollup times are history seconds: the RTC seconds since boot, offset so
+ * they carry on from the newest rollup in flash. Rollups keep their order
+ * across reboots, the time the device was off does not count.
+ *
+ * A history query asks for a time range and the most records it wants.
+ * It is answered from the finest resolution that holds the start of the
+ * range and has no more records in it than that, moving to coarser
+ * resolutions as the range grows, so a month of trend is a few hundred
+ * notifications rather than tens of thousands.
+ *
+ * Task context only.
+ */
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include "samplelog.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Rollup periods [s]. Each must be a multiple of the finer one.
+#ifndef ROLLUP_RES_FINE_S
+#define ROLLUP_RES_FINE_S          60
+#endif
+#ifndef ROLLUP_RES_MEDIUM_S
+#define ROLLUP_RES_MEDIUM_S        (60 * 60)
+#endif
+#ifndef ROLLUP_RES_COARSE_S
+#define ROLLUP_RES_COARSE_S        (24 * 60 * 60)
+#endif
+
+// Retention of each resolution [s], at least this much is kept. The rings
+// share the external flash the OAD images leave free.
+#ifndef ROLLUP_RETAIN_FINE_S
+#define ROLLUP_RETAIN_FINE_S       (6UL * 24 * 60 * 60)
+#endif
+#ifndef ROLLUP_RETAIN_MEDIUM_S
+#define ROLLUP_RETAIN_MEDIUM_S     (120UL * 24 * 60 * 60)
+#endif
+#ifndef ROLLUP_RETAIN_COARSE_S
+#define ROLLUP_RETAIN_COARSE_S     (3UL * 365 * 24 * 60 * 60)
+#endif
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+// Find the newest rollups in flash and carry on from them.
+void Rollup_init(void);
+
+// Add a sample. Returns TRUE if rollups it or earlier samples ended wait
+// for Rollup_store.
+uint8_t Rollup_add(const sample_rec_t *pRec);
+
+// Write the waiting rollups to flash. Those it can't, because the flash is
+// busy or an erase or write failed, keep waiting.
+void Rollup_store(void);
+
+// History seconds now.
+uint32_t Rollup_now(void);
+
+// Queue the answer to a query for sending. Replaces a previous query.
+// Returns the resolution picked.
+uint8_t Rollup_query(const history_query_t *pQuery);
+
+// TRUE while an answer is being sent.
+uint8_t Rollup_queryPending(void);
+
+// Next record of the answer, NULL when done or if the flash is busy. Stays
+// the same until Rollup_queryRecDone is called, so a send the stack
+// refused is retried.
+const history_rec_t *Rollup_nextQueryRec(void);
+void Rollup_queryRecDone(void);
+void Rollup_cancelQuery(void);
+
+#endif /* ROLLUP_H */
@@ -0,0 +1,192 @@
+/*
+ * Sequence-numbered sample records, see samplelog.h.
+ *
+ * Record seq lives at samplelogRing[seq % SAMPLELOG_SIZE], so finding one is
+ * a range check and an index. Sequence numbers are compared by difference,
+ * which stays correct when they wrap.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include "samplelog.h"
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static sample_rec_t samplelogRing[SAMPLELOG_SIZE];
+
+// Sequence number of the next record.
+static uint32_t samplelogNextSeq = 0;
+
+// Records in the ring, at most SAMPLELOG_SIZE.
+static uint32_t samplelogCount = 0;
+
+// Gap fill in progress: next record to send and records left.
+static uint32_t samplelogResendSeq = 0;
+static uint32_t samplelogResendLeft = 0;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Check whether a record is still in the ring.
+ *
+ * @param   seq - sequence number
+ *
+ * @return  TRUE if it is.
+ */
+static uint8_t SampleLog_contains(uint32_t seq)
+{
+  // Records behind the newest; wraps to a huge value for future ones.
+  return (samplelogNextSeq - 1 - seq) < samplelogCount;
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Forget all records and restart numbering.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void SampleLog_init(void)
+{
+  memset(samplelogRing, 0, sizeof(samplelogRing));
+  samplelogNextSeq = 0;
+  samplelogCount = 0;
+  samplelogResendLeft = 0;
+}
+
+/*
+ * @brief   Number a record and keep a copy for gap fill, replacing the
+ *          oldest one if the ring is full.
+ *
+ * @param   pRec - record, its seq is filled in
+ *
+ * @return  Sequence number of the record.
+ */
+uint32_t SampleLog_append(sample_rec_t *pRec)
+{
+  pRec->seq = samplelogNextSeq++;
+  samplelogRing[pRec->seq % SAMPLELOG_SIZE] = *pRec;
+
+  if (samplelogCount < SAMPLELOG_SIZE)
+  {
+    samplelogCount++;
+  }
+
+  return pRec->seq;
+}
+
+/*
+ * @brief   Get the sequence numbers that can still be resent.
+ *
+ * @param   pRange - filled with [oldest, next)
+ *
+ * @return  None.
+ */
+void SampleLog_getRange(sample_range_t *pRange)
+{
+  pRange->next = samplelogNextSeq;
+  pRange->oldest = samplelogNextSeq - samplelogCount;
+}
+
+/*
+ * @brief   Queue records for sending again. Whatever part of the range is
+ *          no longer, or not yet, in the ring is skipped.
+ *
+ * @param   first - first sequence number wanted
+ * @param   last  - last sequence number wanted, inclusive
+ *
+ * @return  Number of records that will be resent.
+ */
+uint16_t SampleLog_requestResend(uint32_t first, uint32_t last)
+{
+  sample_range_t range;
+
+  SampleLog_getRange(&range);
+
+  // Clip to the ring.
+  if ((int32_t)(first - range.oldest) < 0)
+  {
+    first = range.oldest;
+  }
+
+  if ((int32_t)(last - range.next) >= 0)
+  {
+    last = range.next - 1;
+  }
+
+  if (samplelogCount == 0 || (int32_t)(last - first) < 0)
+  {
+    samplelogResendLeft = 0;
+    return 0;
+  }
+
+  samplelogResendSeq = first;
+  samplelogResendLeft = last - first + 1;
+
+  return (uint16_t)samplelogResendLeft;
+}
+
+/*
+ * @brief   Get the next record of the gap fill in progress.
+ *
+ * @param   None.
+ *
+ * @return  The record, NULL if nothing is left to resend.
+ */
+const sample_rec_t *SampleLog_nextResend(void)
+{
+  // Skip what was overwritten while the gap fill was going on.
+  while (samplelogResendLeft != 0 && !SampleLog_contains(samplelogResendSeq))
+  {
+    samplelogResendSeq++;
+    samplelogResendLeft--;
+  }
+
+  if (samplelogResendLeft == 0)
+  {
+    return NULL;
+  }
+
+  return &samplelogRing[samplelogResendSeq % SAMPLELOG_SIZE];
+}
+
+/*
+ * @brief   Move past the record returned by SampleLog_nextResend.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void SampleLog_resendDone(void)
+{
+  if (samplelogResendLeft != 0)
+  {
+    samplelogResendSeq++;
+    samplelogResendLeft--;
+  }
+}
+
+/*
+ * @brief   Drop the gap fill in progress, the central that asked is gone.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void SampleLog_cancelResend(void)
+{
+  samplelogResendLeft = 0;
+}
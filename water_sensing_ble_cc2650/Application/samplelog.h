@@ -0,0 +1,52 @@
+/*
+ * Sequence-numbered sample records.
+ *
+ * Every processed Sensor Controller sample becomes a binary record with a
+ * 32-bit sequence number, counting up from 0 at boot, which is notified on
+ * the BLE service's Record characteristic. The last SAMPLELOG_SIZE records
+ * are kept in a RAM ring so a central that finds a hole in the sequence can
+ * ask for just that range again (gap fill) instead of downloading history.
+ *
+ * Task context only.
+ */
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include <ble_service.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Records kept for gap fill, must be a power of two.
+#ifndef SAMPLELOG_SIZE
+#define SAMPLELOG_SIZE             32
+#endif
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void SampleLog_init(void);
+
+// Number the record and keep a copy. Returns the sequence number.
+uint32_t SampleLog_append(sample_rec_t *pRec);
+
+void SampleLog_getRange(sample_range_t *pRange);
+
+// Gap fill: queue the records first..last (inclusive) for sending again.
+// Replaces a previous request. Returns the number of records found.
+uint16_t SampleLog_requestResend(uint32_t first, uint32_t last);
+
+// Next record to resend, NULL when done. Stays the same until
+// SampleLog_resendDone is called, so a send the stack refused is retried.
+const sample_rec_t *SampleLog_nextResend(void);
+void SampleLog_resendDone(void);
+void SampleLog_cancelResend(void);
+
+#endif /* SAMPLELOG_H */
@@ -18,6 +18,8 @@
 
 #include <ti/sysbios/knl/Clock.h>
 
+#include <driverlib/aon_rtc.h>
+
 #include <ti/drivers/ADC.h>
 #include <ti/drivers/PIN.h>
 #include <ti/drivers/UART.h>
@@ -32,16 +34,111 @@
 #include <ble_service.h>
 
 #include "project_zero.h"
+#include "latency.h"
+#include "diag.h"
+#include "trace.h"
+#include "samplelog.h"
+#include "stats.h"
+#include "rollup.h"
 
 #include <stdio.h>
 
 
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Sampling period [ms]
+#ifndef SC_SAMPLE_PERIOD_MS
+#define SC_SAMPLE_PERIOD_MS     1000
+#endif
+
+// Align sampling to the connection events while connected, so a sample is
+// ready just before the connection event it goes out in.
+#ifndef SC_CONN_EVT_SYNC
+#define SC_CONN_EVT_SYNC        1
+#endif
+
+// How long before the connection anchor the SC is woken [ms]. Covers the SC
+// task, the ALERT and the app task processing the sample. The pH probe is
+// read in the background and is not on this path, see SC_phRead.
+#ifndef SC_SYNC_LEAD_MS
+#define SC_SYNC_LEAD_MS         15
+#endif
+
+// Ticks closer than this are moved on by one interval, the RTC compare
+// must not be set in the past [ms].
+#define SC_SYNC_MARGIN_MS       2
+
+// RTC compare values are seconds in bits 31:16, 1/65536 s in bits 15:0.
+#define SC_MS_TO_RTC(ms)        ((uint32_t)(ms) * 65536 / 1000)
+// Connection interval is in 1.25 ms units.
+#define SC_CI_TO_RTC(ci)        ((uint32_t)(ci) * 8192 / 100)
+
+// Control requests waiting to be issued, including the one in progress.
+#ifndef SC_CTRL_QUEUE_DEPTH
+#define SC_CTRL_QUEUE_DEPTH     4
+#endif
+
+// Copies of the SC output taken to find a consistent one, see
+// SC_snapshot.
+#define SC_SNAPSHOT_TRIES       4
+
+// Retry delay when the SC control interface is not ready although no
+// request of ours is in progress [ms].
+#define SC_CTRL_RETRY_MS        1
+
+// Longest pH reading, the size of sample_rec_t.ph [bytes].
+#define SC_PH_LEN               6
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Queued control request
+typedef struct
+{
+    sc_ctrl_op_t    op;
+    uint16_t        bvTaskIds;
+    scCtrlDoneCb_t  pfnDone;
+} sc_ctrl_req_t;
+
 /*********************************************************************
  * GLOBAL VARIABLES
  */
 static uint32_t     g_sensorLastTick = 0;
 static Clock_Struct g_sensorClock;
 
+// Connection event alignment: whether the tick is aligned now, and whether
+// it has to be (re)armed at the next connection event end.
+static uint8_t      g_syncEnabled = SC_CONN_EVT_SYNC;
+static uint8_t      g_syncActive = FALSE;
+static uint8_t      g_syncRearm = FALSE;
+
+// Control requests, oldest at g_ctrlHead. The head is issued to the SC
+// and, once g_ctrlInFlight, completed by the next control READY.
+static sc_ctrl_req_t g_ctrlQueue[SC_CTRL_QUEUE_DEPTH];
+static uint8_t      g_ctrlHead = 0;
+static uint8_t      g_ctrlCount = 0;
+static uint8_t      g_ctrlInFlight = FALSE;
+
+// Sample now request pending until it is answered, g_sensorLastTick holds
+// when it was made. g_execDone is set once the SC reports the execution
+// done, only ALERTs handled after that answer the request.
+static uint8_t      g_execPending = FALSE;
+static uint8_t      g_execDone = FALSE;
+static uint8_t      g_execAnswered = FALSE;
+
+// pH probe on UART0. While g_phReading the driver fills g_phRxBuf, and
+// g_phRxLen is set when it is done. A complete reading waits in g_phValue
+// for the next sample.
+static UART_Handle  g_phUart = NULL;
+static uint8_t      g_phReading = FALSE;
+static char         g_phRxBuf[SC_PH_LEN];
+static size_t       g_phRxLen = 0;
+static char         g_phValue[SC_PH_LEN];
+static uint8_t      g_phValueLen = 0;
+
 /*********************************************************************
  * LOCAL FUNCTION DECLARATIONS
  */
@@ -50,11 +147,17 @@ static void SC_ctrlReadyHwiCb(void);
 static void SC_taskAlertHwiCb(void);
 
 // SWI
-static void SC_rangerClockSwiFxn(UArg a0);
+static void SC_sensorClockSwiFxn(UArg a0);
+static void SC_phReadSwiCb(UART_Handle handle, void *buf, size_t count);
 
 // TASK
 //static void SC_processAdc(void);
-static void SC_processSensor(void);
+static uint8_t SC_snapshot(SCIF_ADC_OUTPUT_T *pOut);
+static void SC_processSensor(const SCIF_ADC_OUTPUT_T *pOut);
+static void SC_phRead(void);
+static void SC_ctrlIssue(void);
+static void SC_ctrlComplete(uint8_t result);
+static void SC_execSensorDone(sc_ctrl_op_t op, uint16_t bvTaskIds, uint8_t result);
 
 
 /*********************************************************************
@@ -72,6 +175,8 @@ static void SC_processSensor(void);
  */
 static void SC_ctrlReadyHwiCb(void)
 {
+    TRACE0(TRACE_SC_CTRL_READY);
+
     // Signal main loop
     user_enqueueRawAppMsg(APP_MSG_SC_CTRL_READY, NULL, 0);
 } // SC_ctrlReadyHwiCb
@@ -88,6 +193,9 @@ static void SC_ctrlReadyHwiCb(void)
  */
 static void SC_taskAlertHwiCb(void)
 {
+    Latency_markAlert();
+    TRACE0(TRACE_SC_ALERT);
+
     // Signal main loop
     user_enqueueRawAppMsg(APP_MSG_SC_TASK_ALERT, NULL, 0);
 } // SC_taskAlertHwiCb
@@ -100,8 +208,8 @@ static void SC_taskAlertHwiCb(void)
 /*
  * @brief   Callback from Clock module on timeout.
  *
- *          Stores current clock tick, and signals main task with
- *          empty msg APP_MSG_SC_EXEC_SENSOR.
+ *          Signals main task with empty msg APP_MSG_SC_CTRL_RETRY, to retry
+ *          a control request the SC was not ready for.
  *
  * @param   None.
  *
@@ -109,33 +217,92 @@ static void SC_taskAlertHwiCb(void)
  */
 static void SC_sensorClockSwiFxn(UArg a0)
 {
+    // Signal main loop
+    user_enqueueRawAppMsg(APP_MSG_SC_CTRL_RETRY, NULL, 0);
+} // SC_sensorClockSwiFxn
+
+
+/*
+ * @brief   Callback from the UART driver when a pH read is done.
+ *
+ *          Signals main task with empty msg APP_MSG_SC_PH_READ.
+ *
+ * @param   count - bytes read, fewer than asked for if cancelled
+ *
+ * @return  None.
+ */
+static void SC_phReadSwiCb(UART_Handle handle, void *buf, size_t count)
+{
+    g_phRxLen = count;
 
-} // SC_rangerClockSwiFxn
+    // Signal main loop
+    user_enqueueRawAppMsg(APP_MSG_SC_PH_READ, NULL, 0);
+} // SC_phReadSwiCb
 
 
 /*********************************************************************
  * LOCAL FUNCTIONS
  */
 
+/*
+ * @brief   Copy the ADC SC task output out of AUX RAM in one piece.
+ *
+ *          The SC writes the channels one at a time while it executes, and
+ *          a new execution (RTC tick or sample now) can start while the
+ *          output is being copied. The output is copied again until two
+ *          copies in a row agree. A channel the SC rewrites in between is
+ *          caught, but channels rewritten before both copies can still mix
+ *          executions; the SC task output has nothing that tells the
+ *          executions apart. Taken once per ALERT, everything after works
+ *          on the copy.
+ *
+ * @param   pOut - filled with the output
+ *
+ * @return  TRUE if consistent, FALSE if the output kept changing and
+ *          pOut holds the last copy.
+ */
+static uint8_t SC_snapshot(SCIF_ADC_OUTPUT_T *pOut)
+{
+    uint8_t tries;
+    SCIF_ADC_OUTPUT_T check;
+
+    *pOut = scifTaskData.adc.output;
+
+    for (tries = 0; tries < SC_SNAPSHOT_TRIES; tries++)
+    {
+        check = scifTaskData.adc.output;
+        if (memcmp(&check, pOut, sizeof(check)) == 0)
+        {
+            return TRUE;
+        }
+
+        Diag_count(DIAG_CNT_SC_TORN_READS);
+        *pOut = check;
+    }
+
+    return FALSE;
+} // SC_snapshot
+
+
 /*
  * @brief   Processing function for the ADC SC task.
  *
  *          Is called whenever the APP_MSG_SC_TASK_ALERT msg is sent
  *          and ADC SC task has generated an alert.
  *
- *          Retrieves ADC value from SC, and calculates and sets new period and
- *          timeout for Clock object.
+ *          Converts the ADC values of one SC execution and sends them to
+ *          the BLE service.
  *
- * @param   None.
+ * @param   pOut - snapshot of the SC task output
  *
  * @return  None.
  */
-static void SC_processSensor(void)
+static void SC_processSensor(const SCIF_ADC_OUTPUT_T *pOut)
 {
     // Retrieve sensor values and and send to phone via bluetooth
 
     //// Temperature //////////////////////////////////////////////////////////////////
-    float adcTemp = scifTaskData.adc.output.adcTempValue;
+    float adcTemp = pOut->adcTempValue;
     float Temp = adcTemp*430/4096; // convert analog value to temperature in celcius
     // Notify the change to the BLE service
     char pTempLine[10];
@@ -147,7 +314,7 @@ static void SC_processSensor(void)
                             (uint8_t *)pTempLine, strlen(pTempLine));
 
     //// Pressure /////////////////////////////////////////////////////////////////////
-    uint16_t adcPress = scifTaskData.adc.output.adcPressureValue;
+    uint16_t adcPress = pOut->adcPressureValue;
     // Notify the change to the BLE service
     char pPressLine[20];
     itoaAppendStr(pPressLine, adcPress, "");
@@ -156,7 +323,7 @@ static void SC_processSensor(void)
                             (uint8_t *)pPressLine, strlen(pPressLine));
 
     //// Flow /////////////////////////////////////////////////////////////////////////
-    uint16_t adcFlow = scifTaskData.adc.output.adcFlowValue;
+    uint16_t adcFlow = pOut->adcFlowValue;
     // Notify the change to the BLE service
     char pFlowLine[20];
     itoaAppendStr(pFlowLine, adcFlow, "");
@@ -166,7 +333,7 @@ static void SC_processSensor(void)
 
 
     //// Conductivity /////////////////////////////////////////////////////////////////
-    float adcConductivity = scifTaskData.adc.output.adcConductivityValue;
+    float adcConductivity = pOut->adcConductivityValue;
     // convert analog value to conductivity, includes temperature compensation
     float TempCoefficient=1.0+0.0185*(Temp-25.0);
     float inputVoltage = adcConductivity*4300/4096;
@@ -193,7 +360,7 @@ static void SC_processSensor(void)
                             (uint8_t *)pConductLine, strlen(pConductLine));
 
     //// Turbidity ////////////////////////////////////////////////////////////////////////
-    float adcTurbidity = scifTaskData.adc.output.adcTurbidityValue;
+    float adcTurbidity = pOut->adcTurbidityValue;
     float voltTurbidity = adcTurbidity*4300/4096; // Convert analog value to millivolts
     // Notify the change to the BLE service
     char pTurbLine[20];
@@ -206,36 +373,82 @@ static void SC_processSensor(void)
                             (uint8_t *)pTurbLine, strlen(pTurbLine));
 
     /////// pH //////////////////////////////////////////////////////////////////////////////
-
-    /* Initialise UART communication for the pH sensor
-     * Make sure that the jumpers for the RXD and TXD pins are removed
-     * or else the sensor can't send data via UART
-     */
-    char rxBuffer[6];
-    UART_init();
-    UART_Handle uart;
-    UART_Params uartParams;
-    UART_Params_init(&uartParams);
-    uartParams.readMode = UART_MODE_BLOCKING;
-    uartParams.writeMode = UART_MODE_BLOCKING;
-    uartParams.writeDataMode = UART_DATA_TEXT;
-    uartParams.readDataMode = UART_DATA_TEXT;
-    uartParams.readReturnMode = UART_RETURN_NEWLINE;
-    uartParams.baudRate = 9600;
-    uart = UART_open(0, &uartParams);
-    if(uart){
-        UART_read(uart, &rxBuffer, sizeof(rxBuffer));
+    // Read in the background, the sample takes the reading completed since
+    // the one before. The reading is not NUL-terminated when it fills the
+    // buffer. Without one the buffer stays zeroed, which is how the record
+    // marks it.
+    char rxBuffer[SC_PH_LEN] = {0};
+    uint8_t rxLen = g_phValueLen;
+    memcpy(rxBuffer, g_phValue, rxLen);
+    g_phValueLen = 0;
+    if (rxLen > 0)
+    {
+        // Notify the change to the BLE service
+        user_enqueueCharDataMsg(APP_MSG_UPDATE_CHARVAL, 0,
+                                   BLESERVICE_SERV_UUID, BLESERVICE_PHVALUE,
+                                   (uint8_t *)rxBuffer, rxLen);
+    }
+    SC_phRead();
+
+    //// Record ///////////////////////////////////////////////////////////////////////
+    // All channels in one sequence-numbered record, kept for gap fill
+    sample_rec_t rec;
+    rec.temperature = (int16_t)(Temp * 100);
+    rec.pressure = adcPress;
+    rec.flow = adcFlow;
+    rec.conductivity = Conductivity;
+    rec.turbidity = (uint16_t)voltTurbidity;
+    memcpy(rec.ph, rxBuffer, sizeof(rec.ph));
+    SampleLog_append(&rec);
+    Stats_add(&rec);
+    // The flash erases and writes wait for a housekeeping message, so
+    // they don't hold up the samples. Posted again with each sample while
+    // the rollups can't be stored.
+    if (Rollup_add(&rec))
+    {
+      user_enqueueRawAppMsg(APP_MSG_ROLLUP_STORE, NULL, 0);
     }
-    // Notify the change to the BLE service
     user_enqueueCharDataMsg(APP_MSG_UPDATE_CHARVAL, 0,
-                               BLESERVICE_SERV_UUID, BLESERVICE_PHVALUE,
-                               (uint8_t *)rxBuffer, strlen(rxBuffer));
-    UART_close(uart);
+                               BLESERVICE_SERV_UUID, BLESERVICE_RECORD,
+                               (uint8_t *)&rec, sizeof(rec));
 
     user_toggleLED(0);
 } // SC_processAdc
 
 
+/*
+ * @brief   Start reading the pH probe for the next sample.
+ *
+ *          The probe answers at 9600 baud, so the read completes in the
+ *          background and SC_processPhRead keeps the reading. A read still
+ *          not done by the next sample has timed out and is cancelled, the
+ *          sample after that starts a new one.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+static void SC_phRead(void)
+{
+    if (g_phUart == NULL)
+    {
+        return;
+    }
+
+    if (g_phReading)
+    {
+        UART_readCancel(g_phUart);
+        return;
+    }
+
+    g_phReading = TRUE;
+    if (UART_read(g_phUart, g_phRxBuf, sizeof(g_phRxBuf)) == UART_ERROR)
+    {
+        g_phReading = FALSE;
+    }
+} // SC_phRead
+
+
 /*
  * @brief   Processing function for the Ranger SC task.
  *
@@ -256,6 +469,121 @@ static void SC_processSensor(void)
 //} // SC_processRanger
 
 
+/*
+ * @brief   Issue the queued control requests to the Scif driver.
+ *
+ *          Issues the oldest request unless one is already in progress.
+ *          Requests the driver rejects are completed right away and the
+ *          next one is tried. If the control interface is busy, a retry is
+ *          scheduled instead of waiting for it.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+static void SC_ctrlIssue(void)
+{
+    while (g_ctrlCount != 0 && !g_ctrlInFlight)
+    {
+        sc_ctrl_req_t *pReq = &g_ctrlQueue[g_ctrlHead];
+        SCIF_RESULT_T result;
+
+        switch (pReq->op)
+        {
+        case SC_CTRL_START:
+            result = scifStartTasksNbl(pReq->bvTaskIds);
+            break;
+
+        case SC_CTRL_STOP:
+            result = scifStopTasksNbl(pReq->bvTaskIds);
+            break;
+
+        case SC_CTRL_EXECUTE:
+            // Executing once is only allowed for inactive tasks, active
+            // ones get their execution code triggered instead.
+            if (scifGetActiveTaskIds() & pReq->bvTaskIds)
+            {
+                result = scifSwTriggerExecutionCodeNbl(pReq->bvTaskIds);
+            }
+            else
+            {
+                result = scifExecuteTasksOnceNbl(pReq->bvTaskIds);
+            }
+            break;
+
+        default:
+            result = SCIF_ILLEGAL_OPERATION;
+            break;
+        }
+
+        if (result == SCIF_SUCCESS)
+        {
+            g_ctrlInFlight = TRUE;
+        }
+        else if (result == SCIF_NOT_READY)
+        {
+            Clock_stop(Clock_handle(&g_sensorClock));
+            Clock_start(Clock_handle(&g_sensorClock));
+            return;
+        }
+        else
+        {
+            SC_ctrlComplete(result);
+        }
+    }
+} // SC_ctrlIssue
+
+
+/*
+ * @brief   Remove the oldest control request and report its result.
+ *
+ * @param   result - SCIF_RESULT_T of the request
+ *
+ * @return  None.
+ */
+static void SC_ctrlComplete(uint8_t result)
+{
+    sc_ctrl_req_t req = g_ctrlQueue[g_ctrlHead];
+
+    g_ctrlHead = (g_ctrlHead + 1) % SC_CTRL_QUEUE_DEPTH;
+    g_ctrlCount--;
+    g_ctrlInFlight = FALSE;
+
+    TRACE2(TRACE_SC_CTRL_DONE, req.op, result);
+
+    if (req.pfnDone)
+    {
+        req.pfnDone(req.op, req.bvTaskIds, result);
+    }
+} // SC_ctrlComplete
+
+
+/*
+ * @brief   Completion callback of a sample now request.
+ *
+ *          On success the SC has run the execution, so its reading is in
+ *          the output and the next ALERT handled answers the request.
+ *          On failure the request is dropped.
+ *
+ * @param   op        - SC_CTRL_EXECUTE
+ * @param   bvTaskIds - tasks executed
+ * @param   result    - SCIF_RESULT_T of the request
+ *
+ * @return  None.
+ */
+static void SC_execSensorDone(sc_ctrl_op_t op, uint16_t bvTaskIds, uint8_t result)
+{
+    if (result == SCIF_SUCCESS)
+    {
+        g_execDone = TRUE;
+    }
+    else
+    {
+        g_execPending = FALSE;
+    }
+} // SC_execSensorDone
+
+
 /*********************************************************************
  * EXTERN FUNCTIONS
  */
@@ -275,12 +603,12 @@ void SC_init(void)
     // Insert default params
     Clock_Params clockParams;
     Clock_Params_init(&clockParams);
-    // Set period to 0 ms
+    // Set period to 0 ms, one-shot
     clockParams.period = 0;
     // Initialize the clock object / Clock_Struct previously added globally.
     Clock_construct(&g_sensorClock,        // global clock struct
                     SC_sensorClockSwiFxn,  // callback from clock
-                    0,                     // Initial delay before first timeout
+                    MS_TO_TICK(SC_CTRL_RETRY_MS), // Timeout, started on demand
                     &clockParams);         // clock parameters
 
     // Initialize the Sensor Controller
@@ -289,15 +617,32 @@ void SC_init(void)
     scifOsalRegisterTaskAlertCallback(SC_taskAlertHwiCb);
     scifInit(&scifDriverSetup);
 
-    uint32_t rtcHz = 1; // 3Hz RTC
-    scifStartRtcTicksNow(0x00010000 / rtcHz);
+    // Free-running until a connection gives a timing to align to
+    scifStartRtcTicksNow(SC_MS_TO_RTC(SC_SAMPLE_PERIOD_MS));
 
     // Configure SC Tasks here, if any
 
+    /* Initialise UART communication for the pH sensor
+     * Make sure that the jumpers for the RXD and TXD pins are removed
+     * or else the sensor can't send data via UART
+     */
+    UART_init();
+    UART_Params uartParams;
+    UART_Params_init(&uartParams);
+    uartParams.readMode = UART_MODE_CALLBACK;
+    uartParams.readCallback = SC_phReadSwiCb;
+    uartParams.writeMode = UART_MODE_BLOCKING;
+    uartParams.writeDataMode = UART_DATA_TEXT;
+    uartParams.readDataMode = UART_DATA_TEXT;
+    uartParams.readReturnMode = UART_RETURN_NEWLINE;
+    uartParams.baudRate = 9600;
+    g_phUart = UART_open(0, &uartParams);
+    SC_phRead();
+
     // Start Sensor Controller
-    scifStartTasksNbl(BV(SCIF_ADC_TASK_ID));
+    SC_ctrlRequest(SC_CTRL_START, BV(SCIF_ADC_TASK_ID), NULL);
 
-    //Log_info0("scTask initialization done");
+    TRACE0(TRACE_SC_INIT);
 } // SC_init
 
 
@@ -307,7 +652,7 @@ void SC_init(void)
  *          Is called from main loop whenever the APP_MSG_SC_CTRL_READY msg is
  *          sent.
  *
- *          Currently does nothing.
+ *          Completes the control request in progress and issues the next.
  *
  * @param   None.
  *
@@ -315,11 +660,96 @@ void SC_init(void)
  */
 void SC_processCtrlReady(void)
 {
-  // Do nothing
+    if (g_ctrlInFlight)
+    {
+        SC_ctrlComplete(SCIF_SUCCESS);
+    }
 
+    SC_ctrlIssue();
 } // SC_processCtrlReady
 
 
+/*
+ * @brief   Processing function for the APP_MSG_SC_CTRL_RETRY event.
+ *
+ *          Is called from main loop whenever the APP_MSG_SC_CTRL_RETRY msg is
+ *          sent, after the control interface was found busy.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void SC_processCtrlRetry(void)
+{
+    SC_ctrlIssue();
+} // SC_processCtrlRetry
+
+
+/*
+ * @brief   Processing function for the APP_MSG_SC_PH_READ event.
+ *
+ *          Is called from main loop whenever the APP_MSG_SC_PH_READ msg is
+ *          sent.
+ *
+ *          Keeps the reading for the next sample if it is a whole line or
+ *          fills the buffer. What a cancelled read got is dropped.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void SC_processPhRead(void)
+{
+    g_phReading = FALSE;
+
+    if (g_phRxLen == sizeof(g_phRxBuf) ||
+        (g_phRxLen > 0 && g_phRxBuf[g_phRxLen - 1] == '\n'))
+    {
+        memcpy(g_phValue, g_phRxBuf, g_phRxLen);
+        g_phValueLen = g_phRxLen;
+    }
+} // SC_processPhRead
+
+
+/*
+ * @brief   Queue a Sensor Controller control request.
+ *
+ *          Never waits for the Sensor Controller. The request is issued as
+ *          soon as the requests before it are done, and pfnDone is called
+ *          from the app task with the result once the SC has handled it,
+ *          or as soon as the Scif driver rejects it.
+ *
+ * @param   op        - what to do
+ * @param   bvTaskIds - tasks to do it to, BV(SCIF_..._TASK_ID)
+ * @param   pfnDone   - completion callback, may be NULL
+ *
+ * @return  TRUE if queued, FALSE if the queue is full.
+ */
+uint8_t SC_ctrlRequest(sc_ctrl_op_t op, uint16_t bvTaskIds, scCtrlDoneCb_t pfnDone)
+{
+    sc_ctrl_req_t *pReq;
+
+    if (g_ctrlCount == SC_CTRL_QUEUE_DEPTH)
+    {
+        return FALSE;
+    }
+
+    pReq = &g_ctrlQueue[(g_ctrlHead + g_ctrlCount) % SC_CTRL_QUEUE_DEPTH];
+    pReq->op = op;
+    pReq->bvTaskIds = bvTaskIds;
+    pReq->pfnDone = pfnDone;
+    g_ctrlCount++;
+
+    // Unless a retry is already scheduled, try now.
+    if (!Clock_isActive(Clock_handle(&g_sensorClock)))
+    {
+        SC_ctrlIssue();
+    }
+
+    return TRUE;
+} // SC_ctrlRequest
+
+
 /*
  * @brief   Processing function for the APP_MSG_SC_TASK_ALERT event.
  *
@@ -339,28 +769,199 @@ void SC_processTaskAlert(void)
     // Clear the ALERT interrupt source
     scifClearAlertIntSource();
 
+    // Overflow bits [15:8] mean the SC produced output again before the
+    // previous ALERT was acknowledged, i.e. samples were merged.
+    uint32_t bvAlertEvents = scifGetAlertEvents();
+    if (bvAlertEvents & 0xFF00)
+    {
+        Diag_count(DIAG_CNT_ALERT_COALESCED);
+    }
+    Diag_count(DIAG_CNT_SAMPLES_TAKEN);
+    TRACE1(TRACE_SC_SAMPLE, bvAlertEvents);
+
+    // Take the output before anything slow, the next execution may
+    // overwrite it while this sample is processed.
+    SCIF_ADC_OUTPUT_T output;
+    SC_snapshot(&output);
+
     // Do SC Task processing here
 
     // Check which task called and do process
-    SC_processSensor();
+    SC_processSensor(&output);
 
-    // Acknowledge the ALERT event
+    // Acknowledge the ALERT event only now, so the next ALERT cannot come
+    // before this sample's updates are queued (see Latency_beginSample).
+    // Processing does not wait for the pH probe, so this is not held up.
     scifAckAlertEvents();
+
+    // An ALERT handled before the execution was reported done may come from
+    // an execution that was already under way when the request was made.
+    // Once it is done the output holds its reading or a newer one.
+    if (g_execPending && g_execDone)
+    {
+        g_execPending = FALSE;
+        g_execDone = FALSE;
+        g_execAnswered = TRUE;
+        TRACE1(TRACE_SC_EXEC_DONE, TICK_TO_MS(Clock_getTicks() - g_sensorLastTick));
+    }
+
+    // The RTC period is a rounded connection interval multiple. Re-arm from
+    // the next connection event so the phase error never builds up.
+    if (g_syncActive)
+    {
+        g_syncRearm = TRUE;
+    }
 } // SC_processTaskAlert
 
+
 /*
- * @brief   Processing function for the APP_MSG_SC_EXEC_SENSOR event.
+ * @brief   Align the sampling tick to the connection events.
  *
- *          Is called from main loop whenever the APP_MSG_SC_EXEC_SENSOR msg is
- *          sent.
+ *          Is called from main loop at the end of a connection event, while
+ *          SC_connEvtSyncPending() is TRUE.
+ *
+ *          The end of the connection event is taken as the anchor. The next
+ *          tick is put SC_SYNC_LEAD_MS before the anchor one sampling period
+ *          ahead, and ticks repeat every whole number of connection
+ *          intervals closest to SC_SAMPLE_PERIOD_MS.
+ *
+ * @param   connInterval - current connection interval, 1.25 ms units
+ *
+ * @return  None.
+ */
+void SC_connEvtEnd(uint16_t connInterval)
+{
+    if (!g_syncEnabled || !g_syncRearm || connInterval == 0)
+    {
+        return;
+    }
+
+    uint32_t now = AONRTCCurrentCompareValueGet();
+    uint32_t intervalRtc = SC_CI_TO_RTC(connInterval);
+    uint32_t nIntervals = (SC_SAMPLE_PERIOD_MS * 4 / 5 + connInterval / 2) / connInterval;
+    if (nIntervals == 0)
+    {
+        nIntervals = 1;
+    }
+
+    uint32_t tickStart = now + nIntervals * intervalRtc - SC_MS_TO_RTC(SC_SYNC_LEAD_MS);
+    while ((int32_t)(tickStart - now) < (int32_t)SC_MS_TO_RTC(SC_SYNC_MARGIN_MS))
+    {
+        tickStart += intervalRtc;
+    }
+
+    scifStartRtcTicks(tickStart, nIntervals * intervalRtc);
+
+    g_syncActive = TRUE;
+    g_syncRearm = FALSE;
+} // SC_connEvtEnd
+
+
+/*
+ * @brief   Check whether the sampling tick waits for a connection event end
+ *          to be aligned.
+ *
+ * @param   None.
+ *
+ * @return  TRUE if SC_connEvtEnd() has work to do.
+ */
+uint8_t SC_connEvtSyncPending(void)
+{
+    return g_syncEnabled && g_syncRearm;
+} // SC_connEvtSyncPending
+
+
+/*
+ * @brief   Check whether samples are timed to meet the connection events.
  *
- *          Executes the Ranger SC task once.
+ *          If so, the app sends a sample as soon as it is processed instead
+ *          of waiting for the end of the connection event.
  *
  * @param   None.
  *
+ * @return  TRUE while aligned.
+ */
+uint8_t SC_connEvtSynced(void)
+{
+    return g_syncActive;
+} // SC_connEvtSynced
+
+
+/*
+ * @brief   Follow the connection state: align once connected, go back to
+ *          the free-running tick when disconnected.
+ *
+ * @param   connected - TRUE if a connection was just established
+ *
  * @return  None.
  */
+void SC_connectionChanged(uint8_t connected)
+{
+    if (!g_syncEnabled)
+    {
+        return;
+    }
 
+    if (connected)
+    {
+        g_syncRearm = TRUE;
+    }
+    else
+    {
+        g_syncActive = FALSE;
+        g_syncRearm = FALSE;
+        scifStartRtcTicksNow(SC_MS_TO_RTC(SC_SAMPLE_PERIOD_MS));
+    }
+} // SC_connectionChanged
+
+/*
+ * @brief   Take a sample now.
+ *
+ *          Is called from the app task when a peer writes the Sample Now
+ *          characteristic.
+ *
+ *          Queues a one-shot execution of the sensor SC task, outside the
+ *          RTC schedule. The reading is processed when the ALERT fires,
+ *          like any other sample.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
 void SC_execSensor(void)
 {
-} // SC_execRanger
+    uint8_t queued;
+
+    if (g_execPending && !g_execDone)
+    {
+        // The execution still to run answers this request too
+        return;
+    }
+
+    g_sensorLastTick = Clock_getTicks();
+    g_execDone = FALSE;
+    queued = SC_ctrlRequest(SC_CTRL_EXECUTE, BV(SCIF_ADC_TASK_ID),
+                            SC_execSensorDone);
+    g_execPending = queued;
+
+    TRACE1(TRACE_SC_EXEC, queued);
+} // SC_execSensor
+
+
+/*
+ * @brief   Check whether the last sample answered a sample now request.
+ *
+ *          If so, the app sends it right away instead of waiting for the
+ *          end of the connection event. Clears the flag.
+ *
+ * @param   None.
+ *
+ * @return  TRUE once per answered request.
+ */
+uint8_t SC_execSensorAnswered(void)
+{
+    uint8_t answered = g_execAnswered;
+
+    g_execAnswered = FALSE;
+    return answered;
+} // SC_execSensorAnswered
@@ -0,0 +1,325 @@
+/*
+ * Windowed sample statistics, see stats.h.
+ *
+ * The sums are kept relative to the first sample of the window, so they
+ * stay small for the slowly changing values of a water sensor. The
+ * variance is (n * sum of squares - sum^2) / n^2, exact in 64-bit integers
+ * for any window the counts allow, and the standard deviation is its
+ * integer square root. All integer, no floats. A window is ended by the
+ * first sample past it, so while sampling is stopped its result is held
+ * back.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+
+#include <driverlib/aon_rtc.h>
+
+#include "stats.h"
+
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Samples per window at most. With deltas below 2^16 this keeps
+// n * sum of squares and sum^2 below 2^64.
+#define STATS_MAX_COUNT            0xFFFF
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Running sums of one channel in the current window.
+typedef struct
+{
+  int32_t  ref;    // First sample, the sums are relative to it
+  int32_t  min;
+  int32_t  max;
+  int64_t  sum;
+  uint64_t sumSq;
+} stats_acc_t;
+
+typedef struct
+{
+  uint32_t    index;  // RTC seconds / window length
+  uint16_t    count;  // Samples so far, 0 before the first
+  stats_acc_t acc[STATS_NUM_CHANNELS];
+} stats_window_t;
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static const uint32_t statsWindowLen[STATS_NUM_WINDOWS] =
+{
+  STATS_WINDOW_SHORT_S,
+  STATS_WINDOW_MEDIUM_S,
+  STATS_WINDOW_LONG_S
+};
+
+static stats_window_t statsWindow[STATS_NUM_WINDOWS];
+
+// Result of the last ended window, count 0 if none.
+static stats_rec_t statsResult[STATS_NUM_WINDOWS][STATS_NUM_CHANNELS];
+
+// Results still to notify, bit window * STATS_NUM_CHANNELS + channel.
+static uint16_t statsPending = 0;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Integer square root.
+ *
+ * @param   x - value
+ *
+ * @return  floor(sqrt(x)).
+ */
+static uint16_t Stats_sqrt(uint32_t x)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > x)
+  {
+    bit >>= 2;
+  }
+
+  while (bit != 0)
+  {
+    if (x >= root + bit)
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return (uint16_t)root;
+}
+
+/*
+ * @brief   Turn the sums of a window into its results and queue them to be
+ *          notified.
+ *
+ * @param   window - STATS_WINDOW_*
+ *
+ * @return  None.
+ */
+static void Stats_endWindow(uint8_t window)
+{
+  stats_window_t *pWin = &statsWindow[window];
+  uint64_t n = pWin->count;
+  uint8_t ch;
+
+  for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+  {
+    stats_acc_t *pAcc = &pWin->acc[ch];
+    stats_rec_t *pRes = &statsResult[window][ch];
+
+    // Mean relative to the first sample, rounded
+    int64_t meanRel = (pAcc->sum >= 0) ?
+                      (pAcc->sum + (int64_t)(n / 2)) / (int64_t)n :
+                      (pAcc->sum - (int64_t)(n / 2)) / (int64_t)n;
+
+    // Population variance, floored. n * sumSq >= sum^2, so no underflow.
+    uint64_t absSum = (pAcc->sum >= 0) ? (uint64_t)pAcc->sum :
+                                         (uint64_t)-pAcc->sum;
+    uint64_t var = (n * pAcc->sumSq - absSum * absSum) / (n * n);
+
+    if (var > 0xFFFFFFFF)
+    {
+      var = 0xFFFFFFFF;
+    }
+
+    pRes->endSec = (pWin->index + 1) * statsWindowLen[window];
+    pRes->window = window;
+    pRes->channel = ch;
+    pRes->count = pWin->count;
+    pRes->min = (uint16_t)pAcc->min;
+    pRes->max = (uint16_t)pAcc->max;
+    pRes->mean = (uint16_t)(pAcc->ref + meanRel);
+    pRes->stdDev = Stats_sqrt((uint32_t)var);
+
+    statsPending |= 1 << (window * STATS_NUM_CHANNELS + ch);
+  }
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Drop the windows in progress and all results.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Stats_init(void)
+{
+  memset(statsWindow, 0, sizeof(statsWindow));
+  memset(statsResult, 0, sizeof(statsResult));
+  statsPending = 0;
+}
+
+/*
+ * @brief   Add a sample to every window. A window the sample is past is
+ *          ended first and a new one started with the sample.
+ *
+ * @param   pRec - sample
+ *
+ * @return  None.
+ */
+void Stats_add(const sample_rec_t *pRec)
+{
+  uint32_t now = AONRTCSecGet();
+  uint8_t w;
+  uint8_t ch;
+
+  for (w = 0; w < STATS_NUM_WINDOWS; w++)
+  {
+    stats_window_t *pWin = &statsWindow[w];
+    uint32_t index = now / statsWindowLen[w];
+
+    if (pWin->count != 0 && index != pWin->index)
+    {
+      Stats_endWindow(w);
+      pWin->count = 0;
+    }
+
+    if (pWin->count == 0)
+    {
+      pWin->index = index;
+
+      for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+      {
+        int32_t value = Stats_channelValue(pRec, ch);
+
+        pWin->acc[ch].ref = value;
+        pWin->acc[ch].min = value;
+        pWin->acc[ch].max = value;
+        pWin->acc[ch].sum = 0;
+        pWin->acc[ch].sumSq = 0;
+      }
+    }
+
+    if (pWin->count == STATS_MAX_COUNT)
+    {
+      continue;
+    }
+
+    pWin->count++;
+
+    for (ch = 0; ch < STATS_NUM_CHANNELS; ch++)
+    {
+      stats_acc_t *pAcc = &pWin->acc[ch];
+      int32_t value = Stats_channelValue(pRec, ch);
+      int32_t delta = value - pAcc->ref;
+
+      pAcc->sum += delta;
+      pAcc->sumSq += (uint64_t)((int64_t)delta * delta);
+
+      if (value < pAcc->min)
+      {
+        pAcc->min = value;
+      }
+      if (value > pAcc->max)
+      {
+        pAcc->max = value;
+      }
+    }
+  }
+}
+
+/*
+ * @brief   Get the statistics of the last ended window.
+ *
+ * @param   window  - STATS_WINDOW_*
+ * @param   channel - STATS_CH_*
+ *
+ * @return  The result, NULL if no window of that length ended yet.
+ */
+const stats_rec_t *Stats_getResult(uint8_t window, uint8_t channel)
+{
+  if (window >= STATS_NUM_WINDOWS || channel >= STATS_NUM_CHANNELS ||
+      statsResult[window][channel].count == 0)
+  {
+    return NULL;
+  }
+
+  return &statsResult[window][channel];
+}
+
+/*
+ * @brief   Get the next result to notify, shortest window first.
+ *
+ * @param   None.
+ *
+ * @return  The result, NULL if there is none left.
+ */
+const stats_rec_t *Stats_nextPublish(void)
+{
+  uint8_t bit;
+
+  for (bit = 0; bit < STATS_NUM_WINDOWS * STATS_NUM_CHANNELS; bit++)
+  {
+    if (statsPending & (1 << bit))
+    {
+      return &statsResult[bit / STATS_NUM_CHANNELS][bit % STATS_NUM_CHANNELS];
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * @brief   Move on to the next result to notify.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Stats_publishDone(void)
+{
+  // Lowest bit set
+  statsPending &= statsPending - 1;
+}
+
+/*
+ * @brief   Get a channel out of a sample record.
+ *
+ * @param   pRec    - sample
+ * @param   channel - STATS_CH_*
+ *
+ * @return  The value, sign extended for temperature.
+ */
+int32_t Stats_channelValue(const sample_rec_t *pRec, uint8_t channel)
+{
+  switch (channel)
+  {
+    case STATS_CH_TEMPERATURE:
+      return pRec->temperature;
+    case STATS_CH_PRESSURE:
+      return pRec->pressure;
+    case STATS_CH_FLOW:
+      return pRec->flow;
+    case STATS_CH_CONDUCTIVITY:
+      return pRec->conductivity;
+    default:
+      return pRec->turbidity;
+  }
+}
@@ -0,0 +1,62 @@
+/*
+ * Windowed sample statistics.
+ *
+ * Every sample record is added to running min/max/sum/sum of squares
+ * accumulators, one per channel and window length. When a window ends its
+ * count, min, max, mean and standard deviation become a stats_rec_t, which
+ * is notified on the BLE service's Stats characteristic. A gateway that
+ * only wants aggregates subscribes to that alone and gets STATS_NUM_CHANNELS
+ * notifications per window instead of one record per sample.
+ *
+ * Windows are aligned to the RTC seconds, a window of length L covers
+ * [k * L, (k + 1) * L). The first window after boot is partial, its count
+ * tells by how much.
+ *
+ * Task context only.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include "samplelog.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Window lengths [s].
+#ifndef STATS_WINDOW_SHORT_S
+#define STATS_WINDOW_SHORT_S       60
+#endif
+#ifndef STATS_WINDOW_MEDIUM_S
+#define STATS_WINDOW_MEDIUM_S      (15 * 60)
+#endif
+#ifndef STATS_WINDOW_LONG_S
+#define STATS_WINDOW_LONG_S        (60 * 60)
+#endif
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Stats_init(void);
+
+// Add a sample, ending the windows it is past first.
+void Stats_add(const sample_rec_t *pRec);
+
+// Statistics of the last ended window, NULL if none ended yet.
+const stats_rec_t *Stats_getResult(uint8_t window, uint8_t channel);
+
+// Next result to notify, NULL when done. Stays the same until
+// Stats_publishDone is called, so a send the stack refused is retried.
+const stats_rec_t *Stats_nextPublish(void);
+void Stats_publishDone(void);
+
+// Channel of a sample record, STATS_CH_*, sign extended for temperature.
+int32_t Stats_channelValue(const sample_rec_t *pRec, uint8_t channel);
+
+#endif /* STATS_H */
@@ -0,0 +1,217 @@
+/*
+ * Notification throughput test, see tput.h.
+ *
+ * The notifications queued at the end of one connection event go out in
+ * the next, so the number queued per call is the packets per connection
+ * event the link sustains.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+
+#include <ti/sysbios/knl/Clock.h>
+
+#include <bcomdef.h>
+#include <att.h>
+
+#include <diag_service.h>
+
+#include "tput.h"
+#include "notify.h"
+#include "trace.h"
+
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Cap on notifications queued in one call, should the stack never refuse.
+#define TPUT_MAX_PER_EVT           255
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Fails to compile if the report no longer matches the length of the
+// Throughput characteristic.
+typedef char tput_reportLenCheck[(TPUT_REPORT_LEN ==
+                                  DIAGSERVICE_TPUT_LEN) ? 1 : -1];
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static tput_report_t tputReport;
+
+static uint16_t tputConnHandle = 0;
+static uint32_t tputStartTick = 0;
+
+// Sequence number of the next notification.
+static uint32_t tputSeq = 0;
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*
+ * @brief   Write the test payload of the next notification.
+ *
+ * @param   pBuf - stack buffer
+ * @param   len  - payload length
+ *
+ * @return  None.
+ */
+static void Tput_fill(uint8_t *pBuf, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    pBuf[i] = (i < 4) ? BREAK_UINT32(tputSeq, i) : (uint8_t)(tputSeq + i);
+  }
+}
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Start a run, clearing the report of the previous one.
+ *
+ * @param   connHandle - connection to send on
+ *
+ * @return  None.
+ */
+void Tput_start(uint16_t connHandle)
+{
+  memset(&tputReport, 0, sizeof(tputReport));
+
+  tputConnHandle = connHandle;
+  tputSeq = 0;
+
+  tputReport.payloadLen = ATT_GetMTU(connHandle) - 3;
+  tputReport.running = TRUE;
+  tputStartTick = Clock_getTicks();
+}
+
+/*
+ * @brief   End the run and work out the rates.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Tput_stop(void)
+{
+  if (!tputReport.running)
+  {
+    return;
+  }
+
+  tputReport.running = FALSE;
+  tputReport.durationMs = (uint32_t)(((uint64_t)(Clock_getTicks() - tputStartTick) *
+                                      Clock_tickPeriod) / 1000);
+
+  if (tputReport.durationMs != 0)
+  {
+    tputReport.bytesPerSec = (uint32_t)(((uint64_t)tputReport.bytes * 1000) /
+                                        tputReport.durationMs);
+  }
+
+  if (tputReport.connEvents != 0)
+  {
+    tputReport.pktsPerEvtX100 = (uint16_t)(((uint64_t)tputReport.packets * 100) /
+                                           tputReport.connEvents);
+  }
+
+  TRACE2(TRACE_TPUT_DONE, tputReport.payloadLen, tputReport.bytesPerSec);
+}
+
+/*
+ * @brief   Check for a run in progress.
+ *
+ * @param   None.
+ *
+ * @return  TRUE while running.
+ */
+uint8_t Tput_isRunning(void)
+{
+  return tputReport.running;
+}
+
+/*
+ * @brief   Queue notifications until the stack has no buffers left.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Tput_onConnEvt(void)
+{
+  uint16_t sent = 0;
+  uint8_t unsubscribed = FALSE;
+
+  if (!tputReport.running)
+  {
+    return;
+  }
+
+  while (sent < TPUT_MAX_PER_EVT)
+  {
+    uint8_t status = DiagService_NotifyThroughput(tputConnHandle,
+                                                  tputReport.payloadLen,
+                                                  Tput_fill);
+    if (status == SUCCESS)
+    {
+      sent++;
+      tputSeq++;
+    }
+    else if (status == bleIncorrectMode)
+    {
+      unsubscribed = TRUE;
+      break;
+    }
+    else
+    {
+      if (!Notify_isRetryable(status))
+      {
+        tputReport.dropped++;
+      }
+      break;
+    }
+  }
+
+  tputReport.connEvents++;
+  tputReport.packets += sent;
+  tputReport.bytes += (uint32_t)sent * tputReport.payloadLen;
+
+  if (sent > tputReport.maxPktsPerEvt)
+  {
+    tputReport.maxPktsPerEvt = (uint8_t)sent;
+  }
+
+  // The peer unsubscribed, nobody is listening any more.
+  if (unsubscribed)
+  {
+    Tput_stop();
+  }
+}
+
+/*
+ * @brief   Get the report of the last run, or of the run in progress so far.
+ *
+ * @param   None.
+ *
+ * @return  The report.
+ */
+const tput_report_t *Tput_getReport(void)
+{
+  return &tputReport;
+}
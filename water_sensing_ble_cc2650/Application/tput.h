@@ -0,0 +1,66 @@
+/*
+ * Notification throughput test.
+ *
+ * While running, every connection event end tops the stack up with
+ * synthetic notifications on the diagnostics service's throughput
+ * characteristic, as many as it takes. Each carries the full ATT MTU
+ * payload: a 32-bit sequence number, so the central can count what it
+ * lost, followed by a counting pattern. Stopping the test leaves a
+ * tput_report_t behind to size gateways and pick connection parameters.
+ *
+ * Task context only.
+ */
+#ifndef TPUT_H
+#define TPUT_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Commands written to the throughput characteristic.
+#define TPUT_CMD_STOP              0x00
+#define TPUT_CMD_START             0x01
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Result of the last run, as exposed over the air (little endian, packed).
+#pragma pack(push, 1)
+typedef struct
+{
+  uint32_t bytes;          // Payload bytes handed to the stack
+  uint32_t packets;        // Notifications handed to the stack
+  uint32_t durationMs;     // Start to stop
+  uint32_t bytesPerSec;
+  uint32_t connEvents;     // Connection events the test ran in
+  uint16_t pktsPerEvtX100; // Average notifications per connection event, x100
+  uint8_t  maxPktsPerEvt;
+  uint16_t payloadLen;     // Notification payload, ATT MTU - 3
+  uint32_t dropped;        // Notifications the stack refused for other reasons
+                           // than full buffers, never sent
+  uint8_t  running;        // TRUE while the test is going on
+} tput_report_t;
+#pragma pack(pop)
+
+#define TPUT_REPORT_LEN            (sizeof(tput_report_t))
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Tput_start(uint16_t connHandle);
+void Tput_stop(void);
+uint8_t Tput_isRunning(void);
+
+// Called when a connection event ends.
+void Tput_onConnEvt(void);
+
+const tput_report_t *Tput_getReport(void);
+
+#endif /* TPUT_H */
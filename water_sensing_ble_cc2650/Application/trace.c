@@ -0,0 +1,151 @@
+/*
+ * Binary event trace, see trace.h.
+ */
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include <xdc/std.h>
+#include <xdc/runtime/Types.h>
+#include <xdc/runtime/Timestamp.h>
+
+#include <ti/sysbios/hal/Hwi.h>
+
+#include <diag_service.h>
+
+#include "trace.h"
+
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// The dump is the Trace characteristic value, so TRACE_RING_SIZE and the
+// characteristic length go together.
+typedef char trace_bufLenCheck[(TRACE_BUF_LEN ==
+                                DIAGSERVICE_TRACE_LEN) ? 1 : -1];
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static trace_buf_t traceBuf;
+
+// Set while the ring is frozen for a dump.
+static volatile uint8_t traceFrozen = FALSE;
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*
+ * @brief   Initialize the trace ring.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void Trace_init(void)
+{
+  Types_FreqHz freq;
+
+  memset(&traceBuf, 0, sizeof(traceBuf));
+
+  Timestamp_getFreq(&freq);
+  traceBuf.freqHz = freq.lo;
+}
+
+
+/*
+ * @brief   Store one trace record, overwriting the oldest when full.
+ *
+ *          Interrupts are only masked while the slot is claimed and filled,
+ *          a few instructions, so trace points are fine in Hwi context.
+ *
+ * @param   id   - event ID
+ * @param   arg0 - first argument
+ * @param   arg1 - second argument
+ *
+ * @return  None.
+ */
+void Trace_write(trace_id_t id, uint16_t arg0, uint32_t arg1)
+{
+  trace_rec_t *pRec;
+  uint32_t now;
+  UInt key;
+
+  if (traceFrozen)
+  {
+    return;
+  }
+
+  now = Timestamp_get32();
+
+  key = Hwi_disable();
+
+  pRec = &traceBuf.rec[traceBuf.head & (TRACE_RING_SIZE - 1)];
+  pRec->timestamp = now;
+  pRec->id = id;
+  pRec->arg0 = arg0;
+  pRec->arg1 = arg1;
+
+  traceBuf.head++;
+  if (traceBuf.count < TRACE_RING_SIZE)
+  {
+    traceBuf.count++;
+  }
+
+  Hwi_restore(key);
+}
+
+
+/*
+ * @brief   Execute a command written to the trace characteristic.
+ *
+ * @param   cmd - one of TRACE_CMD_*
+ *
+ * @return  None.
+ */
+void Trace_control(uint8_t cmd)
+{
+  UInt key;
+
+  switch (cmd)
+  {
+    case TRACE_CMD_RUN:
+      traceFrozen = FALSE;
+      break;
+
+    case TRACE_CMD_FREEZE:
+      traceFrozen = TRUE;
+      break;
+
+    case TRACE_CMD_CLEAR:
+      key = Hwi_disable();
+      traceBuf.head = 0;
+      traceBuf.count = 0;
+      Hwi_restore(key);
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+/*
+ * @brief   Get the trace buffer in its dump format.
+ *
+ *          The buffer is live: freeze it first for a consistent dump.
+ *
+ * @param   None.
+ *
+ * @return  Pointer to the TRACE_BUF_LEN byte trace buffer.
+ */
+const trace_buf_t *Trace_getBuffer(void)
+{
+  return &traceBuf;
+}
@@ -0,0 +1,144 @@
+/*
+ * Binary event trace.
+ *
+ * Replacement for the xdc Log calls, which are too expensive to leave on in
+ * a deployed node. A trace point stores a fixed size record (timestamp,
+ * event ID and two arguments) into a RAM ring and can be used from any
+ * context, including Hwi. Strings never leave the host: the ring is read
+ * as raw binary from the diagnostics service and tools/trace_decode.py
+ * turns the IDs back into the messages listed in TRACE_EVENTS below.
+ *
+ * Records are readable by a bonded central, never put secrets such as
+ * keys or passcodes in them.
+ *
+ * Define TRACE_DISABLE_ALL to compile all trace points out.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Number of records kept, must be a power of two. Keep the whole buffer
+// below the 512 byte ATT attribute limit so it can be read in one go.
+#define TRACE_RING_SIZE            32
+
+// Commands written to the trace characteristic.
+#define TRACE_CMD_RUN              0x00 /* Resume tracing                  */
+#define TRACE_CMD_FREEZE           0x01 /* Stop recording, keep contents   */
+#define TRACE_CMD_CLEAR            0x02 /* Drop all records                */
+
+/*
+ * Trace events: X(id, message). The host decoder parses this list, so keep
+ * one entry per line and only ever append. Messages use printf syntax with
+ * up to two arguments, arg0 (16 bit) then arg1 (32 bit).
+ */
+#define TRACE_EVENTS(X) \
+  X(TRACE_APP_INIT,              "Initializing the user task, hardware, BLE stack and services") \
+  X(TRACE_ERR_LED_PINS,          "Error initializing board LED pins") \
+  X(TRACE_PASSCODE_REQ,          "BondMgr requested passcode. uiInputs %d") \
+  X(TRACE_GAP_STARTED,           "GAP is started") \
+  X(TRACE_GAP_ADVERTISING,       "Advertising") \
+  X(TRACE_GAP_CONNECTED,         "Connected") \
+  X(TRACE_GAP_CONNECTED_ADV,     "Connected and advertising") \
+  X(TRACE_GAP_WAITING,           "Disconnected / Idle") \
+  X(TRACE_GAP_TIMEOUT,           "Connection timed out") \
+  X(TRACE_GAP_ERROR,             "GAP error") \
+  X(TRACE_CCCD_CHANGE,           "CCCD change: paramID %d, config 0x%04x") \
+  X(TRACE_HCI_CMD_COMPLETE,      "HCI Command Complete Event received") \
+  X(TRACE_ATT_RSP_PENDING,       "Outgoing RF FIFO full. Re-schedule transmission of msg with opcode 0x%02x") \
+  X(TRACE_ATT_FLOW_CTRL,         "Flow control violated. Opcode of offending ATT msg: 0x%02x") \
+  X(TRACE_MTU_UPDATED,           "MTU Size change: %d bytes") \
+  X(TRACE_GATT_MSG,              "Received GATT Message. Opcode: 0x%02x") \
+  X(TRACE_ATT_RSP_RETRY,         "Retrying message with opcode 0x%02x. Attempt %d") \
+  X(TRACE_ATT_RSP_SENT,          "Sent message with opcode 0x%02x. Attempt %d") \
+  X(TRACE_ATT_RSP_FAILED,        "Gave up message with opcode 0x%02x. Status: %d") \
+  X(TRACE_GAP_STATE_CB,          "(CB) GAP State change: %d") \
+  X(TRACE_PAIRING_STARTED,       "Pairing started") \
+  X(TRACE_PAIRING_COMPLETE,      "Pairing completed successfully") \
+  X(TRACE_PAIRING_FAILED,        "Pairing failed. Error: %02x") \
+  X(TRACE_PAIRING_BONDED,        "Re-established pairing from stored bond info") \
+  X(TRACE_CHAR_WRITE_CB,         "(CB) Characteristic value change: paramID(%d) svc(0x%04x)") \
+  X(TRACE_CHAR_CFG_CB,           "(CB) Char config change: paramID(%d) svc(0x%04x)") \
+  X(TRACE_SC_INIT,               "scTask initialization done") \
+  X(TRACE_SC_ALERT,              "SC task alert") \
+  X(TRACE_SC_CTRL_READY,         "SC control ready") \
+  X(TRACE_SC_SAMPLE,             "SC sample processed, alert events 0x%04x") \
+  X(TRACE_STACK_ASSERT,          "Stack assert, cause %d subcause %d") \
+  X(TRACE_RESOURCE_ALARM,        "Resource alarm raised: 0x%02x") \
+  X(TRACE_NOTI_DROPPED,          "Notification retry queue full, dropped paramID %d") \
+  X(TRACE_GAP_FILL,              "Gap fill: resending %d records from seq %d") \
+  X(TRACE_TPUT_DONE,             "Throughput test done: %d byte payloads, %d bytes/s") \
+  X(TRACE_SC_EXEC,               "SC sample now requested, queued %d") \
+  X(TRACE_SC_EXEC_DONE,          "SC sample now answered after %d ms") \
+  X(TRACE_SC_CTRL_DONE,          "SC control request %d done, scif result %d") \
+  X(TRACE_HISTORY_QUERY,         "History query: resolution %d from %d s")
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+#define TRACE_ENUM_ENTRY(id, msg)  id,
+
+typedef enum
+{
+  TRACE_EVENTS(TRACE_ENUM_ENTRY)
+  TRACE_NUM_EVENTS
+} trace_id_t;
+
+// One trace record (little endian, packed).
+#pragma pack(push, 1)
+typedef struct
+{
+  uint32_t timestamp;   // Timestamp_get32() ticks
+  uint16_t id;          // trace_id_t
+  uint16_t arg0;
+  uint32_t arg1;
+} trace_rec_t;
+
+// Dump format, identical over BLE and UART.
+typedef struct
+{
+  uint16_t head;        // Total records written, oldest is head - count
+  uint16_t count;       // Valid records in the ring
+  uint32_t freqHz;      // Timestamp frequency
+  trace_rec_t rec[TRACE_RING_SIZE];
+} trace_buf_t;
+#pragma pack(pop)
+
+#define TRACE_BUF_LEN              (sizeof(trace_buf_t))
+
+/*********************************************************************
+ * MACROS
+ */
+
+#ifndef TRACE_DISABLE_ALL
+#define TRACE(id, arg0, arg1)      Trace_write((id), (arg0), (arg1))
+#else
+#define TRACE(id, arg0, arg1)
+#endif
+
+#define TRACE0(id)                 TRACE((id), 0, 0)
+#define TRACE1(id, arg0)           TRACE((id), (arg0), 0)
+#define TRACE2(id, arg0, arg1)     TRACE((id), (arg0), (arg1))
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Trace_init(void);
+
+// Safe from any context.
+void Trace_write(trace_id_t id, uint16_t arg0, uint32_t arg1);
+
+// Task context only.
+void Trace_control(uint8_t cmd);
+const trace_buf_t *Trace_getBuffer(void);
+
+#endif /* TRACE_H */
@@ -104,6 +104,31 @@ CONST uint8_t bleService_PhValueUUID[ATT_UUID_SIZE] =
 {
   TI_BASE_UUID_128(BLESERVICE_PHVALUE_UUID)
 };
+// record UUID
+CONST uint8_t bleService_RecordUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(BLESERVICE_RECORD_UUID)
+};
+// gapFill UUID
+CONST uint8_t bleService_GapFillUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(BLESERVICE_GAPFILL_UUID)
+};
+// sampleNow UUID
+CONST uint8_t bleService_SampleNowUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(BLESERVICE_SAMPLENOW_UUID)
+};
+// stats UUID
+CONST uint8_t bleService_StatsUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(BLESERVICE_STATS_UUID)
+};
+// history UUID
+CONST uint8_t bleService_HistoryUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(BLESERVICE_HISTORY_UUID)
+};
 
 /*********************************************************************
  * LOCAL VARIABLES
@@ -164,6 +189,40 @@ static uint8_t bleService_PhValueVal[BLESERVICE_PHVALUE_LEN] = {0};
 
 // Characteristic "PhValue" CCCD
 static gattCharCfg_t *bleService_PhValueConfig;
+// Characteristic "Record" Properties (for declaration)
+static uint8_t bleService_RecordProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+// Characteristic "Record" Value variable
+static uint8_t bleService_RecordVal[BLESERVICE_RECORD_LEN] = {0};
+
+// Characteristic "Record" CCCD
+static gattCharCfg_t *bleService_RecordConfig;
+// Characteristic "GapFill" Properties (for declaration)
+static uint8_t bleService_GapFillProps = GATT_PROP_READ | GATT_PROP_WRITE;
+
+// Characteristic "GapFill" Value variable
+static uint8_t bleService_GapFillVal[BLESERVICE_GAPFILL_LEN] = {0};
+// Characteristic "SampleNow" Properties (for declaration)
+static uint8_t bleService_SampleNowProps = GATT_PROP_WRITE;
+
+// Characteristic "SampleNow" Value variable
+static uint8_t bleService_SampleNowVal[BLESERVICE_SAMPLENOW_LEN] = {0};
+// Characteristic "Stats" Properties (for declaration)
+static uint8_t bleService_StatsProps = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_NOTIFY;
+
+// Characteristic "Stats" Value variable
+static uint8_t bleService_StatsVal[BLESERVICE_STATS_LEN] = {0};
+
+// Characteristic "Stats" CCCD
+static gattCharCfg_t *bleService_StatsConfig;
+// Characteristic "History" Properties (for declaration)
+static uint8_t bleService_HistoryProps = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_NOTIFY;
+
+// Characteristic "History" Value variable
+static uint8_t bleService_HistoryVal[BLESERVICE_HISTORY_LEN] = {0};
+
+// Characteristic "History" CCCD
+static gattCharCfg_t *bleService_HistoryConfig;
 
 /*********************************************************************
 * Profile Attributes - Table
@@ -304,6 +363,97 @@ static gattAttribute_t bleServiceAttrTbl[] =
           0,
           (uint8 *)&bleService_PhValueConfig
         },
+    // Record Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &bleService_RecordProps
+    },
+      // Record Characteristic Value
+      {
+        { ATT_UUID_SIZE, bleService_RecordUUID },
+        GATT_PERMIT_READ,
+        0,
+        bleService_RecordVal
+      },
+      // Record CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8 *)&bleService_RecordConfig
+      },
+    // GapFill Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &bleService_GapFillProps
+    },
+      // GapFill Characteristic Value
+      {
+        { ATT_UUID_SIZE, bleService_GapFillUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        bleService_GapFillVal
+      },
+    // SampleNow Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &bleService_SampleNowProps
+    },
+      // SampleNow Characteristic Value
+      {
+        { ATT_UUID_SIZE, bleService_SampleNowUUID },
+        GATT_PERMIT_WRITE,
+        0,
+        bleService_SampleNowVal
+      },
+    // Stats Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &bleService_StatsProps
+    },
+      // Stats Characteristic Value
+      {
+        { ATT_UUID_SIZE, bleService_StatsUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        bleService_StatsVal
+      },
+      // Stats CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8 *)&bleService_StatsConfig
+      },
+    // History Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &bleService_HistoryProps
+    },
+      // History Characteristic Value
+      {
+        { ATT_UUID_SIZE, bleService_HistoryUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        bleService_HistoryVal
+      },
+      // History CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8 *)&bleService_HistoryConfig
+      },
 };
 
 /*********************************************************************
@@ -394,6 +544,33 @@ bStatus_t BleService_AddService( void )
 
   // Initialize Client Characteristic Configuration attributes
   GATTServApp_InitCharCfg( INVALID_CONNHANDLE, bleService_PhValueConfig );
+  // Allocate Client Characteristic Configuration table
+  bleService_RecordConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( bleService_RecordConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, bleService_RecordConfig );
+  // Allocate Client Characteristic Configuration table
+  bleService_StatsConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( bleService_StatsConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, bleService_StatsConfig );
+  // Allocate Client Characteristic Configuration table
+  bleService_HistoryConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( bleService_HistoryConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, bleService_HistoryConfig );
   // Register GATT attribute list and CBs with GATT Server App
   status = GATTServApp_RegisterService( bleServiceAttrTbl,
                                         GATT_NUM_ATTRS( bleServiceAttrTbl ),
@@ -444,7 +621,7 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_TemperatureValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_TemperatureValueConfig, (uint8_t *)&bleService_TemperatureValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_TemperatureValueConfig, (uint8_t *)&bleService_TemperatureValueVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -460,7 +637,7 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_PressureValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_PressureValueConfig, (uint8_t *)&bleService_PressureValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_PressureValueConfig, (uint8_t *)&bleService_PressureValueVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -476,7 +653,7 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_FlowValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_FlowValueConfig, (uint8_t *)&bleService_FlowValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_FlowValueConfig, (uint8_t *)&bleService_FlowValueVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -492,7 +669,7 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_ConductivityValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_ConductivityValueConfig, (uint8_t *)&bleService_ConductivityValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_ConductivityValueConfig, (uint8_t *)&bleService_ConductivityValueVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -508,7 +685,7 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_TurbidityValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_TurbidityValueConfig, (uint8_t *)&bleService_TurbidityValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_TurbidityValueConfig, (uint8_t *)&bleService_TurbidityValueVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -524,7 +701,78 @@ bStatus_t BleService_SetParameter( uint8 param, uint8 len, void *value )
         memcpy(bleService_PhValueVal, value, len);
 
         // Try to send notification.
-        GATTServApp_ProcessCharCfg( bleService_PhValueConfig, (uint8_t *)&bleService_PhValueVal, FALSE,
+        ret = GATTServApp_ProcessCharCfg( bleService_PhValueConfig, (uint8_t *)&bleService_PhValueVal, FALSE,
+                                    bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
+                                    INVALID_TASK_ID,  bleService_ReadAttrCB);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case BLESERVICE_RECORD:
+      if ( len == BLESERVICE_RECORD_LEN )
+      {
+        memcpy(bleService_RecordVal, value, len);
+
+        // Try to send notification.
+        ret = GATTServApp_ProcessCharCfg( bleService_RecordConfig, (uint8_t *)&bleService_RecordVal, FALSE,
+                                    bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
+                                    INVALID_TASK_ID,  bleService_ReadAttrCB);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case BLESERVICE_GAPFILL:
+      if ( len == BLESERVICE_GAPFILL_LEN )
+      {
+        memcpy(bleService_GapFillVal, value, len);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case BLESERVICE_STATS:
+      if ( len == BLESERVICE_STATS_LEN )
+      {
+        memcpy(bleService_StatsVal, value, len);
+
+        // Try to send notification.
+        ret = GATTServApp_ProcessCharCfg( bleService_StatsConfig, (uint8_t *)&bleService_StatsVal, FALSE,
+                                    bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
+                                    INVALID_TASK_ID,  bleService_ReadAttrCB);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case BLESERVICE_STATS_SELECTED:
+      if ( len == BLESERVICE_STATS_LEN )
+      {
+        // Only the peer that asked reads it, subscribers are not notified.
+        memcpy(bleService_StatsVal, value, len);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case BLESERVICE_HISTORY:
+      if ( len == BLESERVICE_HISTORY_LEN )
+      {
+        memcpy(bleService_HistoryVal, value, len);
+
+        // Try to send notification.
+        ret = GATTServApp_ProcessCharCfg( bleService_HistoryConfig, (uint8_t *)&bleService_HistoryVal, FALSE,
                                     bleServiceAttrTbl, GATT_NUM_ATTRS( bleServiceAttrTbl ),
                                     INVALID_TASK_ID,  bleService_ReadAttrCB);
       }
@@ -663,6 +911,58 @@ else if ( ! memcmp(pAttr->type.uuid, bleService_PhValueUUID, pAttr->type.len) )
       memcpy(pValue, pAttr->pValue + offset, *pLen);
     }
   }
+  // See if request is regarding the Record Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_RecordUUID, pAttr->type.len) )
+  {
+    if ( offset > BLESERVICE_RECORD_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, BLESERVICE_RECORD_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the GapFill Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_GapFillUUID, pAttr->type.len) )
+  {
+    if ( offset > BLESERVICE_GAPFILL_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, BLESERVICE_GAPFILL_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the Stats Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_StatsUUID, pAttr->type.len) )
+  {
+    if ( offset > BLESERVICE_STATS_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, BLESERVICE_STATS_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the History Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_HistoryUUID, pAttr->type.len) )
+  {
+    if ( offset > BLESERVICE_HISTORY_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, BLESERVICE_HISTORY_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
   else
   {
     // If we get here, that means you've forgotten to add an if clause for a
@@ -703,6 +1003,82 @@ static bStatus_t bleService_WriteAttrCB( uint16 connHandle, gattAttribute_t *pAt
     status = GATTServApp_ProcessCCCWriteReq( connHandle, pAttr, pValue, len,
                                              offset, GATT_CLIENT_CFG_NOTIFY);
   }
+  // See if request is regarding the GapFill Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_GapFillUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != BLESERVICE_GAPFILL_LEN )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else
+    {
+      // The request is handed to the application, the value keeps
+      // showing the range held.
+      paramID = BLESERVICE_GAPFILL;
+    }
+  }
+  // See if request is regarding the SampleNow Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_SampleNowUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != BLESERVICE_SAMPLENOW_LEN )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else if ( pValue[0] != BLESERVICE_SAMPLENOW_CMD )
+    {
+      status = ATT_ERR_INVALID_VALUE;
+    }
+    else
+    {
+      paramID = BLESERVICE_SAMPLENOW;
+    }
+  }
+  // See if request is regarding the Stats Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_StatsUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != BLESERVICE_STATS_SELECT_LEN )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else if ( pValue[0] >= STATS_NUM_WINDOWS || pValue[1] >= STATS_NUM_CHANNELS )
+    {
+      status = ATT_ERR_INVALID_VALUE;
+    }
+    else
+    {
+      // The application puts the selected result in the value.
+      paramID = BLESERVICE_STATS;
+    }
+  }
+  // See if request is regarding the History Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, bleService_HistoryUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != HISTORY_QUERY_LEN )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else
+    {
+      // The query is handed to the application, the answer is notified.
+      paramID = BLESERVICE_HISTORY;
+    }
+  }
   else
   {
     // If we get here, that means you've forgotten to add an if clause for a
@@ -714,7 +1090,8 @@ static bStatus_t bleService_WriteAttrCB( uint16 connHandle, gattAttribute_t *pAt
   // callback it registered earlier (if it did).
   if (paramID != 0xFF)
     if ( pAppCBs && pAppCBs->pfnChangeCb )
-      pAppCBs->pfnChangeCb( paramID ); // Call app function from stack task context.
+      pAppCBs->pfnChangeCb( connHandle, BLESERVICE_SERV_UUID, paramID,
+                            pValue, len ); // Call app function from stack task context.
 
   return status;
 }
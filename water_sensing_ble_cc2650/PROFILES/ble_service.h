@@ -48,6 +48,8 @@ extern "C"
 /*********************************************************************
  * INCLUDES
  */
+#include <stdint.h>
+
 #include "bcomdef.h"
 /*********************************************************************
  * CONSTANTS
@@ -89,10 +91,153 @@ extern "C"
 #define BLESERVICE_PHVALUE_UUID 0xF11F
 #define BLESERVICE_PHVALUE_LEN  6
 
+//  Characteristic defines
+//  sample_rec_t of every sample, also of the records resent by a gap fill
+#define BLESERVICE_RECORD      6
+#define BLESERVICE_RECORD_UUID 0xA1A1
+#define BLESERVICE_RECORD_LEN  SAMPLE_REC_LEN
+
+//  Characteristic defines
+//  Read: sample_range_t still held. Write: first and last sequence number
+//  (uint32 each, inclusive) of the records to notify again.
+#define BLESERVICE_GAPFILL      7
+#define BLESERVICE_GAPFILL_UUID 0xB1B1
+#define BLESERVICE_GAPFILL_LEN  8
+
+//  Characteristic defines
+//  Write BLESERVICE_SAMPLENOW_CMD to take a sample right away, the reading
+//  is notified as soon as it is ready.
+#define BLESERVICE_SAMPLENOW      8
+#define BLESERVICE_SAMPLENOW_UUID 0xC1C1
+#define BLESERVICE_SAMPLENOW_LEN  1
+
+#define BLESERVICE_SAMPLENOW_CMD  0x01
+
+//  Characteristic defines
+//  stats_rec_t of every channel when a statistics window ends. Write the
+//  window and channel (uint8 each) to read the last result of another one.
+#define BLESERVICE_STATS      9
+#define BLESERVICE_STATS_UUID 0xE1E1
+#define BLESERVICE_STATS_LEN  STATS_REC_LEN
+
+#define BLESERVICE_STATS_SELECT_LEN  2
+
+//  SetParameter only: the result selected by a write, read back but not
+//  notified.
+#define BLESERVICE_STATS_SELECTED  0x80
+
+//  Characteristic defines
+//  history_rec_t answering a history query. Write a history_query_t to ask
+//  for the rollups of a time range.
+#define BLESERVICE_HISTORY      10
+#define BLESERVICE_HISTORY_UUID 0xF1F1
+#define BLESERVICE_HISTORY_LEN  HISTORY_REC_LEN
+
+// Windows, stats_rec_t window. Their lengths are set in stats.h.
+#define STATS_WINDOW_SHORT         0
+#define STATS_WINDOW_MEDIUM        1
+#define STATS_WINDOW_LONG          2
+#define STATS_NUM_WINDOWS          3
+
+// Channels, stats_rec_t and history_rec_t channel. The numeric fields of
+// sample_rec_t.
+#define STATS_CH_TEMPERATURE       0
+#define STATS_CH_PRESSURE          1
+#define STATS_CH_FLOW              2
+#define STATS_CH_CONDUCTIVITY      3
+#define STATS_CH_TURBIDITY         4
+#define STATS_NUM_CHANNELS         5
+
+// Resolutions, history_rec_t resolution. Their periods are set in
+// rollup.h.
+#define ROLLUP_RES_FINE            0
+#define ROLLUP_RES_MEDIUM          1
+#define ROLLUP_RES_COARSE          2
+#define ROLLUP_NUM_RES             3
+
+// history_rec_t channel of the record that starts the answer to a query.
+#define ROLLUP_CH_QUERY            0xFF
+// Instead of ROLLUP_CH_QUERY when the flash is busy. Nothing follows, ask
+// again.
+#define ROLLUP_CH_BUSY             0xFE
+
 /*********************************************************************
  * TYPEDEFS
  */
 
+// Records exchanged over the air, little endian and packed. The
+// application modules that produce them include this header, see
+// samplelog.h, stats.h and rollup.h for what the fields mean.
+#pragma pack(push, 1)
+
+// One sample. Fits the 20 byte notification payload of the default ATT MTU.
+typedef struct
+{
+  uint32_t seq;           // Sequence number, assigned by SampleLog_append
+  int16_t  temperature;   // 0.01 degC
+  uint16_t pressure;      // Raw ADC value
+  uint16_t flow;          // Raw ADC value
+  uint16_t conductivity;  // uS/cm, temperature compensated
+  uint16_t turbidity;     // mV
+  uint8_t  ph[6];         // As read from the pH probe, ASCII, all zero
+                          // without a reading
+} sample_rec_t;
+
+// Range of sequence numbers still held for gap fill, [oldest, next).
+typedef struct
+{
+  uint32_t oldest;
+  uint32_t next;
+} sample_range_t;
+
+// Statistics of one channel over one window. min, max and mean are in the
+// units and encoding of the channel's sample_rec_t field, so temperature
+// is an int16.
+typedef struct
+{
+  uint32_t endSec;   // RTC seconds the window ended at
+  uint8_t  window;   // STATS_WINDOW_*
+  uint8_t  channel;  // STATS_CH_*
+  uint16_t count;    // Samples in the window
+  uint16_t min;
+  uint16_t max;
+  uint16_t mean;
+  uint16_t stdDev;   // Population standard deviation
+} stats_rec_t;
+
+// One channel of a rollup, in the units and encoding of stats_rec_t.
+//
+// A query is answered by a record with channel ROLLUP_CH_QUERY first,
+// which has the history seconds now in startSec, the resolution picked and
+// the number of rollups that follow in count, then by one record per
+// channel of each rollup. If the flash is busy, by a ROLLUP_CH_BUSY record
+// alone.
+typedef struct
+{
+  uint32_t startSec;    // History seconds the period started at
+  uint8_t  resolution;  // ROLLUP_RES_*
+  uint8_t  channel;     // STATS_CH_*
+  uint32_t count;       // Samples in the period
+  uint16_t min;
+  uint16_t max;
+  uint16_t mean;
+} history_rec_t;
+
+// History query, written to the History characteristic.
+typedef struct
+{
+  uint32_t fromSec;     // History seconds, inclusive
+  uint32_t toSec;       // History seconds, exclusive
+  uint16_t maxRecords;  // Most rollups wanted
+} history_query_t;
+#pragma pack(pop)
+
+#define SAMPLE_REC_LEN             (sizeof(sample_rec_t))
+#define SAMPLE_RANGE_LEN           (sizeof(sample_range_t))
+#define STATS_REC_LEN              (sizeof(stats_rec_t))
+#define HISTORY_REC_LEN            (sizeof(history_rec_t))
+#define HISTORY_QUERY_LEN          (sizeof(history_query_t))
+
 /*********************************************************************
  * MACROS
  */
@@ -101,8 +246,9 @@ extern "C"
  * Profile Callbacks
  */
 
-// Callback when a characteristic value has changed
-typedef void (*bleServiceChange_t)( uint8 paramID );
+// Callback when a characteristic value has been written
+typedef void (*bleServiceChange_t)( uint16 connHandle, uint16 svcUuid,
+                                    uint8 paramID, uint8 *pValue, uint16 len );
 
 typedef struct
 {
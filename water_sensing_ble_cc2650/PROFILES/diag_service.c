@@ -0,0 +1,599 @@
+/**********************************************************************************************
+ * Filename:       diag_service.c
+ *
+ * Description:    This file contains the implementation of the diagnostics
+ *                 service.
+ *
+ *                 Diagnostic blocks are larger than the default ATT MTU, so
+ *                 values are served with Read Blob offsets. The trace
+ *                 characteristic is writable to control the trace ring,
+ *                 the throughput characteristic to run the throughput
+ *                 test, whose notifications are sent directly rather than
+ *                 from the characteristic value.
+ *
+ *                 The latency histogram, counters and trace need an
+ *                 authenticated link. The trace records pairing and
+ *                 connection events, and the blocks tell about the
+ *                 device's load.
+ *
+ *************************************************************************************************/
+
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <diag_service.h>
+#include <string.h>
+
+#include "bcomdef.h"
+#include "OSAL.h"
+#include "linkdb.h"
+#include "att.h"
+#include "gatt.h"
+#include "gatt_uuid.h"
+#include "gattservapp.h"
+#include "gapbondmgr.h"
+
+
+/*********************************************************************
+* GLOBAL VARIABLES
+*/
+
+// diagService Service UUID
+CONST uint8_t diagServiceUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_SERV_UUID)
+};
+
+// latencyHist UUID
+CONST uint8_t diagService_LatencyHistUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_LATENCYHIST_UUID)
+};
+// counters UUID
+CONST uint8_t diagService_CountersUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_COUNTERS_UUID)
+};
+// trace UUID
+CONST uint8_t diagService_TraceUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_TRACE_UUID)
+};
+// alarm UUID
+CONST uint8_t diagService_AlarmUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_ALARM_UUID)
+};
+// tput UUID
+CONST uint8_t diagService_TputUUID[ATT_UUID_SIZE] =
+{
+  TI_BASE_UUID_128(DIAGSERVICE_TPUT_UUID)
+};
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static diagServiceCBs_t *pAppCBs = NULL;
+
+/*********************************************************************
+* Profile Attributes - variables
+*/
+
+// Service declaration
+static CONST gattAttrType_t diagServiceDecl = { ATT_UUID_SIZE, diagServiceUUID };
+
+// Characteristic "LatencyHist" Properties (for declaration)
+static uint8_t diagService_LatencyHistProps = GATT_PROP_READ;
+
+// Characteristic "LatencyHist" Value variable
+static uint8_t diagService_LatencyHistVal[DIAGSERVICE_LATENCYHIST_LEN] = {0};
+
+// Characteristic "Counters" Properties (for declaration)
+static uint8_t diagService_CountersProps = GATT_PROP_READ;
+
+// Characteristic "Counters" Value variable
+static uint8_t diagService_CountersVal[DIAGSERVICE_COUNTERS_LEN] = {0};
+
+// Characteristic "Trace" Properties (for declaration)
+static uint8_t diagService_TraceProps = GATT_PROP_READ | GATT_PROP_WRITE;
+
+// Characteristic "Trace" Value, points at the trace buffer once registered
+static const uint8_t *diagService_TraceVal = NULL;
+
+// Characteristic "Alarm" Properties (for declaration)
+static uint8_t diagService_AlarmProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+// Characteristic "Alarm" Value variable
+static uint8_t diagService_AlarmVal[DIAGSERVICE_ALARM_LEN] = {0};
+
+// Characteristic "Alarm" CCCD
+static gattCharCfg_t *diagService_AlarmConfig;
+
+// Characteristic "Tput" Properties (for declaration)
+static uint8_t diagService_TputProps = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_NOTIFY;
+
+// Characteristic "Tput" Value variable, the report of the last run
+static uint8_t diagService_TputVal[DIAGSERVICE_TPUT_LEN] = {0};
+
+// Characteristic "Tput" CCCD
+static gattCharCfg_t *diagService_TputConfig;
+
+/*********************************************************************
+* Profile Attributes - Table
+*/
+
+static gattAttribute_t diagServiceAttrTbl[] =
+{
+  // diagService Service Declaration
+  {
+    { ATT_BT_UUID_SIZE, primaryServiceUUID },
+    GATT_PERMIT_READ,
+    0,
+    (uint8_t *)&diagServiceDecl
+  },
+    // LatencyHist Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diagService_LatencyHistProps
+    },
+      // LatencyHist Characteristic Value
+      {
+        { ATT_UUID_SIZE, diagService_LatencyHistUUID },
+        GATT_PERMIT_AUTHEN_READ,
+        0,
+        diagService_LatencyHistVal
+      },
+    // Counters Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diagService_CountersProps
+    },
+      // Counters Characteristic Value
+      {
+        { ATT_UUID_SIZE, diagService_CountersUUID },
+        GATT_PERMIT_AUTHEN_READ,
+        0,
+        diagService_CountersVal
+      },
+    // Trace Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diagService_TraceProps
+    },
+      // Trace Characteristic Value
+      {
+        { ATT_UUID_SIZE, diagService_TraceUUID },
+        GATT_PERMIT_AUTHEN_READ | GATT_PERMIT_AUTHEN_WRITE,
+        0,
+        NULL
+      },
+    // Alarm Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diagService_AlarmProps
+    },
+      // Alarm Characteristic Value
+      {
+        { ATT_UUID_SIZE, diagService_AlarmUUID },
+        GATT_PERMIT_READ,
+        0,
+        diagService_AlarmVal
+      },
+      // Alarm CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8 *)&diagService_AlarmConfig
+      },
+    // Tput Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diagService_TputProps
+    },
+      // Tput Characteristic Value
+      {
+        { ATT_UUID_SIZE, diagService_TputUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        diagService_TputVal
+      },
+      // Tput CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8 *)&diagService_TputConfig
+      },
+};
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static bStatus_t diagService_ReadAttrCB( uint16 connHandle, gattAttribute_t *pAttr,
+                                         uint8 *pValue, uint16 *pLen, uint16 offset,
+                                         uint16 maxLen, uint8 method );
+static bStatus_t diagService_WriteAttrCB( uint16 connHandle, gattAttribute_t *pAttr,
+                                          uint8 *pValue, uint16 len, uint16 offset,
+                                          uint8 method );
+
+/*********************************************************************
+ * PROFILE CALLBACKS
+ */
+// Diagnostics Service Callbacks
+CONST gattServiceCBs_t diagServiceCBs =
+{
+  diagService_ReadAttrCB,  // Read callback function pointer
+  diagService_WriteAttrCB, // Write callback function pointer
+  NULL                     // Authorization callback function pointer
+};
+
+/*********************************************************************
+* PUBLIC FUNCTIONS
+*/
+
+/*
+ * DiagService_AddService- Initializes the DiagService service by registering
+ *          GATT attributes with the GATT server.
+ *
+ */
+bStatus_t DiagService_AddService( void )
+{
+  // Allocate Client Characteristic Configuration table
+  diagService_AlarmConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( diagService_AlarmConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, diagService_AlarmConfig );
+
+  // Allocate Client Characteristic Configuration table
+  diagService_TputConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( diagService_TputConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, diagService_TputConfig );
+
+  // Register GATT attribute list and CBs with GATT Server App
+  return GATTServApp_RegisterService( diagServiceAttrTbl,
+                                      GATT_NUM_ATTRS( diagServiceAttrTbl ),
+                                      GATT_MAX_ENCRYPT_KEY_SIZE,
+                                      &diagServiceCBs );
+}
+
+/*
+ * DiagService_RegisterAppCBs - Registers the application callback function.
+ *                    Only call this function once.
+ *
+ *    appCallbacks - pointer to application callbacks.
+ */
+bStatus_t DiagService_RegisterAppCBs( diagServiceCBs_t *appCallbacks )
+{
+  if ( appCallbacks )
+  {
+    pAppCBs = appCallbacks;
+
+    return ( SUCCESS );
+  }
+  else
+  {
+    return ( bleAlreadyInRequestedMode );
+  }
+}
+
+/*
+ * DiagService_SetParameter - Set a DiagService parameter.
+ *
+ *    param - Profile parameter ID
+ *    len - length of data to write
+ *    value - pointer to data to write. DIAGSERVICE_TRACE keeps the
+ *          pointer instead of copying, reads always see the live buffer.
+ */
+bStatus_t DiagService_SetParameter( uint8 param, uint16 len, const void *value )
+{
+  bStatus_t ret = SUCCESS;
+  switch ( param )
+  {
+    case DIAGSERVICE_LATENCYHIST:
+      if ( len == DIAGSERVICE_LATENCYHIST_LEN )
+      {
+        memcpy(diagService_LatencyHistVal, value, len);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case DIAGSERVICE_COUNTERS:
+      if ( len == DIAGSERVICE_COUNTERS_LEN )
+      {
+        memcpy(diagService_CountersVal, value, len);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case DIAGSERVICE_TRACE:
+      if ( len == DIAGSERVICE_TRACE_LEN )
+      {
+        diagService_TraceVal = value;
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case DIAGSERVICE_ALARM:
+      if ( len == DIAGSERVICE_ALARM_LEN )
+      {
+        memcpy(diagService_AlarmVal, value, len);
+
+        // Try to send notification.
+        ret = GATTServApp_ProcessCharCfg( diagService_AlarmConfig, (uint8_t *)&diagService_AlarmVal, FALSE,
+                                          diagServiceAttrTbl, GATT_NUM_ATTRS( diagServiceAttrTbl ),
+                                          INVALID_TASK_ID,  diagService_ReadAttrCB);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    case DIAGSERVICE_TPUT:
+      if ( len == DIAGSERVICE_TPUT_LEN )
+      {
+        memcpy(diagService_TputVal, value, len);
+      }
+      else
+      {
+        ret = bleInvalidRange;
+      }
+      break;
+
+    default:
+      ret = INVALIDPARAMETER;
+      break;
+  }
+  return ret;
+}
+
+/*
+ * DiagService_NotifyThroughput - Send one throughput test notification.
+ *
+ *    connHandle - connection to send on
+ *    len - notification payload length
+ *    pfnFill - called to write the payload straight into the stack buffer
+ */
+bStatus_t DiagService_NotifyThroughput( uint16 connHandle, uint16 len,
+                                        void (*pfnFill)( uint8 *pBuf, uint16 len ) )
+{
+  attHandleValueNoti_t noti;
+  gattAttribute_t *pAttr;
+  bStatus_t status;
+
+  if ( !(GATTServApp_ReadCharCfg( connHandle, diagService_TputConfig ) & GATT_CLIENT_CFG_NOTIFY) )
+  {
+    return ( bleIncorrectMode );
+  }
+
+  noti.pValue = GATT_bm_alloc( connHandle, ATT_HANDLE_VALUE_NOTI, len, NULL );
+  if ( noti.pValue == NULL )
+  {
+    return ( bleNoResources );
+  }
+
+  pAttr = GATTServApp_FindAttr( diagServiceAttrTbl, GATT_NUM_ATTRS( diagServiceAttrTbl ),
+                                diagService_TputVal );
+  noti.handle = pAttr->handle;
+  noti.len = len;
+  pfnFill( noti.pValue, len );
+
+  status = GATT_Notification( connHandle, &noti, FALSE );
+  if ( status != SUCCESS )
+  {
+    GATT_bm_free( (gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI );
+  }
+
+  return ( status );
+}
+
+
+/*********************************************************************
+ * @fn          diagService_ReadAttrCB
+ *
+ * @brief       Read an attribute.
+ *
+ * @param       connHandle - connection message was received on
+ * @param       pAttr - pointer to attribute
+ * @param       pValue - pointer to data to be read
+ * @param       pLen - length of data to be read
+ * @param       offset - offset of the first octet to be read
+ * @param       maxLen - maximum length of data to be read
+ * @param       method - type of read message
+ *
+ * @return      SUCCESS, blePending or Failure
+ */
+static bStatus_t diagService_ReadAttrCB( uint16 connHandle, gattAttribute_t *pAttr,
+                                         uint8 *pValue, uint16 *pLen, uint16 offset,
+                                         uint16 maxLen, uint8 method )
+{
+  bStatus_t status = SUCCESS;
+
+  // See if request is regarding the LatencyHist Characteristic Value
+  if ( ! memcmp(pAttr->type.uuid, diagService_LatencyHistUUID, pAttr->type.len) )
+  {
+    if ( offset > DIAGSERVICE_LATENCYHIST_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, DIAGSERVICE_LATENCYHIST_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the Counters Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_CountersUUID, pAttr->type.len) )
+  {
+    if ( offset > DIAGSERVICE_COUNTERS_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, DIAGSERVICE_COUNTERS_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the Trace Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_TraceUUID, pAttr->type.len) )
+  {
+    if ( diagService_TraceVal == NULL )
+    {
+      *pLen = 0;
+    }
+    else if ( offset > DIAGSERVICE_TRACE_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, DIAGSERVICE_TRACE_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, diagService_TraceVal + offset, *pLen);
+    }
+  }
+  // See if request is regarding the Alarm Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_AlarmUUID, pAttr->type.len) )
+  {
+    if ( offset > DIAGSERVICE_ALARM_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, DIAGSERVICE_ALARM_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  // See if request is regarding the Tput Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_TputUUID, pAttr->type.len) )
+  {
+    if ( offset > DIAGSERVICE_TPUT_LEN )  // Prevent malicious ATT ReadBlob offsets.
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else
+    {
+      *pLen = MIN(maxLen, DIAGSERVICE_TPUT_LEN - offset);  // Transmit as much as possible
+      memcpy(pValue, pAttr->pValue + offset, *pLen);
+    }
+  }
+  else
+  {
+    // If we get here, that means you've forgotten to add an if clause for a
+    // characteristic value attribute in the attribute table that has READ permissions.
+    *pLen = 0;
+    status = ATT_ERR_ATTR_NOT_FOUND;
+  }
+
+  return status;
+}
+
+
+/*********************************************************************
+ * @fn      diagService_WriteAttrCB
+ *
+ * @brief   Validate attribute data prior to a write operation
+ *
+ * @param   connHandle - connection message was received on
+ * @param   pAttr - pointer to attribute
+ * @param   pValue - pointer to data to be written
+ * @param   len - length of data
+ * @param   offset - offset of the first octet to be written
+ * @param   method - type of write message
+ *
+ * @return  SUCCESS, blePending or Failure
+ */
+static bStatus_t diagService_WriteAttrCB( uint16 connHandle, gattAttribute_t *pAttr,
+                                          uint8 *pValue, uint16 len, uint16 offset,
+                                          uint8 method )
+{
+  bStatus_t status  = SUCCESS;
+  uint8_t   paramID = 0xFF;
+
+  // See if request is regarding a Client Characterisic Configuration
+  if ( ! memcmp(pAttr->type.uuid, clientCharCfgUUID, pAttr->type.len) )
+  {
+    // Allow only notifications.
+    status = GATTServApp_ProcessCCCWriteReq( connHandle, pAttr, pValue, len,
+                                             offset, GATT_CLIENT_CFG_NOTIFY);
+  }
+  // See if request is regarding the Trace Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_TraceUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != 1 )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else
+    {
+      paramID = DIAGSERVICE_TRACE;
+    }
+  }
+  // See if request is regarding the Tput Characteristic Value
+  else if ( ! memcmp(pAttr->type.uuid, diagService_TputUUID, pAttr->type.len) )
+  {
+    if ( offset != 0 )
+    {
+      status = ATT_ERR_INVALID_OFFSET;
+    }
+    else if ( len != 1 )
+    {
+      status = ATT_ERR_INVALID_VALUE_SIZE;
+    }
+    else
+    {
+      paramID = DIAGSERVICE_TPUT;
+    }
+  }
+  else
+  {
+    // If we get here, that means you've forgotten to add an if clause for a
+    // characteristic value attribute in the attribute table that has WRITE permissions.
+    status = ATT_ERR_ATTR_NOT_FOUND;
+  }
+
+  // Let the application know something changed (if it did) by using the
+  // callback it registered earlier (if it did).
+  if (paramID != 0xFF)
+    if ( pAppCBs && pAppCBs->pfnChangeCb )
+      pAppCBs->pfnChangeCb( connHandle, DIAGSERVICE_SERV_UUID, paramID,
+                            pValue, len ); // Call app function from stack task context.
+
+  return status;
+}
@@ -0,0 +1,123 @@
+/**********************************************************************************************
+ * Filename:       diag_service.h
+ *
+ * Description:    This file contains the diagService service definitions and
+ *                 prototypes. The service exposes diagnostic blocks
+ *                 gathered by the application.
+ *
+ *************************************************************************************************/
+
+
+#ifndef _DIAGSERVICE_H_
+#define _DIAGSERVICE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "bcomdef.h"
+
+/*********************************************************************
+* CONSTANTS
+*/
+// Service UUID
+#define DIAGSERVICE_SERV_UUID 0x22AA
+
+//  Characteristic defines
+#define DIAGSERVICE_LATENCYHIST      0
+#define DIAGSERVICE_LATENCYHIST_UUID 0xA22A
+//  latency_hist_t of each latency_stage_t, see latency.h
+#define DIAGSERVICE_LATENCYHIST_LEN  108
+
+//  Characteristic defines
+#define DIAGSERVICE_COUNTERS      1
+#define DIAGSERVICE_COUNTERS_UUID 0xB22B
+//  diag_block_t, see diag.h
+#define DIAGSERVICE_COUNTERS_LEN  84
+
+//  Characteristic defines
+#define DIAGSERVICE_TRACE      2
+#define DIAGSERVICE_TRACE_UUID 0xC22C
+//  trace_buf_t, see trace.h
+#define DIAGSERVICE_TRACE_LEN  392
+
+//  Characteristic defines
+#define DIAGSERVICE_ALARM      3
+#define DIAGSERVICE_ALARM_UUID 0xD22D
+#define DIAGSERVICE_ALARM_LEN  1
+
+//  Characteristic defines
+//  Write 1 to start the throughput test, 0 to stop it. Notifies the test
+//  data while running, reads back the tput_report_t of the last run.
+#define DIAGSERVICE_TPUT      4
+#define DIAGSERVICE_TPUT_UUID 0xE22E
+#define DIAGSERVICE_TPUT_LEN  30
+
+/*********************************************************************
+ * Profile Callbacks
+ */
+
+// Callback when a characteristic value has been written
+typedef void (*diagServiceChange_t)( uint16 connHandle, uint16 svcUuid,
+                                     uint8 paramID, uint8 *pValue, uint16 len );
+
+typedef struct
+{
+  diagServiceChange_t        pfnChangeCb;  // Called when characteristic value changes
+} diagServiceCBs_t;
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*
+ * DiagService_AddService- Initializes the DiagService service by registering
+ *          GATT attributes with the GATT server.
+ *
+ */
+extern bStatus_t DiagService_AddService( void );
+
+/*
+ * DiagService_RegisterAppCBs - Registers the application callback function.
+ *                    Only call this function once.
+ *
+ *    appCallbacks - pointer to application callbacks.
+ */
+extern bStatus_t DiagService_RegisterAppCBs( diagServiceCBs_t *appCallbacks );
+
+/*
+ * DiagService_SetParameter - Set a DiagService parameter.
+ *
+ *    param - Profile parameter ID
+ *    len - length of data to write
+ *    value - pointer to data to write. DIAGSERVICE_TRACE keeps the
+ *          pointer instead of copying, reads always see the live buffer.
+ */
+extern bStatus_t DiagService_SetParameter( uint8 param, uint16 len, const void *value );
+
+/*
+ * DiagService_NotifyThroughput - Send one throughput test notification.
+ *
+ *    connHandle - connection to send on
+ *    len - notification payload length
+ *    pfnFill - called to write the payload straight into the stack buffer
+ *
+ *    Returns bleIncorrectMode if the peer has not enabled notifications,
+ *    bleNoResources if no buffer could be allocated, else the status of
+ *    GATT_Notification.
+ */
+extern bStatus_t DiagService_NotifyThroughput( uint16 connHandle, uint16 len,
+                                               void (*pfnFill)( uint8 *pBuf, uint16 len ) );
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DIAGSERVICE_H_ */
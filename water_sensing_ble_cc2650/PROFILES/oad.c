@@ -55,6 +55,7 @@
 #include "gatt_uuid.h"
 #include "gattservapp.h"
 #include "hal_flash.h"
+#include "osal_snv.h"
 #if (defined HAL_LCD) && (HAL_LCD == TRUE)
 #include "hal_lcd.h"
 #endif
@@ -63,6 +64,7 @@
 
 #include "oad_target.h"
 #include "oad_constants.h"
+#include "oad_codec.h"
 #include "oad.h"
 
 /*********************************************************************
@@ -75,10 +77,30 @@
 #define OAD_FLASH_ERR   2
 #define OAD_BUFFER_OFL  3
 
+// Opcode and handle of an ATT Write Command.
+#define OAD_ATT_WRITE_HDR_SIZE  3
+
+// SNV item holding the download progress checkpoint.
+#define OAD_NVID_RESUME         BLE_NVID_CUST_START
+
 /*********************************************************************
  * MACROS
  */
 
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Download progress, saved to SNV every flash page so that an interrupted
+// download of the same image can carry on where it stopped.
+typedef struct
+{
+  uint16_t crc;               // Image CRC from the identify, 0xFFFF if none
+  uint8_t  hdr[sizeof(img_hdr_t)]; // Image header from the identify
+  uint16_t runCrc;            // CRC over the image up to len
+  uint32_t len;               // Image bytes safely in flash
+} oadResume_t;
+
 /*********************************************************************
  * GLOBAL VARIABLES
  */
@@ -286,6 +308,72 @@ static uint8_t flagRecord = 0;
 
 static uint8_t oad_imageIdLen = 0;
 
+// Windowed transfer state. oadWindow is 0 for the lock-step transfer, else
+// the number of blocks the OAD manager may have outstanding. Bit n of
+// oadWinMap is set when block oadBlkNum + n has been written.
+static uint8_t oadWindow = 0;
+static uint32_t oadWinMap = 0;
+static uint16_t oadAckBlkNum = 0;
+
+// Negotiated block size and features, image and payload length in bytes.
+// The two lengths only differ for an encoded payload.
+static uint16_t oadBlkSize = OAD_BLOCK_SIZE;
+static uint8_t oadFeatures = 0;
+static uint32_t oadImgLen = 0;
+static uint32_t oadXferLen = 0;
+
+// Payload encoding.
+static uint8_t oadCodec = OAD_CODEC_NONE;
+
+#ifndef FEATURE_OAD_ONCHIP
+// CRC over the blocks received in order so far, and the next block to fold.
+static uint16_t oadCrc = 0;
+static uint16_t oadCrcBlkNum = 0;
+
+// Progress checkpoint of the current download.
+static oadResume_t oadResume;
+
+// Image bytes decoded so far.
+static uint32_t oadOutLen = 0;
+
+// CRC-CCITT lookup table, poly 0x1021.
+static const uint16_t crc16Table[256] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+#endif //FEATURE_OAD_ONCHIP
+
 /*********************************************************************
  * LOCAL FUNCTIONS
  */
@@ -299,14 +387,24 @@ static bStatus_t oadWriteAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
                                 uint8_t method);
 
 static void OAD_getNextBlockReq(uint16_t connHandle, uint16_t blkNum);
+static void OAD_windowBlockWrite(uint16_t connHandle, uint16_t blkNum,
+                                 uint8_t *pData);
+static void OAD_writeBlock(uint16_t blkNum, uint8_t *pData);
+static uint16_t OAD_blockLen(uint16_t blkNum);
+static uint16_t OAD_negotiateBlockSize(uint16_t connHandle);
 static void OAD_rejectImage(uint16_t connHandle, img_hdr_t *pImgHdr);
 static void OAD_sendStatus(uint16_t connHandle, uint8_t status);
 
 #if !defined FEATURE_OAD_ONCHIP
 static uint8_t CheckImageDownloadCount(void);
 static uint8_t checkDL(void);
-static uint16_t crcCalcDL(void);
-static uint16_t crc16(uint16_t crc, uint8_t val);
+static void OAD_crcUpdate(uint16_t blkNum, uint8_t *pData);
+static uint16_t crcCalcFlash(uint16_t crc, uint32_t offset, uint32_t len);
+static uint16_t crc16(uint16_t crc, const uint8_t *pBuf, uint16_t len);
+static uint32_t OAD_resumeStart(uint8_t *pValue, uint8_t hdrOffset);
+static void OAD_resumeSave(uint32_t len);
+static void OAD_resumeClear(void);
+static void OAD_codecOut(uint8_t *pBuf, uint16_t len);
 #endif  // !FEATURE_OAD_ONCHIP
 
 /*********************************************************************
@@ -490,7 +588,7 @@ static bStatus_t oadWriteAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
       if (oadTargetWriteCB != NULL)
       {
         oad_imageIdLen = len;
-        (*oadTargetWriteCB)(OAD_WRITE_IDENTIFY_REQ, connHandle, pValue);
+        (*oadTargetWriteCB)(OAD_WRITE_IDENTIFY_REQ, connHandle, pValue, len);
       }
     }
     else if (!memcmp(pAttr->type.uuid, oadCharUUID[OAD_IDX_IMG_BLOCK],
@@ -499,11 +597,20 @@ static bStatus_t oadWriteAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
       /* OAD is ongoing.
        * the OAD manager has sent a block from the new image.
        */
+      uint16_t blkNum = (len >= 2) ? BUILD_UINT16(pValue[0], pValue[1]) : 0;
 
+      // A block of the image must carry exactly its bytes, they are all
+      // written and folded into the CRC. Other block numbers are only
+      // answered with a block request, their data is not read.
+      if (len < 2 ||
+          (blkNum < oadBlkTot && len != 2 + OAD_blockLen(blkNum)))
+      {
+        status = ATT_ERR_INVALID_VALUE_SIZE;
+      }
       // Notify the application.
-      if (oadTargetWriteCB != NULL)
+      else if (oadTargetWriteCB != NULL)
       {
-        (*oadTargetWriteCB)(OAD_WRITE_BLOCK_REQ, connHandle, pValue);
+        (*oadTargetWriteCB)(OAD_WRITE_BLOCK_REQ, connHandle, pValue, len);
       }
     }
     else if (!memcmp(pAttr->type.uuid, oadCharUUID[OAD_IDX_IMG_COUNT],
@@ -556,14 +663,84 @@ void OAD_imgIdentifyWrite(uint16_t connHandle, uint8_t *pValue)
   // Read out running image's header.
   OADTarget_getCurrentImageHeader(&ImgHdr);
 
-  // Calculate block total of the new image.
-  oadBlkTot = BUILD_UINT16(pValue[hdrOffset + 2], pValue[hdrOffset + 3]) /
-              (OAD_BLOCK_SIZE / HAL_FLASH_WORD_SIZE);
   oadBlkNum = 0;
 #ifndef FEATURE_OAD_ONCHIP
     flagRecord = 0;
+    oadCrc = 0;
+    oadCrcBlkNum = 0;
+    oadOutLen = 0;
+#endif
+
+  // An extended identify may ask for a windowed transfer and for blocks
+  // as large as the connection's MTU allows.
+  // Calculate length of the new image, given in flash words.
+  oadImgLen = (uint32_t)BUILD_UINT16(pValue[hdrOffset + 2],
+                                     pValue[hdrOffset + 3]) * HAL_FLASH_WORD_SIZE;
+  oadXferLen = oadImgLen;
+
+  oadWindow = 0;
+  oadWinMap = 0;
+  oadBlkSize = OAD_BLOCK_SIZE;
+  oadFeatures = 0;
+  oadCodec = OAD_CODEC_NONE;
+  if (oad_imageIdLen >= OAD_IMG_ID_EXT_SIZE)
+  {
+    uint8_t features = pValue[OAD_IMG_ID_FEATURES];
+
+    if (features & OAD_FEATURE_LARGE_BLOCK)
+    {
+      oadBlkSize = OAD_negotiateBlockSize(connHandle);
+      oadFeatures |= OAD_FEATURE_LARGE_BLOCK;
+    }
+
+    // The block size is only reported in the windowed acknowledge, so a
+    // large block transfer is windowed too, if only with a single block.
+    if (features & OAD_FEATURE_WINDOW)
+    {
+      oadWindow = pValue[OAD_IMG_ID_WINDOW];
+      oadFeatures |= OAD_FEATURE_WINDOW;
+    }
+
+#ifndef FEATURE_OAD_ONCHIP
+    // A compressed or delta payload is decoded into the image as it
+    // arrives. The two do not combine, compression wins.
+    if (features & OAD_FEATURE_COMPRESSED)
+    {
+      oadCodec = OAD_CODEC_LZSS;
+      oadFeatures |= OAD_FEATURE_COMPRESSED;
+    }
+    else if (features & OAD_FEATURE_DELTA)
+    {
+      oadCodec = OAD_CODEC_DELTA;
+      oadFeatures |= OAD_FEATURE_DELTA;
+    }
+
+    if (oadCodec != OAD_CODEC_NONE)
+    {
+      oadXferLen = (uint32_t)BUILD_UINT16(pValue[OAD_IMG_ID_PAYLOAD_LEN],
+                                          pValue[OAD_IMG_ID_PAYLOAD_LEN + 1])
+                   * HAL_FLASH_WORD_SIZE;
+      OADCodec_init(oadCodec, OAD_codecOut, OADTarget_readCurrentImage);
+    }
 #endif
 
+    if (features & (OAD_FEATURE_WINDOW | OAD_FEATURE_LARGE_BLOCK |
+                    OAD_FEATURE_COMPRESSED | OAD_FEATURE_DELTA))
+    {
+      if (oadWindow > OAD_WINDOW_MAX)
+      {
+        oadWindow = OAD_WINDOW_MAX;
+      }
+      else if (oadWindow == 0)
+      {
+        oadWindow = 1;
+      }
+    }
+  }
+
+  // Calculate block total of the transfer; the last block may be short.
+  oadBlkTot = (oadXferLen + oadBlkSize - 1) / oadBlkSize;
+
   /* Requirements to begin OAD:
    * 1) LSB of image version cannot be the same, this would imply a code overlap
    *    between currently running image and new image.
@@ -572,7 +749,8 @@ void OAD_imgIdentifyWrite(uint16_t connHandle, uint8_t *pValue)
    * 3) Block total must be greater than 0.
    * 4) Optional: Add additional criteria for initiating OAD here.
    */
-  if (OADTarget_validateNewImage(pValue + hdrOffset, &ImgHdr, oadBlkTot))
+  if (OADTarget_validateNewImage(pValue + hdrOffset, &ImgHdr, oadBlkTot,
+                                 oadBlkSize))
   {
     // Determine where image will be stored.
     imageAddress = OADTarget_imageAddress(pValue+hdrOffset);
@@ -581,20 +759,25 @@ void OAD_imgIdentifyWrite(uint16_t connHandle, uint8_t *pValue)
     // Open the target interface
     if (OADTarget_open())
     {
-        uint8_t page;
-        uint8_t lastPage = oadBlkTot / OAD_BLOCKS_PER_PAGE;
+        uint8_t page = imagePage;
+        uint8_t lastPage = oadImgLen / HAL_FLASH_PAGE_SIZE;
 
         // Set last page to end of OAD image address range.
         lastPage += imagePage;
 
+#ifndef FEATURE_OAD_ONCHIP
+        // Keep the pages an interrupted download of this image completed.
+        page += OAD_resumeStart(pValue, hdrOffset) / HAL_FLASH_PAGE_SIZE;
+#endif
+
         // Erase required pages
-        for (page = imagePage; page <= lastPage; page++)
+        for (; page <= lastPage; page++)
         {
             OADTarget_eraseFlash(page);
         }
 
-        // Image accepted, request block 0.
-        OAD_getNextBlockReq(connHandle, 0);
+        // Image accepted, request the first block missing.
+        OAD_getNextBlockReq(connHandle, oadBlkNum);
     }
     else
     {
@@ -625,20 +808,30 @@ void OAD_imgBlockWrite(uint16_t connHandle, uint8_t *pValue)
   // N.B. This must be left volatile.
   volatile uint16_t blkNum = BUILD_UINT16(pValue[0], pValue[1]);
 
+  if (oadWindow != 0)
+  {
+    // Windowed transfer, blocks may arrive in any order.
+    OAD_windowBlockWrite(connHandle, blkNum, pValue+2);
+  }
   // Check that this is the expected block number.
-  if (oadBlkNum == blkNum)
+  else if (oadBlkNum == blkNum)
   {
-    // Write a 16 byte block to Flash.
-    OADTarget_writeFlash(imagePage, (blkNum * OAD_BLOCK_SIZE), pValue+2,
-                         OAD_BLOCK_SIZE);
+    // Write a block to Flash.
+    OAD_writeBlock(blkNum, pValue+2);
 
     // Increment received block count.
     oadBlkNum++;
+
+#ifndef FEATURE_OAD_ONCHIP
+    // Fold the block into the image CRC.
+    OAD_crcUpdate(blkNum, pValue+2);
+#endif
   }
   else
   {
     // Overflow, abort OAD
     oadBlkNum = 0;
+    oadWindow = 0;
 #ifndef FEATURE_OAD_ONCHIP
     flagRecord = 0;
 #endif
@@ -654,10 +847,16 @@ void OAD_imgBlockWrite(uint16_t connHandle, uint8_t *pValue)
   // Check if the OAD Image is complete.
   if (oadBlkNum == oadBlkTot)
   {
+    // Write out the tail of the image still buffered.
+    OADTarget_flushFlash();
+
 #if FEATURE_OAD_ONCHIP
     // Handle CRC verification in BIM.
     OADTarget_systemReset();
 #else // !FEATURE_OAD_ONCHIP
+    // The download is over either way, nothing left to resume.
+    OAD_resumeClear();
+
     // Run CRC check on new image.
     if (checkDL())
     {
@@ -679,7 +878,7 @@ void OAD_imgBlockWrite(uint16_t connHandle, uint8_t *pValue)
         // interrupt. It is ok to take any action here.
         if (flagRecord & OAD_IMG_NP_FLAG)
         {
-          (*oadTargetWriteCB)(OAD_IMAGE_COMPLETE, connHandle, NULL);
+          (*oadTargetWriteCB)(OAD_IMAGE_COMPLETE, connHandle, NULL, 0);
         }
 
         // If one image is an application or stack image, perform the reset
@@ -702,18 +901,159 @@ void OAD_imgBlockWrite(uint16_t connHandle, uint8_t *pValue)
 
     OADTarget_close();
     oadBlkNum = 0;
+    oadWindow = 0;
   }
-  else
+  else if (oadWindow == 0)
   {
     // Request the next OAD Image block.
     OAD_getNextBlockReq(connHandle, oadBlkNum);
   }
 }
 
+/*********************************************************************
+ * @fn      OAD_windowBlockWrite
+ *
+ * @brief   Process a block of a windowed transfer.
+ *
+ *          The OAD manager may write any block in [oadBlkNum, oadBlkNum +
+ *          oadWindow) without waiting for a request. Received blocks are
+ *          acknowledged cumulatively, every half window, when the top of
+ *          the window or the last block arrives, and whenever a block
+ *          falls outside the window. A write of block OAD_BLK_ACK_REQ only
+ *          asks for an acknowledge, for when the manager lost track.
+ *
+ * @param   connHandle - connection message was received on
+ * @param   blkNum     - block number
+ * @param   pData      - block data
+ *
+ * @return  None
+ */
+static void OAD_windowBlockWrite(uint16_t connHandle, uint16_t blkNum,
+                                 uint8_t *pData)
+{
+  uint16_t offset = blkNum - oadBlkNum;
+  uint32_t bit;
+
+  // An encoded payload can only be decoded in order.
+  if (blkNum == OAD_BLK_ACK_REQ || blkNum < oadBlkNum ||
+      blkNum >= oadBlkTot || offset >= oadWindow ||
+      (offset != 0 && oadCodec != OAD_CODEC_NONE))
+  {
+    // Resent or out of range block, tell the manager where we are.
+    OAD_getNextBlockReq(connHandle, oadBlkNum);
+    return;
+  }
+
+  bit = (uint32_t)1 << offset;
+
+  if (!(oadWinMap & bit))
+  {
+    OAD_writeBlock(blkNum, pData);
+    oadWinMap |= bit;
+  }
+
+  // Slide the window over the blocks now received in order.
+  while (oadWinMap & 1)
+  {
+    oadWinMap >>= 1;
+    oadBlkNum++;
+  }
+
+#ifndef FEATURE_OAD_ONCHIP
+  // Fold the blocks now in order into the image CRC.
+  OAD_crcUpdate(blkNum, pData);
+#endif
+
+  // Completion is reported with the status instead.
+  if (oadBlkNum == oadBlkTot)
+  {
+    return;
+  }
+
+  if ((uint16_t)(oadBlkNum - oadAckBlkNum) >= (oadWindow + 1) / 2 ||
+      offset == oadWindow - 1 || blkNum == oadBlkTot - 1)
+  {
+    OAD_getNextBlockReq(connHandle, oadBlkNum);
+  }
+}
+
+/*********************************************************************
+ * @fn      OAD_writeBlock
+ *
+ * @brief   Write a received block to flash.
+ *
+ * @param   blkNum - block number
+ * @param   pData  - block data
+ *
+ * @return  None
+ */
+static void OAD_writeBlock(uint16_t blkNum, uint8_t *pData)
+{
+#ifndef FEATURE_OAD_ONCHIP
+  if (oadCodec != OAD_CODEC_NONE)
+  {
+    OADCodec_decode(pData, OAD_blockLen(blkNum));
+    return;
+  }
+#endif
+
+  OADTarget_writeFlash(imagePage, (uint32_t)blkNum * oadBlkSize, pData,
+                       OAD_blockLen(blkNum));
+}
+
+/*********************************************************************
+ * @fn      OAD_blockLen
+ *
+ * @brief   Get the number of image bytes in a block.
+ *
+ * @param   blkNum - block number
+ *
+ * @return  Block size, less for the last block of the image.
+ */
+static uint16_t OAD_blockLen(uint16_t blkNum)
+{
+  uint32_t offset = (uint32_t)blkNum * oadBlkSize;
+
+  // The last block only carries what is left of the transfer.
+  if (offset + oadBlkSize > oadXferLen)
+  {
+    return oadXferLen - offset;
+  }
+
+  return oadBlkSize;
+}
+
+/*********************************************************************
+ * @fn      OAD_negotiateBlockSize
+ *
+ * @brief   Pick the largest block that fits in one write command on this
+ *          connection. Block sizes are powers of two so that blocks never
+ *          straddle a flash page.
+ *
+ * @param   connHandle - connection the image is downloaded on
+ *
+ * @return  Block size in bytes, OAD_BLOCK_SIZE to OAD_BLOCK_SIZE_MAX.
+ */
+static uint16_t OAD_negotiateBlockSize(uint16_t connHandle)
+{
+  // Room left in a write command after the 2 byte block number.
+  uint16_t room = ATT_GetMTU(connHandle) - OAD_ATT_WRITE_HDR_SIZE - 2;
+  uint16_t blkSize = OAD_BLOCK_SIZE_MAX;
+
+  while (blkSize > OAD_BLOCK_SIZE && blkSize > room)
+  {
+    blkSize >>= 1;
+  }
+
+  return blkSize;
+}
+
 /*********************************************************************
  * @fn      OAD_getNextBlockReq
  *
- * @brief   Process the Request for next image block.
+ * @brief   Process the Request for next image block. In a windowed
+ *          transfer this is the cumulative acknowledge, carrying the window
+ *          and the bitmap of blocks received past blkNum.
  *
  * @param   connHandle - connection message was received on
  * @param   blkNum - block number to request from OAD Manager.
@@ -728,8 +1068,9 @@ static void OAD_getNextBlockReq(uint16_t connHandle, uint16_t blkNum)
   if (value & GATT_CLIENT_CFG_NOTIFY)
   {
     attHandleValueNoti_t noti;
+    uint16_t len = (oadWindow != 0) ? OAD_BLK_ACK_SIZE : 2;
 
-    noti.pValue = GATT_bm_alloc(connHandle, ATT_HANDLE_VALUE_NOTI, 2, NULL);
+    noti.pValue = GATT_bm_alloc(connHandle, ATT_HANDLE_VALUE_NOTI, len, NULL);
 
     if (noti.pValue != NULL)
     {
@@ -739,11 +1080,25 @@ static void OAD_getNextBlockReq(uint16_t connHandle, uint16_t blkNum)
                                   oadCharVals+OAD_IDX_IMG_BLOCK);
 
       noti.handle = pAttr->handle;
-      noti.len = 2;
+      noti.len = len;
 
       noti.pValue[0] = LO_UINT16(blkNum);
       noti.pValue[1] = HI_UINT16(blkNum);
 
+      if (oadWindow != 0)
+      {
+        noti.pValue[2] = oadWindow;
+        noti.pValue[3] = BREAK_UINT32(oadWinMap, 0);
+        noti.pValue[4] = BREAK_UINT32(oadWinMap, 1);
+        noti.pValue[5] = BREAK_UINT32(oadWinMap, 2);
+        noti.pValue[6] = BREAK_UINT32(oadWinMap, 3);
+        noti.pValue[7] = LO_UINT16(oadBlkSize);
+        noti.pValue[8] = HI_UINT16(oadBlkSize);
+        noti.pValue[9] = oadFeatures;
+
+        oadAckBlkNum = blkNum;
+      }
+
       if (GATT_Notification(connHandle, &noti, FALSE) != SUCCESS)
       {
         GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
@@ -851,60 +1206,215 @@ static void OAD_rejectImage(uint16_t connHandle, img_hdr_t *pImgHdr)
 #if !defined FEATURE_OAD_ONCHIP
 
 /*********************************************************************
- * @fn      crcCalcDL
+ * @fn      OAD_crcUpdate
+ *
+ * @brief   Fold the blocks received in order into the image CRC.
+ *
+ *          The block just received is taken from the packet. Blocks of a
+ *          windowed transfer that arrived ahead of a gap are read back from
+ *          flash once the gap is filled.
+ *
+ * @param   blkNum - block just received
+ * @param   pData  - its data
+ *
+ * @return  None
+ */
+static void OAD_crcUpdate(uint16_t blkNum, uint8_t *pData)
+{
+  // The CRC of a decoded image is run in OAD_codecOut.
+  if (oadCodec != OAD_CODEC_NONE)
+  {
+    return;
+  }
+
+  while (oadCrcBlkNum < oadBlkNum)
+  {
+    uint32_t offset = (uint32_t)oadCrcBlkNum * oadBlkSize;
+    uint16_t len = OAD_blockLen(oadCrcBlkNum);
+    uint16_t skip = 0;
+
+    // The CRC and CRC shadow at the start of the image are not covered.
+    if (offset < HAL_FLASH_WORD_SIZE)
+    {
+      skip = HAL_FLASH_WORD_SIZE - offset;
+    }
+
+    if (oadCrcBlkNum == blkNum)
+    {
+      oadCrc = crc16(oadCrc, pData + skip, len - skip);
+    }
+    else
+    {
+      oadCrc = crcCalcFlash(oadCrc, offset + skip, len - skip);
+    }
+
+    oadCrcBlkNum++;
+
+    // Checkpoint each completed flash page.
+    offset += len;
+    if (offset % HAL_FLASH_PAGE_SIZE == 0 && offset < oadImgLen)
+    {
+      OAD_resumeSave(offset);
+    }
+  }
+}
+
+/*********************************************************************
+ * @fn      OAD_resumeStart
+ *
+ * @brief   Check for an interrupted download of the image just identified
+ *          and pick it up from the last checkpoint.
  *
- * @brief   Run the CRC16 Polynomial calculation over the DL image.
+ *          Only whole flash pages are checkpointed, so the pages below the
+ *          checkpoint can be kept and the rest erased. Any other image
+ *          invalidates the checkpoint.
+ *
+ * @param   pValue    - image identify data
+ * @param   hdrOffset - offset of the image header in it
+ *
+ * @return  Image bytes already downloaded, 0 to start from scratch.
+ */
+static uint32_t OAD_resumeStart(uint8_t *pValue, uint8_t hdrOffset)
+{
+  oadResume_t saved;
+
+  oadResume.crc = hdrOffset ? BUILD_UINT16(pValue[0], pValue[1]) : 0xFFFF;
+  memcpy(oadResume.hdr, pValue + hdrOffset, sizeof(oadResume.hdr));
+
+  // The decoder state is not checkpointed, an encoded payload starts over.
+  if (oadCodec == OAD_CODEC_NONE &&
+      osal_snv_read(OAD_NVID_RESUME, sizeof(saved), &saved) == SUCCESS &&
+      saved.len > 0 && saved.len < oadImgLen &&
+      saved.len % oadBlkSize == 0 &&
+      saved.crc == oadResume.crc &&
+      !memcmp(saved.hdr, oadResume.hdr, sizeof(saved.hdr)))
+  {
+    oadBlkNum = saved.len / oadBlkSize;
+    oadCrcBlkNum = oadBlkNum;
+    oadCrc = saved.runCrc;
+
+    return saved.len;
+  }
+
+  OAD_resumeClear();
+
+  return 0;
+}
+
+/*********************************************************************
+ * @fn      OAD_resumeSave
+ *
+ * @brief   Save a download progress checkpoint.
+ *
+ * @param   len - image bytes received in order so far
+ *
+ * @return  None
+ */
+static void OAD_resumeSave(uint32_t len)
+{
+  // The checkpoint must not get ahead of the flash.
+  OADTarget_flushFlash();
+
+  oadResume.runCrc = oadCrc;
+  oadResume.len = len;
+
+  VOID osal_snv_write(OAD_NVID_RESUME, sizeof(oadResume), &oadResume);
+}
+
+/*********************************************************************
+ * @fn      OAD_resumeClear
+ *
+ * @brief   Invalidate the download progress checkpoint.
  *
  * @param   None
  *
- * @return  The CRC16 calculated.
+ * @return  None
  */
-static uint16_t crcCalcDL(void)
+static void OAD_resumeClear(void)
 {
-  uint16_t imageCRC = 0;
-  uint8_t page;
-  uint8_t lastPage = oadBlkTot / OAD_BLOCKS_PER_PAGE;
+  oadResume_t saved;
+
+  // Spare the SNV write if there is nothing to clear.
+  if (osal_snv_read(OAD_NVID_RESUME, sizeof(saved), &saved) == SUCCESS &&
+      saved.len != 0)
+  {
+    oadResume.runCrc = 0;
+    oadResume.len = 0;
 
-  // Remainder of bytes not divisible by the size of a flash page in bytes.
-  uint16_t numRemBytes = (oadBlkTot - (lastPage * OAD_BLOCKS_PER_PAGE))
-                         * OAD_BLOCK_SIZE;
+    VOID osal_snv_write(OAD_NVID_RESUME, sizeof(oadResume), &oadResume);
+  }
+}
 
-  // Set last page to end of OAD image address range.
-  lastPage += imagePage;
+/*********************************************************************
+ * @fn      crcCalcFlash
+ *
+ * @brief   Run the CRC16 over a range of the DL image in flash.
+ *
+ * @param   crc    - Running CRC calculated so far.
+ * @param   offset - Offset into the DL image.
+ * @param   len    - Number of bytes.
+ *
+ * @return  The updated CRC.
+ */
+static uint16_t crcCalcFlash(uint16_t crc, uint32_t offset, uint32_t len)
+{
+  uint8_t buf[4 * HAL_FLASH_WORD_SIZE];
 
-  // Read over downloaded pages
-  for (page = imagePage; page <= lastPage; page++)
+  while (len > 0)
   {
-    uint16_t offset;
+    uint16_t n = (len < sizeof(buf)) ? len : sizeof(buf);
 
-    // Read over all flash words in a page, excluding the CRC section of the
-    // first page and all bytes after remainder bytes on the last page.
-    for (offset = (page == imagePage) ? HAL_FLASH_WORD_SIZE : 0;
-         offset < HAL_FLASH_PAGE_SIZE &&
-         (page < lastPage || offset < numRemBytes);
-         offset += HAL_FLASH_WORD_SIZE)
-    {
-      uint8_t buf[HAL_FLASH_WORD_SIZE];
-      uint8_t idx;
+    OADTarget_readFlash(imagePage, offset, buf, n);
+    crc = crc16(crc, buf, n);
 
-      // Read a word from flash.
-      OADTarget_readFlash(page, offset, buf, HAL_FLASH_WORD_SIZE);
+    offset += n;
+    len -= n;
+  }
 
-      // Calculate CRC of word, byte by byte.
-      for (idx = 0; idx < HAL_FLASH_WORD_SIZE; idx++)
-      {
-        imageCRC = crc16(imageCRC, buf[idx]);
-      }
-    }
+  return crc;
+}
+
+/*********************************************************************
+ * @fn      OAD_codecOut
+ *
+ * @brief   Write decoded image data to flash and fold it into the CRC.
+ *
+ *          Anything decoded past the image length, from padding the
+ *          payload to whole flash words, is dropped.
+ *
+ * @param   pBuf - decoded bytes
+ * @param   len  - number of bytes
+ *
+ * @return  None
+ */
+static void OAD_codecOut(uint8_t *pBuf, uint16_t len)
+{
+  uint16_t skip = 0;
+
+  if (oadOutLen + len > oadImgLen)
+  {
+    len = oadImgLen - oadOutLen;
+  }
+
+  if (len == 0)
+  {
+    return;
   }
 
-  // IAR note explains that poly must be run with value zero for each byte of
-  // the crc.
-  imageCRC = crc16(imageCRC, 0);
-  imageCRC = crc16(imageCRC, 0);
+  OADTarget_writeFlash(imagePage, oadOutLen, pBuf, len);
 
-  // Return the CRC calculated over the image.
-  return imageCRC;
+  // The CRC and CRC shadow at the start of the image are not covered.
+  if (oadOutLen < HAL_FLASH_WORD_SIZE)
+  {
+    skip = HAL_FLASH_WORD_SIZE - oadOutLen;
+    if (skip > len)
+    {
+      skip = len;
+    }
+  }
+
+  oadCrc = crc16(oadCrc, pBuf + skip, len - skip);
+  oadOutLen += len;
 }
 
 /*********************************************************************
@@ -912,6 +1422,10 @@ static uint16_t crcCalcDL(void)
  *
  * @brief   Check validity of the downloaded image.
  *
+ *          The CRC is folded in as blocks arrive, so this only compares.
+ *          Build with OAD_CRC_READBACK to also run the CRC over the image
+ *          read back from flash, which catches flash write errors too.
+ *
  * @param   None.
  *
  * @return  TRUE or FALSE for image valid.
@@ -927,8 +1441,21 @@ static uint8_t checkDL(void)
     return FALSE;
   }
 
-  // Calculate CRC of downloaded image.
-  crc[1] = crcCalcDL();
+  // An encoded payload must have decoded into the whole image.
+  if (oadCodec != OAD_CODEC_NONE && oadOutLen != oadImgLen)
+  {
+    return FALSE;
+  }
+
+  crc[1] = oadCrc;
+
+#ifdef OAD_CRC_READBACK
+  if (crc[1] == crc[0])
+  {
+    crc[1] = crcCalcFlash(0, HAL_FLASH_WORD_SIZE,
+                          oadImgLen - HAL_FLASH_WORD_SIZE);
+  }
+#endif // OAD_CRC_READBACK
 
   if (crc[1] == crc[0])
   {
@@ -942,33 +1469,24 @@ static uint8_t checkDL(void)
 /*********************************************************************
  * @fn          crc16
  *
- * @brief       Run the CRC16 Polynomial calculation over the byte parameter.
+ * @brief       Run the CRC16 Polynomial calculation over a buffer.
  *
- * @param       crc - Running CRC calculated so far.
- * @param       val - Value on which to run the CRC16.
+ *              Table driven CRC-CCITT (poly 0x1021, MSB first). Starting
+ *              from zero this gives the same result as the bit-serial IAR
+ *              checksum followed by its two zero bytes, so no padding pass
+ *              is needed at the end.
+ *
+ * @param       crc  - Running CRC calculated so far.
+ * @param       pBuf - Bytes on which to run the CRC16.
+ * @param       len  - Number of bytes.
  *
  * @return      crc - Updated for the run.
  */
-static uint16_t crc16(uint16_t crc, uint8_t val)
+static uint16_t crc16(uint16_t crc, const uint8_t *pBuf, uint16_t len)
 {
-  const uint16_t poly = 0x1021;
-  uint8_t cnt;
-
-  for (cnt = 0; cnt < 8; cnt++, val <<= 1)
+  while (len--)
   {
-    uint8_t msb = (crc & 0x8000) ? 1 : 0;
-
-    crc <<= 1;
-
-    if (val & 0x80)
-    {
-      crc |= 0x0001;
-    }
-
-    if (msb)
-    {
-      crc ^= poly;
-    }
+    crc = (crc << 8) ^ crc16Table[(uint8_t)(crc >> 8) ^ *pBuf++];
   }
 
   return crc;
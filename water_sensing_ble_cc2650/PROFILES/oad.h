@@ -76,6 +76,31 @@ extern "C"
 // Number of characteristics in the service
 #define OAD_CHAR_CNT           4
 
+// Extended Image Identify: the 16 byte CRC + header form followed by a
+// feature request byte, the requested window and, for an encoded payload,
+// the payload length in flash words.
+#define OAD_IMG_ID_EXT_SIZE    20
+#define OAD_IMG_ID_FEATURES    16
+#define OAD_IMG_ID_WINDOW      17
+#define OAD_IMG_ID_PAYLOAD_LEN 18
+
+// Feature request bits
+#define OAD_FEATURE_WINDOW     0x01
+#define OAD_FEATURE_LARGE_BLOCK 0x02
+#define OAD_FEATURE_COMPRESSED 0x08
+#define OAD_FEATURE_DELTA      0x10
+
+// Windowed transfer: most blocks outstanding at once.
+#define OAD_WINDOW_MAX         32
+
+// Block number written by the OAD manager to ask for a block acknowledge.
+#define OAD_BLK_ACK_REQ        0xFFFF
+
+// Windowed block acknowledge: next expected block (2), window (1), a
+// bitmap of the blocks received from the next expected block on (4), the
+// negotiated block size (2) and the feature bits granted (1).
+#define OAD_BLK_ACK_SIZE       10
+
 /*********************************************************************
  * MACROS
  */
@@ -93,9 +118,13 @@ extern "C"
  * Profile Callbacks
  */
 
-// Callback when a characteristic value has changed
+// Callback when a characteristic value has changed. pData and its len
+// bytes are only valid during the call. An application that processes the
+// write in its own task must copy all len bytes, a block write is up to
+// OAD_BLOCK_SIZE_MAX + 2 long. Block writes of the wrong length have
+// already been rejected.
 typedef void (*oadWriteCB_t)(uint8_t event, uint16_t connHandle,
-                             uint8_t *pData);
+                             uint8_t *pData, uint16_t len);
 
 typedef struct
 {
@@ -148,7 +177,9 @@ extern void OAD_register(oadTargetCBs_t *pfnOadCBs);
  * @fn      OAD_imgIdentifyWrite
  *
  * @brief   Process the Image Identify Write.  Determine from the received OAD
- *          Image Header if the Downloaded Image should be acquired.
+ *          Image Header if the Downloaded Image should be acquired. If a
+ *          download of the same image was interrupted, the first block
+ *          requested is the one after the last checkpointed flash page.
  *
  * @param   connHandle - connection message was received on
  * @param   pValue     - pointer to data to be written
@@ -160,10 +191,12 @@ extern void OAD_imgIdentifyWrite(uint16 connHandle, uint8 *pValue);
 /*********************************************************************
  * @fn      OAD_imgBlockWrite
  *
- * @brief   Process the Image Block Write.
+ * @brief   Process the Image Block Write. With large blocks negotiated a
+ *          block write carries up to OAD_BLOCK_SIZE_MAX + 2 bytes.
  *
  * @param   connHandle - connection message was received on
- * @param   pValue     - pointer to data to be written
+ * @param   pValue     - pointer to data to be written, all len bytes
+ *                       passed to the oadWriteCB_t
  *
  * @return  None.
  */
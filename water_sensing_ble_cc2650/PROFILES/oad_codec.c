@@ -0,0 +1,340 @@
+/*
+ * Streaming decoders for OAD image payloads, see oad_codec.h.
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stddef.h>
+
+#include "oad_codec.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// LZSS decoder states
+#define LZ_STATE_FLAGS         0
+#define LZ_STATE_ITEM          1
+#define LZ_STATE_MATCH_LEN     2
+
+// Delta decoder states
+#define DELTA_STATE_OP         0
+#define DELTA_STATE_COPY_ARGS  1
+#define DELTA_STATE_INSERT     2
+
+// Base image bytes read at a time for a copy.
+#define DELTA_COPY_CHUNK       16
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static oadCodecOutCB_t pfnCodecOut = NULL;
+static oadCodecBaseCB_t pfnCodecBase = NULL;
+static uint8_t codecType = OAD_CODEC_NONE;
+
+// Output history. Decoded bytes are written here and handed out straight
+// from the window, from lzEmitPos up to lzPos. Both indices wrap with the
+// 256 byte window on their own.
+static uint8_t lzWindow[OAD_LZ_WINDOW_SIZE];
+static uint8_t lzPos;
+static uint8_t lzEmitPos;
+
+// Token being decoded, which may straddle blocks.
+static uint8_t lzState;
+static uint8_t lzFlags;
+static uint8_t lzFlagBits;
+static uint8_t lzDist;
+
+// Delta operation being decoded.
+static uint8_t deltaState;
+static uint8_t deltaArgs[OAD_DELTA_COPY_ARGS];
+static uint8_t deltaArgCnt;
+static uint8_t deltaInsertCnt;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      lzEmit
+ *
+ * @brief   Hand the decoded bytes not passed on yet to the output.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+static void lzEmit(void)
+{
+  if (lzPos != lzEmitPos)
+  {
+    pfnCodecOut(lzWindow + lzEmitPos, (uint8_t)(lzPos - lzEmitPos));
+    lzEmitPos = lzPos;
+  }
+}
+
+/*********************************************************************
+ * @fn      lzPut
+ *
+ * @brief   Append a decoded byte to the window. The window is emitted
+ *          before it wraps so no byte is overwritten before it is output.
+ *
+ * @param   b - decoded byte
+ *
+ * @return  None.
+ */
+static void lzPut(uint8_t b)
+{
+  lzWindow[lzPos++] = b;
+
+  if (lzPos == 0)
+  {
+    pfnCodecOut(lzWindow + lzEmitPos, OAD_LZ_WINDOW_SIZE - lzEmitPos);
+    lzEmitPos = 0;
+  }
+}
+
+/*********************************************************************
+ * @fn      lzNextItem
+ *
+ * @brief   Move on to the next item of the current flag byte.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+static void lzNextItem(void)
+{
+  lzFlags >>= 1;
+  lzState = (--lzFlagBits == 0) ? LZ_STATE_FLAGS : LZ_STATE_ITEM;
+}
+
+/*********************************************************************
+ * @fn      lzDecode
+ *
+ * @brief   Run the LZSS decoder over part of the payload.
+ *
+ * @param   pData - payload bytes
+ * @param   len   - number of bytes
+ *
+ * @return  None.
+ */
+static void lzDecode(uint8_t *pData, uint16_t len)
+{
+  while (len--)
+  {
+    uint8_t b = *pData++;
+
+    switch (lzState)
+    {
+      case LZ_STATE_FLAGS:
+        lzFlags = b;
+        lzFlagBits = 8;
+        lzState = LZ_STATE_ITEM;
+        break;
+
+      case LZ_STATE_ITEM:
+        if (lzFlags & 0x01)
+        {
+          lzPut(b);
+          lzNextItem();
+        }
+        else
+        {
+          lzDist = b;
+          lzState = LZ_STATE_MATCH_LEN;
+        }
+        break;
+
+      case LZ_STATE_MATCH_LEN:
+        {
+          uint16_t n = b + OAD_LZ_MIN_MATCH;
+
+          // Copy byte by byte, a match may overlap its own output.
+          while (n--)
+          {
+            lzPut(lzWindow[(uint8_t)(lzPos - lzDist - 1)]);
+          }
+
+          lzNextItem();
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  lzEmit();
+}
+
+/*********************************************************************
+ * @fn      deltaCopy
+ *
+ * @brief   Copy a range of the base image to the output.
+ *
+ * @param   offset - offset into the base image
+ * @param   len    - number of bytes
+ *
+ * @return  None.
+ */
+static void deltaCopy(uint32_t offset, uint32_t len)
+{
+  uint8_t buf[DELTA_COPY_CHUNK];
+
+  while (len > 0)
+  {
+    uint16_t n = (len < sizeof(buf)) ? len : sizeof(buf);
+
+    pfnCodecBase(offset, buf, n);
+    pfnCodecOut(buf, n);
+
+    offset += n;
+    len -= n;
+  }
+}
+
+/*********************************************************************
+ * @fn      deltaDecode
+ *
+ * @brief   Run the delta decoder over part of the payload.
+ *
+ * @param   pData - payload bytes
+ * @param   len   - number of bytes
+ *
+ * @return  None.
+ */
+static void deltaDecode(uint8_t *pData, uint16_t len)
+{
+  while (len > 0)
+  {
+    switch (deltaState)
+    {
+      case DELTA_STATE_OP:
+        if (*pData & OAD_DELTA_OP_COPY)
+        {
+          deltaArgCnt = 0;
+          deltaState = DELTA_STATE_COPY_ARGS;
+        }
+        else
+        {
+          deltaInsertCnt = *pData + 1;
+          deltaState = DELTA_STATE_INSERT;
+        }
+        pData++;
+        len--;
+        break;
+
+      case DELTA_STATE_COPY_ARGS:
+        deltaArgs[deltaArgCnt++] = *pData++;
+        len--;
+
+        if (deltaArgCnt == OAD_DELTA_COPY_ARGS)
+        {
+          uint32_t offset = (uint32_t)deltaArgs[0] |
+                            ((uint32_t)deltaArgs[1] << 8) |
+                            ((uint32_t)deltaArgs[2] << 16);
+          uint32_t count = ((uint32_t)deltaArgs[3] |
+                            ((uint32_t)deltaArgs[4] << 8)) + 1;
+
+          deltaCopy(offset, count);
+          deltaState = DELTA_STATE_OP;
+        }
+        break;
+
+      case DELTA_STATE_INSERT:
+        {
+          // Inserted bytes go out straight from the payload.
+          uint16_t n = (len < deltaInsertCnt) ? len : deltaInsertCnt;
+
+          pfnCodecOut(pData, n);
+
+          pData += n;
+          len -= n;
+          deltaInsertCnt -= n;
+
+          if (deltaInsertCnt == 0)
+          {
+            deltaState = DELTA_STATE_OP;
+          }
+        }
+        break;
+
+      default:
+        len = 0;
+        break;
+    }
+  }
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      OADCodec_init
+ *
+ * @brief   Start decoding a new payload.
+ *
+ * @param   codec   - one of OAD_CODEC_*
+ * @param   pfnOut  - output callback
+ * @param   pfnBase - delta base read callback
+ *
+ * @return  None.
+ */
+void OADCodec_init(uint8_t codec, oadCodecOutCB_t pfnOut,
+                   oadCodecBaseCB_t pfnBase)
+{
+  uint16_t i;
+
+  codecType = codec;
+  pfnCodecOut = pfnOut;
+  pfnCodecBase = pfnBase;
+
+  // Matches reaching back before the start of the image read zeros, the
+  // packer assumes the same.
+  for (i = 0; i < OAD_LZ_WINDOW_SIZE; i++)
+  {
+    lzWindow[i] = 0;
+  }
+
+  lzPos = 0;
+  lzEmitPos = 0;
+  lzState = LZ_STATE_FLAGS;
+
+  deltaState = DELTA_STATE_OP;
+}
+
+/*********************************************************************
+ * @fn      OADCodec_decode
+ *
+ * @brief   Decode the next part of the payload. Everything decoded has
+ *          been passed to the output callback on return.
+ *
+ * @param   pData - payload bytes
+ * @param   len   - number of bytes
+ *
+ * @return  None.
+ */
+void OADCodec_decode(uint8_t *pData, uint16_t len)
+{
+  switch (codecType)
+  {
+    case OAD_CODEC_LZSS:
+      lzDecode(pData, len);
+      break;
+
+    case OAD_CODEC_DELTA:
+      deltaDecode(pData, len);
+      break;
+
+    default:
+      pfnCodecOut(pData, len);
+      break;
+  }
+}
+
+/*********************************************************************
+*********************************************************************/
@@ -0,0 +1,101 @@
+/*
+ * Streaming decoders for OAD image payloads.
+ *
+ * An OAD manager may send the image compressed instead of raw. The payload
+ * is fed to the decoder block by block, in order, and the decoder hands the
+ * reconstructed image to an output callback as it goes, so no more than
+ * the decoder state is ever held in RAM.
+ *
+ * LZSS stream format (tools/oad_pack.py):
+ *   A flag byte followed by up to 8 items, flag bit 0 first. A set bit is a
+ *   literal byte, a clear bit a match of two bytes: distance - 1 and
+ *   length - OAD_LZ_MIN_MATCH. Matches reach back at most OAD_LZ_WINDOW_SIZE
+ *   bytes into the output.
+ *
+ * Delta stream format (tools/oad_pack.py --base):
+ *   A list of operations rebuilding the new image from the image in use.
+ *   0x00-0x7F  insert: (op + 1) bytes follow, taken as they are.
+ *   0x80       copy: 3 byte offset into the image in use and 2 byte
+ *              length - 1 follow, little endian.
+ */
+#ifndef OAD_CODEC_H
+#define OAD_CODEC_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Payload encodings
+#define OAD_CODEC_NONE         0
+#define OAD_CODEC_LZSS         1
+#define OAD_CODEC_DELTA        2
+
+// LZSS parameters, shared with the host packer. The window size is tied to
+// the 8 bit window index in oad_codec.c.
+#define OAD_LZ_WINDOW_SIZE     256
+#define OAD_LZ_MIN_MATCH       3
+
+// Delta operations
+#define OAD_DELTA_OP_COPY      0x80
+#define OAD_DELTA_COPY_ARGS    5
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Receives the decoded image, in order.
+typedef void (*oadCodecOutCB_t)(uint8_t *pBuf, uint16_t len);
+
+// Reads the image a delta is applied to.
+typedef void (*oadCodecBaseCB_t)(uint32_t offset, uint8_t *pBuf,
+                                 uint16_t len);
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      OADCodec_init
+ *
+ * @brief   Start decoding a new payload.
+ *
+ * @param   codec   - one of OAD_CODEC_*
+ * @param   pfnOut  - output callback
+ * @param   pfnBase - delta base read callback
+ *
+ * @return  None.
+ */
+extern void OADCodec_init(uint8_t codec, oadCodecOutCB_t pfnOut,
+                          oadCodecBaseCB_t pfnBase);
+
+/*********************************************************************
+ * @fn      OADCodec_decode
+ *
+ * @brief   Decode the next part of the payload. Everything decoded has
+ *          been passed to the output callback on return.
+ *
+ * @param   pData - payload bytes
+ * @param   len   - number of bytes
+ *
+ * @return  None.
+ */
+extern void OADCodec_decode(uint8_t *pData, uint16_t len);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OAD_CODEC_H */
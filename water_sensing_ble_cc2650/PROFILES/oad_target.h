@@ -79,6 +79,9 @@ extern "C"
 
 // The Image is transported in 16-byte blocks in order to avoid using blob operations.
 #define OAD_BLOCK_SIZE         16
+
+// Largest block when the block size is negotiated from the ATT MTU.
+#define OAD_BLOCK_SIZE_MAX     128
 #define OAD_BLOCKS_PER_PAGE    (HAL_FLASH_PAGE_SIZE / OAD_BLOCK_SIZE)
 #define OAD_BLOCK_MAX          (OAD_BLOCKS_PER_PAGE * OAD_IMG_D_AREA)
 
@@ -321,11 +324,12 @@ extern uint32_t OADTarget_imageAddress(uint8_t *pValue);
  * @param   pValue - pointer to new Image header information
  * @param   ImgHdr - pointer to contents of current image header
  * @param   blkTot - total number of blocks comprising new image.
+ * @param   blkSize - size of the blocks in bytes.
  *
  * @return  TRUE to begin OAD otherwise FALSE to reject the image.
  */
 extern uint8_t OADTarget_validateNewImage(uint8_t *pValue, img_hdr_t *ImgHdr,
-                                          uint16_t blkTot);
+                                          uint16_t blkTot, uint16_t blkSize);
 
 /*********************************************************************
  * @fn      OADTarget_readFlash
@@ -342,6 +346,21 @@ extern uint8_t OADTarget_validateNewImage(uint8_t *pValue, img_hdr_t *ImgHdr,
 extern void OADTarget_readFlash(uint8_t page, uint32_t offset,
                                 uint8_t *pBuf, uint16_t len);
 
+/*********************************************************************
+ * @fn      OADTarget_readCurrentImage
+ *
+ * @brief   Read from the image now in use of the type being downloaded,
+ *          the base a delta update is applied to.
+ *
+ * @param   offset - offset into the image to begin reading
+ * @param   pBuf   - pointer to buffer into which data is read.
+ * @param   len    - length of data to read in bytes.
+ *
+ * @return  None.
+ */
+extern void OADTarget_readCurrentImage(uint32_t offset, uint8_t *pBuf,
+                                       uint16_t len);
+
 /*********************************************************************
  * @fn      OADTarget_writeFlash
  *
@@ -357,6 +376,17 @@ extern void OADTarget_readFlash(uint8_t page, uint32_t offset,
 extern void OADTarget_writeFlash(uint8_t page, uint32_t offset,
                                  uint8_t *pBuf, uint16_t len);
 
+/*********************************************************************
+ * @fn      OADTarget_flushFlash
+ *
+ * @brief   Write out any data OADTarget_writeFlash is still holding.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+extern void OADTarget_flushFlash(void);
+
 /*********************************************************************
  * @fn      OADTarget_eraseFlash
  *
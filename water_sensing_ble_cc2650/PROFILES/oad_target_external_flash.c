@@ -59,14 +59,24 @@
  * Constants and macros
  */
 #define PROG_BUF_SIZE             16
+
+// External flash program page. Writes are gathered into one page so that
+// each page costs a single program command.
+#define WRITE_BUF_SIZE            256
 #define PAGE_0                    0
 #define PAGE_1                    1
 #define PAGE_31                   31
 
 #define APP_IMAGE_START           0x1000
 #define BOOT_LOADER_START         0x1F000
+#define INT_FLASH_SIZE            0x20000
+
+// Internal flash is memory mapped from address 0.
+#ifndef INT_FLASH_BASE
+#define INT_FLASH_BASE            0
+#endif
 
-#define MAX_BLOCKS                (EFL_SIZE_IMAGE_APP / OAD_BLOCK_SIZE)
+#define MAX_BLOCKS(blkSize)       (EFL_SIZE_IMAGE_APP / (blkSize))
 
 // Dummy header.
 #if defined (__IAR_SYSTEMS_ICC__)
@@ -101,6 +111,11 @@ const uint8_t _imgHdr[16] = {
 static bool isOpen = false;
 static ExtImageInfo_t imgInfo;
 
+// Write-combining buffer, holding writeBufLen bytes for writeBufAddr on.
+static uint8_t writeBuf[WRITE_BUF_SIZE];
+static uint32_t writeBufAddr;
+static uint16_t writeBufLen = 0;
+
 /*******************************************************************************
  * PRIVATE FUNCTIONS
  */
@@ -142,6 +157,8 @@ void OADTarget_close(void)
 {
   if (isOpen)
   {
+    OADTarget_flushFlash();
+
     isOpen = false;
     ExtFlash_close();
   }
@@ -174,7 +191,8 @@ uint8_t OADTarget_getCurrentImageHeader(img_hdr_t *pHdr)
 {
   uint8_t ret;
 
-  ret = ExtFlash_open() ? TRUE : FALSE;
+  // A download in progress already has the flash open.
+  ret = (isOpen || ExtFlash_open()) ? TRUE : FALSE;
 
   if (ret)
   {
@@ -194,7 +212,12 @@ uint8_t OADTarget_getCurrentImageHeader(img_hdr_t *pHdr)
     }
 
     ExtFlash_read(metaDataAddr, sizeof(ExtImageInfo_t), (uint8_t*)&tempHdr);
-    ExtFlash_close();
+
+    // Closing it under the download would fail every write that follows.
+    if (!isOpen)
+    {
+      ExtFlash_close();
+    }
 
     pHdr->len = tempHdr.len;
 
@@ -219,11 +242,12 @@ uint8_t OADTarget_getCurrentImageHeader(img_hdr_t *pHdr)
  * @param   pValue - pointer to new Image header information
  * @param   pCur - pointer to contents of current image header
  * @param   blkTot - total number of blocks comprising new image.
+ * @param   blkSize - size of the blocks in bytes.
  *
  * @return  TRUE to begin OAD otherwise FALSE to reject the image.
  */
 uint8_t OADTarget_validateNewImage(uint8_t *pValue, img_hdr_t *pCur,
-                                   uint16_t blkTot)
+                                   uint16_t blkTot, uint16_t blkSize)
 {
   img_hdr_t *pNew;
   uint32_t addr;
@@ -236,7 +260,7 @@ uint8_t OADTarget_validateNewImage(uint8_t *pValue, img_hdr_t *pCur,
   valid = FALSE;
 
   // Check if number of blocks make sense
-  if (blkTot > MAX_BLOCKS || blkTot == 0)
+  if (blkTot > MAX_BLOCKS(blkSize) || blkTot == 0)
   {
     return FALSE;
   }
@@ -411,14 +435,52 @@ void OADTarget_disableCache(void)
 void OADTarget_readFlash(uint8_t page, uint32_t offset, uint8_t *pBuf,
                          uint16_t len)
 {
+  // Reads must see everything written so far.
+  OADTarget_flushFlash();
+
   ExtFlash_read(FLASH_ADDRESS(page,offset), len, pBuf);
 }
 
+/*******************************************************************************
+ * @fn      OADTarget_readCurrentImage
+ *
+ * @brief   Read from the image now in use of the type being downloaded.
+ *
+ *          The download slot in external flash is overwritten by the new
+ *          image, so the base of a delta update is the image running from
+ *          internal flash, at the address given in the new image header.
+ *
+ * @param   offset - offset into the image to begin reading
+ * @param   pBuf   - pointer to buffer into which data is read.
+ * @param   len    - length of data to read in bytes.
+ *
+ * @return  None.
+ */
+void OADTarget_readCurrentImage(uint32_t offset, uint8_t *pBuf, uint16_t len)
+{
+  uint32_t addr = (uint32_t)imgInfo.addr * EFL_OAD_ADDR_RESOLUTION + offset;
+
+  // Anything past the end of internal flash reads as erased.
+  if (addr >= INT_FLASH_SIZE || len > INT_FLASH_SIZE - addr)
+  {
+    memset(pBuf, 0xFF, len);
+    return;
+  }
+
+  memcpy(pBuf, (const uint8_t *)(uintptr_t)(INT_FLASH_BASE + addr), len);
+}
+
 /*******************************************************************************
  * @fn      OADTarget_writeFlash
  *
  * @brief   Write data to flash.
  *
+ *          Contiguous writes are gathered into a program page buffer and
+ *          only written out when the page is full, on a gap, or on
+ *          OADTarget_flushFlash. ExtFlash_write waits for the previous
+ *          program to finish before it starts, not after, so the flash
+ *          programs one page while the blocks of the next are received.
+ *
  * @param   page   - page to write to in flash
  * @param   offset - offset into flash page to begin writing
  * @param   pBuf   - pointer to buffer of data to write
@@ -429,7 +491,59 @@ void OADTarget_readFlash(uint8_t page, uint32_t offset, uint8_t *pBuf,
 void OADTarget_writeFlash(uint8_t page, uint32_t offset, uint8_t *pBuf,
                           uint16_t len)
 {
-  ExtFlash_write(FLASH_ADDRESS(page,offset), len, pBuf);
+  uint32_t addr = FLASH_ADDRESS(page,offset);
+
+  while (len > 0)
+  {
+    uint16_t n = WRITE_BUF_SIZE - (addr % WRITE_BUF_SIZE);
+
+    // Not following on from the buffered data, write that out first.
+    if (writeBufLen > 0 && addr != writeBufAddr + writeBufLen)
+    {
+      OADTarget_flushFlash();
+    }
+
+    if (writeBufLen == 0)
+    {
+      writeBufAddr = addr;
+    }
+
+    if (n > len)
+    {
+      n = len;
+    }
+
+    memcpy(writeBuf + writeBufLen, pBuf, n);
+    writeBufLen += n;
+
+    addr += n;
+    pBuf += n;
+    len -= n;
+
+    // Program page complete.
+    if (addr % WRITE_BUF_SIZE == 0)
+    {
+      OADTarget_flushFlash();
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn      OADTarget_flushFlash
+ *
+ * @brief   Write out any data OADTarget_writeFlash is still holding.
+ *
+ * @param   None.
+ *
+ * @return  None.
+ */
+void OADTarget_flushFlash(void)
+{
+  if (writeBufLen > 0)
+  {
+    ExtFlash_write(writeBufAddr, writeBufLen, writeBuf);
+    writeBufLen = 0;
+  }
 }
 
 /*********************************************************************
@@ -443,6 +557,8 @@ void OADTarget_writeFlash(uint8_t page, uint32_t offset, uint8_t *pBuf,
  */
 void OADTarget_eraseFlash(uint8_t page)
 {
+  OADTarget_flushFlash();
+
   ExtFlash_erase(FLASH_ADDRESS(page,0), HAL_FLASH_PAGE_SIZE);
 }
 
@@ -483,6 +599,9 @@ void saveImageInfo(void)
     addr = EFL_IMAGE_INFO_ADDR_BLE;
   }
 
+  // The image must be complete in flash before its meta data.
+  OADTarget_flushFlash();
+
   // Erase old meta data.
   ExtFlash_erase(addr, HAL_FLASH_PAGE_SIZE);
 
@@ -59,6 +59,7 @@
 #include "bcomdef.h"
 #include "peripheral.h"
 #include "project_zero.h"
+#include "diag.h"
 
 #include <ti/drivers/PIN.h>
 #include <ti/drivers/UART.h>
@@ -177,6 +178,10 @@ int main(){
  */
 void AssertHandler(uint8 assertCause, uint8 assertSubcause)
 {
+  // Keep the cause readable from the diagnostics service, as an out of
+  // memory assert returns and the node keeps running.
+  Diag_recordAssert(assertCause, assertSubcause);
+
   // Open the display if the app has not already done so
   if ( !dispHandle )
   {
@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+"""Encode an OAD image for a compressed or delta over-the-air download.
+
+The payload is the LZSS stream, or with --base the delta against the image
+the node runs now, decoded by PROFILES/oad_codec.c, padded to whole flash
+words. The tool also prints the extended image identify to write to the
+OAD service, which carries the payload length.
+
+Usage:
+    oad_pack.py image.bin -o image.lz [--window 16] [--large-block]
+    oad_pack.py image.bin --base running.bin -o image.delta
+    oad_pack.py --selftest [image.bin ...]
+"""
+
+import argparse
+import random
+import struct
+import sys
+
+# Must match PROFILES/oad_codec.h and PROFILES/oad.h.
+LZ_WINDOW_SIZE = 256
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = LZ_MIN_MATCH + 255
+
+DELTA_OP_COPY = 0x80
+DELTA_INSERT_MAX = 128
+DELTA_COPY_MAX = 0x10000
+DELTA_MIN_COPY = 8
+
+FLASH_WORD_SIZE = 4
+IMG_ID_SIZE = 16
+
+FEATURE_WINDOW = 0x01
+FEATURE_LARGE_BLOCK = 0x02
+FEATURE_COMPRESSED = 0x08
+FEATURE_DELTA = 0x10
+
+
+def compress(data):
+    """Greedy LZSS, longest match within the window."""
+    out = bytearray()
+    chains = {}
+    flags_at = None
+    nitems = 8
+    pos = 0
+    next_prune = 4096
+
+    def add_item(literal, body):
+        nonlocal flags_at, nitems
+        if nitems == 8:
+            flags_at = len(out)
+            out.append(0)
+            nitems = 0
+        if literal:
+            out[flags_at] |= 1 << nitems
+        out.extend(body)
+        nitems += 1
+
+    def insert(p):
+        if p + LZ_MIN_MATCH <= len(data):
+            chains.setdefault(data[p:p + LZ_MIN_MATCH], []).append(p)
+
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        for cand in reversed(chains.get(data[pos:pos + LZ_MIN_MATCH], ())):
+            dist = pos - cand
+            if dist > LZ_WINDOW_SIZE:
+                break
+            n = 0
+            limit = min(LZ_MAX_MATCH, len(data) - pos)
+            while n < limit and data[cand + n] == data[pos + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, dist
+                if n == limit:
+                    break
+
+        if best_len >= LZ_MIN_MATCH:
+            add_item(False, bytes((best_dist - 1, best_len - LZ_MIN_MATCH)))
+            step = best_len
+        else:
+            add_item(True, data[pos:pos + 1])
+            step = 1
+
+        for p in range(pos, pos + step):
+            insert(p)
+        pos += step
+
+        # Keep the chains to the window.
+        if pos >= next_prune:
+            next_prune += 4096
+            for key in list(chains):
+                chains[key] = [p for p in chains[key]
+                               if pos - p <= LZ_WINDOW_SIZE]
+
+    return bytes(out)
+
+
+def decompress(payload, length):
+    """Reference decoder, mirrors lzDecode() in oad_codec.c."""
+    window = bytearray(LZ_WINDOW_SIZE)
+    wpos = 0
+    out = bytearray()
+    flags = nbits = 0
+    i = 0
+
+    def put(b):
+        nonlocal wpos
+        window[wpos] = b
+        wpos = (wpos + 1) % LZ_WINDOW_SIZE
+        out.append(b)
+
+    while i < len(payload) and len(out) < length:
+        if nbits == 0:
+            flags, nbits = payload[i], 8
+            i += 1
+            continue
+        if flags & 1:
+            put(payload[i])
+            i += 1
+        else:
+            if i + 1 >= len(payload):
+                break
+            dist, n = payload[i] + 1, payload[i + 1] + LZ_MIN_MATCH
+            i += 2
+            for _ in range(n):
+                put(window[(wpos - dist) % LZ_WINDOW_SIZE])
+        flags >>= 1
+        nbits -= 1
+
+    return bytes(out[:length])
+
+
+def delta(base, data):
+    """Copy/insert ops rebuilding data from base, greedy longest copy."""
+    index = {}
+    for p in range(len(base) - DELTA_MIN_COPY + 1):
+        index.setdefault(base[p:p + DELTA_MIN_COPY], []).append(p)
+
+    out = bytearray()
+    pending = bytearray()
+
+    def flush_inserts():
+        for i in range(0, len(pending), DELTA_INSERT_MAX):
+            chunk = pending[i:i + DELTA_INSERT_MAX]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        del pending[:]
+
+    pos = 0
+    while pos < len(data):
+        best_len, best_off = 0, 0
+        for cand in index.get(data[pos:pos + DELTA_MIN_COPY], ())[:64]:
+            n = 0
+            limit = min(DELTA_COPY_MAX, len(data) - pos, len(base) - cand)
+            while n < limit and base[cand + n] == data[pos + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_off = n, cand
+                if n == limit:
+                    break
+
+        if best_len >= DELTA_MIN_COPY:
+            flush_inserts()
+            out.append(DELTA_OP_COPY)
+            out.extend(struct.pack("<I", best_off)[:3])
+            out.extend(struct.pack("<H", best_len - 1))
+            pos += best_len
+        else:
+            pending.append(data[pos])
+            pos += 1
+
+    flush_inserts()
+    return bytes(out)
+
+
+def undelta(base, payload, length):
+    """Reference decoder, mirrors deltaDecode() in oad_codec.c."""
+    out = bytearray()
+    i = 0
+    while i < len(payload) and len(out) < length:
+        op = payload[i]
+        i += 1
+        if op & DELTA_OP_COPY:
+            args = payload[i:i + 5]
+            if len(args) < 5:
+                break
+            off = args[0] | args[1] << 8 | args[2] << 16
+            n = (args[3] | args[4] << 8) + 1
+            chunk = base[off:off + n]
+            out.extend(chunk + b"\xff" * (n - len(chunk)))
+            i += 5
+        else:
+            out.extend(payload[i:i + op + 1])
+            i += op + 1
+    return bytes(out[:length])
+
+
+def pad(payload):
+    return payload + b"\xff" * (-len(payload) % FLASH_WORD_SIZE)
+
+
+def identify(image, payload, window, large_block, features):
+    if window:
+        features |= FEATURE_WINDOW
+    if large_block:
+        features |= FEATURE_LARGE_BLOCK
+    return (image[:IMG_ID_SIZE] +
+            struct.pack("<BBH", features, window,
+                        len(payload) // FLASH_WORD_SIZE))
+
+
+def selftest(files):
+    rnd = random.Random(1)
+    cases = [b"", b"a", b"abc" * 1000, bytes(5000),
+             bytes(rnd.randrange(256) for _ in range(3000)),
+             bytes(rnd.choice(b"\x00\x00\xff\x12\x34") for _ in range(20000))]
+    for name in files:
+        with open(name, "rb") as f:
+            cases.append(f.read())
+
+    for data in cases:
+        payload = pad(compress(data))
+        back = decompress(payload, len(data))
+        if back != data:
+            sys.exit("round trip failed for %d byte input" % len(data))
+        print("lzss  %7d -> %7d bytes ok" % (len(data), len(payload)))
+
+        # Delta against a patched copy: a few bytes changed, a run inserted
+        # and a run dropped.
+        new = bytearray(data)
+        for _ in range(len(new) // 1000):
+            new[rnd.randrange(len(new))] = rnd.randrange(256)
+        cut = len(new) // 3
+        new[cut:cut] = bytes(rnd.randrange(256) for _ in range(100))
+        del new[2 * cut:2 * cut + 50]
+        new = bytes(new)
+        payload = pad(delta(data, new))
+        if undelta(data, payload, len(new)) != new:
+            sys.exit("delta round trip failed for %d byte input" % len(new))
+        print("delta %7d -> %7d bytes ok" % (len(new), len(payload)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("image", nargs="*", help="OAD image (.bin)")
+    ap.add_argument("-o", "--output", help="payload file to write")
+    ap.add_argument("--base", help="image the node runs now, for a delta")
+    ap.add_argument("--window", type=int, default=0,
+                    help="blocks outstanding in a windowed transfer")
+    ap.add_argument("--large-block", action="store_true",
+                    help="ask for the block size to follow the MTU")
+    ap.add_argument("--selftest", action="store_true",
+                    help="round trip built in data and any images given")
+    args = ap.parse_args()
+
+    if args.selftest:
+        selftest(args.image)
+        return
+
+    if len(args.image) != 1 or not args.output:
+        ap.error("need one image and -o")
+
+    with open(args.image[0], "rb") as f:
+        image = f.read()
+    if len(image) < IMG_ID_SIZE or len(image) % FLASH_WORD_SIZE:
+        sys.exit("%s is not an OAD image" % args.image[0])
+
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+        payload = pad(delta(base, image))
+        if undelta(base, payload, len(image)) != image:
+            sys.exit("internal error, delta does not apply")
+        features = FEATURE_DELTA
+    else:
+        payload = pad(compress(image))
+        if decompress(payload, len(image)) != image:
+            sys.exit("internal error, payload does not decompress")
+        features = FEATURE_COMPRESSED
+    if len(payload) // FLASH_WORD_SIZE > 0xFFFF:
+        sys.exit("payload too large")
+
+    with open(args.output, "wb") as f:
+        f.write(payload)
+
+    print("image   %d bytes" % len(image))
+    print("payload %d bytes (%.1f%%)" % (len(payload),
+                                         100.0 * len(payload) / len(image)))
+    print("identify %s" % identify(image, payload, args.window,
+                                   args.large_block, features).hex())
+
+
+if __name__ == "__main__":
+    main()
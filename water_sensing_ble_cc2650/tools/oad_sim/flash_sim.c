@@ -0,0 +1,303 @@
+/*
+ * External flash model behind the ExtFlash API, backed by a memory mapped
+ * file so the contents can be inspected after a run.
+ *
+ * NOR semantics: erase sets a 4 kB sector to 0xFF, program can only clear
+ * bits and covers at most one 256 byte page per command. Like the TI
+ * driver, every command first waits for the previous program or erase to
+ * finish, so flash time only costs CPU time when the next command comes
+ * too soon.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define FLASH_PAGE_SIZE           256
+#define FLASH_SECTOR_SIZE         EFL_PAGE_SIZE
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+
+// 4 MHz SPI, typical program and erase times of the LaunchPad and
+// SensorTag parts.
+simFlashTiming_t simFlashTiming =
+{
+  20,     // cmdUs
+  2,      // byteUs
+  800,    // pageProgUs
+  40000   // sectorEraseUs
+};
+
+simFlashStats_t simFlashStats;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static uint8_t *flash = NULL;
+static int flashFd = -1;
+static bool flashOpen = false;
+
+// Time the program or erase in progress completes.
+static uint64_t busyUntilUs = 0;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      flashCommand
+ *
+ * @brief   Wait for the flash to be ready and clock out a command.
+ *
+ * @param   len - data bytes transferred with the command
+ *
+ * @return  None.
+ */
+static void flashCommand(size_t len)
+{
+  if (simNowUs < busyUntilUs)
+  {
+    simFlashStats.busyUs += busyUntilUs - simNowUs;
+    simNowUs = busyUntilUs;
+  }
+
+  simNowUs += simFlashTiming.cmdUs + len * simFlashTiming.byteUs;
+}
+
+/*********************************************************************
+ * @fn      flashInRange
+ *
+ * @brief   Check an access against the part size.
+ *
+ * @param   offset - start address
+ * @param   length - bytes
+ *
+ * @return  true if the whole range is on the part.
+ */
+static bool flashInRange(size_t offset, size_t length)
+{
+  if (!flash || !flashOpen || offset > EFL_FLASH_SIZE ||
+      length > EFL_FLASH_SIZE - offset)
+  {
+    fprintf(stderr, "flash: bad access 0x%zx+%zu\n", offset, length);
+    return false;
+  }
+
+  return true;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      SimFlash_map
+ *
+ * @brief   Map the flash file, creating it if needed.
+ *
+ * @param   path - backing file
+ * @param   keep - keep the contents, else start from an erased part
+ *
+ * @return  0 on success, -1 on error.
+ */
+int SimFlash_map(const char *path, bool keep)
+{
+  struct stat st;
+
+  flashFd = open(path, O_RDWR | O_CREAT, 0644);
+  if (flashFd < 0 || fstat(flashFd, &st) < 0)
+  {
+    perror(path);
+    return -1;
+  }
+
+  if (st.st_size != EFL_FLASH_SIZE)
+  {
+    keep = false;
+    if (ftruncate(flashFd, EFL_FLASH_SIZE) < 0)
+    {
+      perror(path);
+      return -1;
+    }
+  }
+
+  flash = mmap(NULL, EFL_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+               flashFd, 0);
+  if (flash == MAP_FAILED)
+  {
+    perror(path);
+    flash = NULL;
+    return -1;
+  }
+
+  if (!keep)
+  {
+    memset(flash, 0xFF, EFL_FLASH_SIZE);
+  }
+
+  return 0;
+}
+
+/*********************************************************************
+ * @fn      SimFlash_unmap
+ *
+ * @brief   Write the flash back to its file and unmap it.
+ *
+ * @return  None.
+ */
+void SimFlash_unmap(void)
+{
+  if (flash)
+  {
+    msync(flash, EFL_FLASH_SIZE, MS_SYNC);
+    munmap(flash, EFL_FLASH_SIZE);
+    flash = NULL;
+  }
+
+  if (flashFd >= 0)
+  {
+    close(flashFd);
+    flashFd = -1;
+  }
+}
+
+/*********************************************************************
+ * @fn      SimFlash_data
+ *
+ * @brief   Direct access to the flash contents, for checking results.
+ *
+ * @return  The mapped part.
+ */
+uint8_t *SimFlash_data(void)
+{
+  return flash;
+}
+
+/*********************************************************************
+ * @fn      SimFlash_resetStats
+ *
+ * @brief   Clear the activity counters and any operation in progress.
+ *
+ * @return  None.
+ */
+void SimFlash_resetStats(void)
+{
+  memset(&simFlashStats, 0, sizeof(simFlashStats));
+  busyUntilUs = 0;
+}
+
+/*********************************************************************
+ * ExtFlash API
+ */
+
+bool ExtFlash_open(void)
+{
+  if (flash)
+  {
+    flashOpen = true;
+  }
+
+  return flashOpen;
+}
+
+void ExtFlash_close(void)
+{
+  flashOpen = false;
+}
+
+bool ExtFlash_read(size_t offset, size_t length, uint8_t *buf)
+{
+  if (!flashInRange(offset, length))
+  {
+    return false;
+  }
+
+  simFlashStats.reads++;
+  flashCommand(length);
+  memcpy(buf, flash + offset, length);
+
+  return true;
+}
+
+bool ExtFlash_write(size_t offset, size_t length, const uint8_t *buf)
+{
+  if (!flashInRange(offset, length))
+  {
+    return false;
+  }
+
+  simFlashStats.writes++;
+
+  // One program command per flash page touched.
+  while (length > 0)
+  {
+    size_t n = FLASH_PAGE_SIZE - (offset % FLASH_PAGE_SIZE);
+    size_t i;
+    bool bitError = false;
+
+    if (n > length)
+    {
+      n = length;
+    }
+
+    flashCommand(n);
+
+    for (i = 0; i < n; i++)
+    {
+      if ((flash[offset + i] & buf[i]) != buf[i])
+      {
+        bitError = true;
+      }
+      flash[offset + i] &= buf[i];
+    }
+
+    if (bitError)
+    {
+      simFlashStats.bitErrors++;
+    }
+
+    simFlashStats.pageProgs++;
+    busyUntilUs = simNowUs + simFlashTiming.pageProgUs;
+
+    offset += n;
+    buf += n;
+    length -= n;
+  }
+
+  return true;
+}
+
+bool ExtFlash_erase(size_t offset, size_t length)
+{
+  size_t first = offset / FLASH_SECTOR_SIZE;
+  size_t last = (offset + length - 1) / FLASH_SECTOR_SIZE;
+  size_t sector;
+
+  if (length == 0 || !flashInRange(offset, length))
+  {
+    return length == 0;
+  }
+
+  for (sector = first; sector <= last; sector++)
+  {
+    flashCommand(0);
+    memset(flash + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+
+    simFlashStats.erases++;
+    busyUntilUs = simNowUs + simFlashTiming.sectorEraseUs;
+  }
+
+  return true;
+}
@@ -0,0 +1,2 @@
+/* Host build of the OAD profile, see sim_stack.h. */
+#include "sim_stack.h"
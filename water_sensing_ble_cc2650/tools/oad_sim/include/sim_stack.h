@@ -0,0 +1,233 @@
+/*
+ * Host stand-ins for the parts of the BLE stack, TI-RTOS and the external
+ * flash driver used by the OAD profile.
+ *
+ * Every stack header PROFILES/oad.c and PROFILES/oad_target_external_flash.c
+ * include resolves, in tools/oad_sim/include, to a one line header pulling
+ * in this file. Only what the OAD sources use is declared; the definitions
+ * are in stack_sim.c and flash_sim.c.
+ */
+#ifndef SIM_STACK_H
+#define SIM_STACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*********************************************************************
+ * TYPES AND MACROS (comdef.h, hal_types.h)
+ */
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint8_t  bStatus_t;
+
+#ifndef TRUE
+#define TRUE                      1
+#define FALSE                     0
+#endif
+
+#define CONST                     const
+#define VOID                      (void)
+
+#define SUCCESS                   0x00
+#define FAILURE                   0x01
+#define MSG_BUFFER_NOT_AVAIL      0x10
+#define bleMemAllocError          0x13
+
+#define INVALID_CONNHANDLE        0xFFFF
+
+#define BUILD_UINT16(lo, hi) \
+  ((uint16_t)(((lo) & 0x00FF) | (((hi) & 0x00FF) << 8)))
+#define HI_UINT16(a)              (((a) >> 8) & 0xFF)
+#define LO_UINT16(a)              ((a) & 0xFF)
+#define BREAK_UINT32(var, byte)   ((uint8_t)(((var) >> ((byte) * 8)) & 0xFF))
+
+/*********************************************************************
+ * ATT / GATT
+ */
+
+#define ATT_BT_UUID_SIZE          2
+#define ATT_UUID_SIZE             16
+
+#define TI_BASE_UUID_128(uuid) \
+  0xF0, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+  0x00, 0x00, 0x00, 0xB0, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+
+#define ATT_ERR_INVALID_HANDLE    0x01
+#define ATT_ERR_ATTR_NOT_LONG     0x0B
+#define ATT_ERR_ATTR_NOT_FOUND    0x0A
+#define ATT_ERR_INVALID_VALUE_SIZE 0x0D
+#define ATT_ERR_INVALID_VALUE     0x80
+
+#define ATT_HANDLE_VALUE_NOTI     0x1B
+#define ATT_WRITE_REQ             0x12
+#define ATT_WRITE_CMD             0x52
+
+#define GATT_PROP_READ            0x02
+#define GATT_PROP_WRITE_NO_RSP    0x04
+#define GATT_PROP_WRITE           0x08
+#define GATT_PROP_NOTIFY          0x10
+
+#define GATT_PERMIT_READ          0x01
+#define GATT_PERMIT_WRITE         0x02
+
+#define GATT_CLIENT_CFG_NOTIFY    0x0001
+#define GATT_CLIENT_CHAR_CFG_UUID 0x2902
+#define GATT_MAX_ENCRYPT_KEY_SIZE 16
+
+typedef struct
+{
+  uint8_t len;
+  const uint8_t *uuid;
+} gattAttrType_t;
+
+typedef struct
+{
+  gattAttrType_t type;
+  uint8_t permissions;
+  uint16_t handle;
+  uint8_t *pValue;
+} gattAttribute_t;
+
+typedef struct
+{
+  uint16_t connHandle;
+  uint8_t value;
+} gattCharCfg_t;
+
+typedef bStatus_t (*pfnGATTReadAttrCB_t)(uint16_t connHandle,
+                                         gattAttribute_t *pAttr,
+                                         uint8_t *pValue, uint16_t *pLen,
+                                         uint16_t offset, uint16_t maxLen,
+                                         uint8_t method);
+typedef bStatus_t (*pfnGATTWriteAttrCB_t)(uint16_t connHandle,
+                                          gattAttribute_t *pAttr,
+                                          uint8_t *pValue, uint16_t len,
+                                          uint16_t offset, uint8_t method);
+typedef bStatus_t (*pfnGATTAuthorizeAttrCB_t)(uint16_t connHandle,
+                                              gattAttribute_t *pAttr,
+                                              uint8_t opcode);
+
+typedef struct
+{
+  pfnGATTReadAttrCB_t pfnReadAttrCB;
+  pfnGATTWriteAttrCB_t pfnWriteAttrCB;
+  pfnGATTAuthorizeAttrCB_t pfnAuthorizeAttrCB;
+} gattServiceCBs_t;
+
+typedef struct
+{
+  uint16_t handle;
+  uint16_t len;
+  uint8_t *pValue;
+} attHandleValueNoti_t;
+
+typedef union
+{
+  attHandleValueNoti_t handleValueNoti;
+} gattMsg_t;
+
+#define GATT_NUM_ATTRS(attrs)     ((uint16_t)(sizeof(attrs) / sizeof(attrs[0])))
+
+extern const uint8_t primaryServiceUUID[];
+extern const uint8_t characterUUID[];
+extern const uint8_t clientCharCfgUUID[];
+extern const uint8_t charUserDescUUID[];
+
+extern uint8_t linkDBNumConns;
+
+extern uint16_t ATT_GetMTU(uint16_t connHandle);
+
+extern void *GATT_bm_alloc(uint16_t connHandle, uint8_t opcode, uint16_t size,
+                           uint16_t *pSizeAlloc);
+extern void GATT_bm_free(gattMsg_t *pMsg, uint8_t opcode);
+extern bStatus_t GATT_Notification(uint16_t connHandle,
+                                   attHandleValueNoti_t *pNoti,
+                                   uint8_t authenticated);
+
+extern bStatus_t GATTServApp_RegisterService(gattAttribute_t *pAttrs,
+                                             uint16_t numAttrs,
+                                             uint8_t encKeySize,
+                                             CONST gattServiceCBs_t *pCBs);
+extern void GATTServApp_InitCharCfg(uint16_t connHandle,
+                                    gattCharCfg_t *charCfgTbl);
+extern uint16_t GATTServApp_ReadCharCfg(uint16_t connHandle,
+                                        gattCharCfg_t *charCfgTbl);
+extern bStatus_t GATTServApp_ProcessCCCWriteReq(uint16_t connHandle,
+                                                gattAttribute_t *pAttr,
+                                                uint8_t *pValue, uint16_t len,
+                                                uint16_t offset,
+                                                uint16_t validCfg);
+extern gattAttribute_t *GATTServApp_FindAttr(gattAttribute_t *pAttrTbl,
+                                             uint16_t numAttrs,
+                                             uint8_t *pValue);
+
+/*********************************************************************
+ * OSAL / ICALL / HAL
+ */
+
+#define BLE_NVID_CUST_START       0x80
+
+extern uint8_t osal_snv_read(uint8_t id, uint8_t len, void *pBuf);
+extern uint8_t osal_snv_write(uint8_t id, uint8_t len, void *pBuf);
+
+extern void *ICall_malloc(uint32_t size);
+extern void ICall_free(void *msg);
+
+#define HAL_FLASH_PAGE_SIZE       4096
+#define HAL_FLASH_WORD_SIZE       4
+
+extern void simSystemReset(void);
+#define HAL_SYSTEM_RESET()        simSystemReset()
+
+// Internal flash, holding the running image a delta is applied to.
+extern uint8_t simIntFlash[];
+#define INT_FLASH_BASE            ((uintptr_t)simIntFlash)
+
+/*********************************************************************
+ * TI-RTOS
+ */
+
+typedef struct Queue_Elem
+{
+  struct Queue_Elem *next;
+  struct Queue_Elem *prev;
+} Queue_Elem;
+
+/*********************************************************************
+ * EXTERNAL FLASH (ExtFlash.h, ext_flash_layout.h)
+ */
+
+extern bool ExtFlash_open(void);
+extern void ExtFlash_close(void);
+extern bool ExtFlash_read(size_t offset, size_t length, uint8_t *buf);
+extern bool ExtFlash_write(size_t offset, size_t length, const uint8_t *buf);
+extern bool ExtFlash_erase(size_t offset, size_t length);
+
+typedef struct
+{
+  uint16_t crc[2];
+  uint16_t ver;
+  uint16_t len;
+  uint8_t  uid[4];
+  uint16_t addr;
+  uint8_t  imgType;
+  uint8_t  status;
+} ExtImageInfo_t;
+
+#define EFL_OAD_IMG_TYPE_APP      1
+#define EFL_OAD_IMG_TYPE_STACK    2
+#define EFL_OAD_IMG_TYPE_NP       3
+
+#define EFL_IMAGE_INFO_ADDR_APP   0x0000
+#define EFL_IMAGE_INFO_ADDR_BLE   0x1000
+#define EFL_ADDR_IMAGE_APP        0x20000
+#define EFL_ADDR_IMAGE_BLE        0x40000
+#define EFL_SIZE_IMAGE_APP        0x20000
+#define EFL_OAD_ADDR_RESOLUTION   4
+#define EFL_PAGE_SIZE             0x1000
+#define EFL_FLASH_SIZE            0x100000
+
+#endif /* SIM_STACK_H */
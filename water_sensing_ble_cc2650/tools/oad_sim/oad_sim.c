@@ -0,0 +1,1200 @@
+/*
+ * Host simulator for the OAD profile.
+ *
+ * Runs PROFILES/oad.c, oad_target_external_flash.c and oad_codec.c
+ * unchanged on Linux against a file backed external flash model
+ * (flash_sim.c) and stand-ins for the GATT server (stack_sim.c), driven by
+ * a scripted OAD manager. Full image transfers can be run lock-step,
+ * windowed, with large blocks and with compressed or delta payloads, with
+ * blocks dropped, corrupted or cut short and the link lost part way
+ * through.
+ *
+ * Connection model: the central writes up to --pkts blocks per connection
+ * event, --interval apart. Notifications sent while an event is processed
+ * reach the central on the next event. When the node is held up by the
+ * flash, the events it missed are skipped.
+ *
+ * Build, from water_sensing_ble_cc2650:
+ *   cc -O2 -Wall -DFEATURE_OAD -Itools/oad_sim -Itools/oad_sim/include \
+ *      -IPROFILES -o oad_sim tools/oad_sim/oad_sim.c \
+ *      tools/oad_sim/flash_sim.c tools/oad_sim/stack_sim.c PROFILES/oad.c \
+ *      PROFILES/oad_codec.c PROFILES/oad_target_external_flash.c
+ *
+ * Usage:
+ *   oad_sim [options] [image.bin]      one transfer
+ *   oad_sim --bench [options] [image]  transfer time by block size, window
+ *   oad_sim --selftest                 run the built in scenarios
+ *
+ * Without an image a test image of --size bytes is made up. --compressed
+ * and --delta encode the image here unless --payload gives the output of
+ * tools/oad_pack.py. A delta is applied against --base, or against a made
+ * up image the test image is a patched copy of.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "oad_target.h"
+#include "oad_codec.h"
+#include "oad.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Status values notified by oad.c.
+#define STATUS_NONE               -1
+#define STATUS_REJECTED           -2
+#define STATUS_SUCCESS            0
+#define STATUS_CRC_ERR            1
+
+// Events without a notification before the central asks again.
+#define TIMEOUT_EVENTS            8
+
+// Give up on a transfer after this many connection events.
+#define MAX_EVENTS                1000000
+
+// Time to get the link back after a disconnect.
+#define RECONNECT_US              1000000
+
+// Image identify: CRC and CRC shadow, then the image header.
+#define IMG_ID_SIZE               (OAD_IMG_HDR_OSET + sizeof(img_hdr_t))
+
+// Where the running image sits in internal flash.
+#define APP_IMAGE_START           0x1000
+
+#define DEFAULT_IMAGE_SIZE        0x10000
+#define DEFAULT_FLASH_FILE        "oad_sim.flash"
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+  uint16_t mtu;
+  uint8_t  window;        // 0 for the lock-step transfer
+  bool     largeBlock;
+  uint8_t  codec;         // OAD_FEATURE_COMPRESSED, _DELTA or 0
+  uint32_t intervalUs;
+  uint8_t  pkts;          // Block writes per connection event
+  double   drop;          // Probability a block write is lost
+  double   corrupt;       // Probability a block arrives with a bit flipped
+  double   truncate;      // Probability a block write is a byte short
+  uint32_t disconnectAt;  // Block writes before the link drops, 0 for never
+  uint32_t seed;
+  bool     keep;          // Do not erase the flash first
+  bool     verbose;
+} simCfg_t;
+
+typedef struct
+{
+  int      status;
+  bool     imageOk;
+  uint16_t blkSize;
+  uint8_t  window;
+  uint32_t events;
+  uint64_t timeUs;
+  uint32_t writes;
+  uint32_t polls;
+  uint32_t dropped;
+  uint32_t corrupted;
+  uint32_t truncated;
+  uint32_t rejected;      // Block writes the node refused
+  uint32_t resumedAt;
+  simFlashStats_t flash;
+} simResult_t;
+
+typedef struct
+{
+  uint8_t  *data;
+  uint32_t len;
+} buf_t;
+
+// OAD manager state.
+typedef struct
+{
+  const simCfg_t *cfg;
+  const buf_t *payload;
+  simResult_t *res;
+
+  uint16_t blkHandle;
+  uint16_t idHandle;
+  uint16_t statusHandle;
+
+  uint16_t blkSize;
+  uint8_t  window;
+  uint32_t blkTot;
+  uint32_t base;          // First block not acknowledged
+  uint8_t  *acked;
+  uint32_t *sentAt;       // Event a block was last sent in, plus one
+
+  bool     windowed;      // Acknowledges seen
+  bool     reqPending;    // Lock-step request to answer
+  uint32_t reqBlk;
+  bool     reconnected;
+  uint32_t idle;
+} central_t;
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+
+uint64_t simNowUs = 0;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static const char *statusNames[] =
+{
+  "success", "CRC error", "flash error", "buffer overflow"
+};
+
+static uint32_t rngState = 1;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint32_t rnd(void)
+{
+  // xorshift32
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static bool chance(double p)
+{
+  return p > 0 && (rnd() % 1000000) < p * 1000000;
+}
+
+static uint16_t crc16(uint16_t crc, const uint8_t *p, uint32_t len)
+{
+  while (len--)
+  {
+    uint8_t i;
+
+    crc ^= (uint16_t)*p++ << 8;
+    for (i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+static const char *statusName(int status)
+{
+  if (status == STATUS_NONE)
+  {
+    return "stalled";
+  }
+  if (status == STATUS_REJECTED)
+  {
+    return "image rejected";
+  }
+  if (status >= 0 && status < (int)(sizeof(statusNames) / sizeof(char *)))
+  {
+    return statusNames[status];
+  }
+  return "unknown status";
+}
+
+/*********************************************************************
+ * Images and payloads
+ */
+
+static void bufAlloc(buf_t *b, uint32_t len)
+{
+  b->data = malloc(len ? len : 1);
+  b->len = len;
+  if (!b->data)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+}
+
+static int bufRead(buf_t *b, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  long len;
+
+  if (!f || fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0)
+  {
+    perror(path);
+    return -1;
+  }
+
+  rewind(f);
+  bufAlloc(b, len);
+  if (fread(b->data, 1, len, f) != (size_t)len)
+  {
+    perror(path);
+    fclose(f);
+    return -1;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+// Fill in the image header and CRC of an application image.
+static void imageSeal(buf_t *img)
+{
+  uint16_t words = img->len / HAL_FLASH_WORD_SIZE;
+  uint16_t crc;
+
+  img->data[2] = 0xFF;
+  img->data[3] = 0xFF;
+  img->data[4] = 0x00;                  // ver
+  img->data[5] = 0x00;
+  img->data[6] = LO_UINT16(words);      // len
+  img->data[7] = HI_UINT16(words);
+  memcpy(&img->data[8], "SIM0", 4);     // uid
+  img->data[12] = LO_UINT16(APP_IMAGE_START / EFL_OAD_ADDR_RESOLUTION);
+  img->data[13] = HI_UINT16(APP_IMAGE_START / EFL_OAD_ADDR_RESOLUTION);
+  img->data[14] = EFL_OAD_IMG_TYPE_APP;
+  img->data[15] = 0xFF;
+
+  crc = crc16(0, img->data + 4, img->len - 4);
+  img->data[0] = LO_UINT16(crc);
+  img->data[1] = HI_UINT16(crc);
+}
+
+// Made up image, roughly as compressible as code: short random runs mixed
+// with repeats of earlier bytes.
+static void imageMake(buf_t *img, uint32_t len)
+{
+  uint32_t pos = 16;
+
+  bufAlloc(img, len);
+
+  while (pos < len)
+  {
+    uint32_t n = 1 + rnd() % 24;
+
+    if (n > len - pos)
+    {
+      n = len - pos;
+    }
+
+    if (pos > 512 && rnd() % 3)
+    {
+      uint32_t from = pos - 1 - rnd() % 400;
+
+      while (n--)
+      {
+        img->data[pos++] = img->data[from++];
+      }
+    }
+    else
+    {
+      while (n--)
+      {
+        img->data[pos++] = rnd();
+      }
+    }
+  }
+
+  imageSeal(img);
+}
+
+// The next release of an image: a few bytes patched, a run inserted and a
+// run dropped, so most of it moves.
+static void imagePatch(buf_t *img, const buf_t *base)
+{
+  uint32_t cut = base->len / 3;
+  uint32_t i;
+
+  bufAlloc(img, base->len);
+  memcpy(img->data, base->data, cut);
+  for (i = 0; i < 64; i++)
+  {
+    img->data[cut + i] = rnd();
+  }
+  memcpy(img->data + cut + 64, base->data + cut, base->len - cut - 64);
+
+  for (i = 0; i < base->len / 2000; i++)
+  {
+    img->data[16 + rnd() % (base->len - 16)] = rnd();
+  }
+
+  imageSeal(img);
+}
+
+static void payloadPad(buf_t *out, uint32_t len)
+{
+  while (len % HAL_FLASH_WORD_SIZE)
+  {
+    out->data[len++] = 0xFF;
+  }
+  out->len = len;
+}
+
+// Greedy LZSS in the format of oad_codec.h.
+static void lzssEncode(buf_t *out, const buf_t *in)
+{
+  uint32_t pos = 0;
+  uint32_t len = 0;
+  uint32_t flagsAt = 0;
+  uint8_t items = 8;
+
+  bufAlloc(out, in->len + in->len / 8 + 8);
+
+  while (pos < in->len)
+  {
+    uint32_t best = 0;
+    uint32_t dist = 0;
+    uint32_t d;
+
+    for (d = 1; d <= OAD_LZ_WINDOW_SIZE && d <= pos; d++)
+    {
+      uint32_t n = 0;
+
+      while (n < OAD_LZ_MIN_MATCH + 255 && pos + n < in->len &&
+             in->data[pos - d + n] == in->data[pos + n])
+      {
+        n++;
+      }
+      if (n > best)
+      {
+        best = n;
+        dist = d;
+      }
+    }
+
+    if (items == 8)
+    {
+      flagsAt = len++;
+      out->data[flagsAt] = 0;
+      items = 0;
+    }
+
+    if (best >= OAD_LZ_MIN_MATCH)
+    {
+      out->data[len++] = dist - 1;
+      out->data[len++] = best - OAD_LZ_MIN_MATCH;
+      pos += best;
+    }
+    else
+    {
+      out->data[flagsAt] |= 1 << items;
+      out->data[len++] = in->data[pos++];
+    }
+    items++;
+  }
+
+  payloadPad(out, len);
+}
+
+// Delta in the format of oad_codec.h, copying only what stayed in place.
+static void deltaEncode(buf_t *out, const buf_t *in, const buf_t *base)
+{
+  uint32_t pos = 0;
+  uint32_t len = 0;
+  uint32_t ins = UINT32_MAX;   // Insert op being filled, if any
+
+  bufAlloc(out, in->len + in->len / 64 + 8);
+
+  while (pos < in->len)
+  {
+    uint32_t n = 0;
+
+    while (pos + n < base->len && pos + n < in->len && n < 0x10000 &&
+           in->data[pos + n] == base->data[pos + n])
+    {
+      n++;
+    }
+
+    if (n >= 8)
+    {
+      out->data[len++] = OAD_DELTA_OP_COPY;
+      out->data[len++] = pos;
+      out->data[len++] = pos >> 8;
+      out->data[len++] = pos >> 16;
+      out->data[len++] = (n - 1);
+      out->data[len++] = (n - 1) >> 8;
+      pos += n;
+      ins = UINT32_MAX;
+    }
+    else
+    {
+      if (ins == UINT32_MAX)
+      {
+        ins = len++;
+        out->data[ins] = 0xFF;
+      }
+      out->data[len++] = in->data[pos++];
+      if (++out->data[ins] == 127)
+      {
+        ins = UINT32_MAX;
+      }
+    }
+  }
+
+  payloadPad(out, len);
+}
+
+/*********************************************************************
+ * OAD manager
+ */
+
+static void simOadWriteCB(uint8_t event, uint16_t connHandle, uint8_t *pData,
+                          uint16_t len)
+{
+  // The application copies the len bytes into its queue and processes them
+  // in its task, here they run at once on such a copy. A read past the
+  // write shows up under a memory checker.
+  uint8_t *pCopy = NULL;
+
+  if (pData != NULL)
+  {
+    pCopy = malloc(len);
+    memcpy(pCopy, pData, len);
+  }
+
+  switch (event)
+  {
+    case OAD_WRITE_IDENTIFY_REQ:
+      OAD_imgIdentifyWrite(connHandle, pCopy);
+      break;
+
+    case OAD_WRITE_BLOCK_REQ:
+      OAD_imgBlockWrite(connHandle, pCopy);
+      break;
+
+    default:
+      break;
+  }
+
+  free(pCopy);
+}
+
+static oadTargetCBs_t simOadCBs =
+{
+  simOadWriteCB
+};
+
+static void centralConnect(central_t *c, const buf_t *image)
+{
+  static const uint16_t notified[] =
+  {
+    OAD_IMG_IDENTIFY_UUID, OAD_IMG_BLOCK_UUID, OAD_IMG_STATUS_UUID
+  };
+  uint8_t enable[2] = { LO_UINT16(GATT_CLIENT_CFG_NOTIFY),
+                        HI_UINT16(GATT_CLIENT_CFG_NOTIFY) };
+  uint8_t count = 1;
+  uint8_t id[OAD_IMG_ID_EXT_SIZE];
+  uint16_t idLen = IMG_ID_SIZE;
+  uint8_t features = c->cfg->codec;
+  uint32_t words = c->payload->len / HAL_FLASH_WORD_SIZE;
+  uint8_t i;
+
+  for (i = 0; i < sizeof(notified) / sizeof(notified[0]); i++)
+  {
+    SimStack_write(SimStack_findCCC(notified[i]), enable, sizeof(enable));
+  }
+
+  // One image per reset. The node is not really reset between transfers,
+  // so the count left from the last one is set again.
+  SimStack_write(SimStack_findChar(OAD_IMG_COUNT_UUID), &count, 1);
+
+  c->blkSize = OAD_BLOCK_SIZE;
+  c->window = 0;
+  c->base = 0;
+  c->windowed = false;
+  c->reqPending = false;
+  c->idle = 0;
+  memset(c->acked, 0, c->payload->len / OAD_BLOCK_SIZE + 1);
+  memset(c->sentAt, 0,
+         (c->payload->len / OAD_BLOCK_SIZE + 1) * sizeof(uint32_t));
+
+  memcpy(id, image->data, IMG_ID_SIZE);
+  if (c->cfg->window)
+  {
+    features |= OAD_FEATURE_WINDOW;
+  }
+  if (c->cfg->largeBlock)
+  {
+    features |= OAD_FEATURE_LARGE_BLOCK;
+  }
+  if (features)
+  {
+    id[OAD_IMG_ID_FEATURES] = features;
+    id[OAD_IMG_ID_WINDOW] = c->cfg->window;
+    id[OAD_IMG_ID_PAYLOAD_LEN] = LO_UINT16(words);
+    id[OAD_IMG_ID_PAYLOAD_LEN + 1] = HI_UINT16(words);
+    idLen = OAD_IMG_ID_EXT_SIZE;
+  }
+
+  SimStack_write(SimStack_findChar(OAD_IMG_IDENTIFY_UUID), id, idLen);
+}
+
+static void centralNoti(central_t *c, simNoti_t *n, uint32_t ev)
+{
+  uint32_t next;
+  uint32_t map;
+  uint32_t b;
+
+  if (c->cfg->verbose)
+  {
+    printf("  ev %u noti 0x%04x:", ev, n->handle);
+    for (b = 0; b < n->len; b++)
+    {
+      printf(" %02x", n->data[b]);
+    }
+    printf("\n");
+  }
+
+  if (n->handle == c->statusHandle)
+  {
+    c->res->status = n->data[0];
+    return;
+  }
+
+  if (n->handle == c->idHandle)
+  {
+    c->res->status = STATUS_REJECTED;
+    return;
+  }
+
+  if (n->handle != c->blkHandle)
+  {
+    return;
+  }
+
+  next = BUILD_UINT16(n->data[0], n->data[1]);
+
+  if (c->reconnected)
+  {
+    c->res->resumedAt = next;
+    c->reconnected = false;
+  }
+
+  if (n->len < OAD_BLK_ACK_SIZE)
+  {
+    // Lock-step block request.
+    c->reqBlk = next;
+    c->reqPending = true;
+    return;
+  }
+
+  // Windowed acknowledge.
+  c->window = n->data[2];
+  c->blkSize = BUILD_UINT16(n->data[7], n->data[8]);
+  c->blkTot = (c->payload->len + c->blkSize - 1) / c->blkSize;
+  c->windowed = true;
+
+  for (b = c->base; b < next && b < c->blkTot; b++)
+  {
+    c->acked[b] = 1;
+  }
+  c->base = next;
+
+  map = (uint32_t)n->data[3] | ((uint32_t)n->data[4] << 8) |
+        ((uint32_t)n->data[5] << 16) | ((uint32_t)n->data[6] << 24);
+
+  for (b = 0; b < 32 && next + b < c->blkTot; b++)
+  {
+    if (map & ((uint32_t)1 << b))
+    {
+      c->acked[next + b] = 1;
+    }
+    // Sent two events ago or earlier and still missing: lost.
+    else if (c->sentAt[next + b] && c->sentAt[next + b] < ev)
+    {
+      c->sentAt[next + b] = 0;
+    }
+  }
+}
+
+static void centralSend(central_t *c, uint32_t blkNum, uint32_t ev)
+{
+  uint8_t buf[2 + OAD_BLOCK_SIZE_MAX];
+  uint32_t offset = blkNum * c->blkSize;
+  uint16_t len = c->blkSize;
+
+  if (len > c->payload->len - offset)
+  {
+    len = c->payload->len - offset;
+  }
+
+  buf[0] = LO_UINT16(blkNum);
+  buf[1] = HI_UINT16(blkNum);
+  memcpy(buf + 2, c->payload->data + offset, len);
+
+  c->sentAt[blkNum] = ev + 1;
+  c->res->writes++;
+
+  if (chance(c->cfg->drop))
+  {
+    c->res->dropped++;
+    return;
+  }
+
+  if (chance(c->cfg->corrupt))
+  {
+    buf[2 + rnd() % len] ^= 1 << (rnd() % 8);
+    c->res->corrupted++;
+  }
+
+  if (chance(c->cfg->truncate))
+  {
+    len--;
+    c->res->truncated++;
+  }
+
+  if (SimStack_write(SimStack_findChar(OAD_IMG_BLOCK_UUID), buf, 2 + len) ==
+      ATT_ERR_INVALID_VALUE_SIZE)
+  {
+    c->res->rejected++;
+  }
+}
+
+static bool centralNextBlock(central_t *c, uint32_t *pBlkNum)
+{
+  uint32_t b;
+
+  if (!c->windowed)
+  {
+    if (c->reqPending)
+    {
+      c->reqPending = false;
+      *pBlkNum = c->reqBlk;
+      return true;
+    }
+    return false;
+  }
+
+  for (b = c->base; b < c->base + c->window && b < c->blkTot; b++)
+  {
+    if (!c->acked[b] && !c->sentAt[b])
+    {
+      *pBlkNum = b;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void centralPoll(central_t *c)
+{
+  uint8_t buf[2] = { LO_UINT16(OAD_BLK_ACK_REQ), HI_UINT16(OAD_BLK_ACK_REQ) };
+
+  c->res->polls++;
+  SimStack_write(SimStack_findChar(OAD_IMG_BLOCK_UUID), buf, sizeof(buf));
+}
+
+/*********************************************************************
+ * @fn      runTransfer
+ *
+ * @brief   Download an image to the simulated node.
+ *
+ * @param   cfg     - link and fault settings
+ * @param   image   - image the node should end up with
+ * @param   payload - bytes sent, the image unless encoded
+ * @param   res     - result
+ *
+ * @return  None.
+ */
+static void runTransfer(const simCfg_t *cfg, const buf_t *image,
+                        const buf_t *payload, simResult_t *res)
+{
+  central_t c;
+  simNoti_t n;
+  uint32_t ev;
+  uint8_t *flash;
+
+  memset(res, 0, sizeof(*res));
+  res->status = STATUS_NONE;
+
+  memset(&c, 0, sizeof(c));
+  c.cfg = cfg;
+  c.payload = payload;
+  c.res = res;
+  c.idHandle = SimStack_findChar(OAD_IMG_IDENTIFY_UUID)->handle;
+  c.blkHandle = SimStack_findChar(OAD_IMG_BLOCK_UUID)->handle;
+  c.statusHandle = SimStack_findChar(OAD_IMG_STATUS_UUID)->handle;
+  c.acked = calloc(payload->len / OAD_BLOCK_SIZE + 1, 1);
+  c.sentAt = calloc(payload->len / OAD_BLOCK_SIZE + 1, sizeof(uint32_t));
+
+  flash = SimFlash_data();
+  if (!cfg->keep)
+  {
+    memset(flash, 0xFF, EFL_FLASH_SIZE);
+  }
+  SimStack_clearSnv();
+  SimStack_flushNoti();
+  SimFlash_resetStats();
+  rngState = cfg->seed ? cfg->seed : 1;
+  simNowUs = 0;
+  simResets = 0;
+  simMtu = cfg->mtu;
+
+  centralConnect(&c, image);
+
+  for (ev = 0; ev < MAX_EVENTS && res->status == STATUS_NONE; ev++)
+  {
+    uint64_t nextUs = simNowUs + cfg->intervalUs;
+    bool heard = false;
+    uint32_t blkNum;
+    uint8_t sent = 0;
+
+    while (SimStack_getNoti(&n))
+    {
+      centralNoti(&c, &n, ev);
+      heard = true;
+    }
+
+    if (res->status != STATUS_NONE)
+    {
+      break;
+    }
+
+    while (sent < cfg->pkts && centralNextBlock(&c, &blkNum))
+    {
+      centralSend(&c, blkNum, ev);
+      sent++;
+
+      if (cfg->disconnectAt && res->writes == cfg->disconnectAt)
+      {
+        // Link lost: whatever the node had queued is gone.
+        SimStack_flushNoti();
+        simNowUs += RECONNECT_US;
+        nextUs = simNowUs + cfg->intervalUs;
+        c.reconnected = true;
+        centralConnect(&c, image);
+        break;
+      }
+    }
+
+    // Nothing heard for a while: ask again.
+    if (heard || sent)
+    {
+      c.idle = 0;
+    }
+    else if (++c.idle >= TIMEOUT_EVENTS)
+    {
+      c.idle = 0;
+      if (c.windowed)
+      {
+        centralPoll(&c);
+      }
+      else if (res->writes)
+      {
+        c.reqPending = true;
+      }
+    }
+
+    // Events the node was too busy for are missed.
+    while (nextUs < simNowUs)
+    {
+      nextUs += cfg->intervalUs;
+    }
+    simNowUs = nextUs;
+  }
+
+  res->events = ev;
+  res->timeUs = simNowUs;
+  res->blkSize = c.blkSize;
+  res->window = c.window;
+  res->flash = simFlashStats;
+
+  if (res->status == STATUS_SUCCESS)
+  {
+    const ExtImageInfo_t *pInfo =
+      (const ExtImageInfo_t *)(flash + EFL_IMAGE_INFO_ADDR_APP);
+
+    res->imageOk = !memcmp(flash + EFL_ADDR_IMAGE_APP, image->data,
+                           image->len) &&
+                   pInfo->crc[0] == BUILD_UINT16(image->data[0],
+                                                 image->data[1]) &&
+                   pInfo->crc[1] == pInfo->crc[0] &&
+                   simResets > 0 && res->flash.bitErrors == 0;
+  }
+
+  free(c.acked);
+  free(c.sentAt);
+}
+
+static void printResult(const simCfg_t *cfg, const simResult_t *res,
+                        uint32_t imageLen)
+{
+  double secs = res->timeUs / 1e6;
+
+  printf("status      %s%s\n", statusName(res->status),
+         res->status == STATUS_SUCCESS ?
+         (res->imageOk ? ", image verified" : ", IMAGE MISMATCH") : "");
+  printf("transfer    %s, block %u, window %u, mtu %u\n",
+         res->window ? "windowed" : "lock-step", res->blkSize, res->window,
+         cfg->mtu);
+  printf("time        %.2f s, %u events, %.2f kB/s\n", secs, res->events,
+         secs > 0 ? imageLen / 1024.0 / secs : 0);
+  printf("writes      %u (%u dropped, %u corrupted, %u short), %u polls\n",
+         res->writes, res->dropped, res->corrupted, res->truncated,
+         res->polls);
+  if (res->rejected)
+  {
+    printf("rejected    %u writes\n", res->rejected);
+  }
+  if (cfg->disconnectAt)
+  {
+    printf("resumed at  block %u\n", res->resumedAt);
+  }
+  printf("flash       %u writes, %u page programs, %u erases, %u reads\n",
+         res->flash.writes, res->flash.pageProgs, res->flash.erases,
+         res->flash.reads);
+  printf("flash wait  %.1f ms, %u bit errors\n", res->flash.busyUs / 1e3,
+         res->flash.bitErrors);
+}
+
+static void runBench(const simCfg_t *base, const buf_t *image,
+                     const buf_t *payload)
+{
+  static const uint16_t mtus[] = { 23, 69, 135, 247 };
+  static const uint8_t windows[] = { 1, 4, 8, 16, 32 };
+  simCfg_t cfg = *base;
+  simResult_t res;
+  uint8_t i;
+  uint8_t j;
+
+  printf("image %u bytes, payload %u bytes, interval %.2f ms, "
+         "%u writes per event\n\n", image->len, payload->len,
+         cfg.intervalUs / 1e3, cfg.pkts);
+  printf("  mtu  block  window     time     kB/s  events  progs  "
+         "wait ms  status\n");
+
+  for (i = 0; i < sizeof(mtus) / sizeof(mtus[0]); i++)
+  {
+    for (j = 0; j <= sizeof(windows) / sizeof(windows[0]); j++)
+    {
+      // Each MTU starts with the lock-step transfer for comparison.
+      cfg.mtu = mtus[i];
+      cfg.window = j ? windows[j - 1] : 0;
+      cfg.largeBlock = j != 0;
+
+      if (!j && i)
+      {
+        continue;
+      }
+
+      runTransfer(&cfg, image, payload, &res);
+
+      printf("  %3u  %5u  %6u  %7.2f  %7.2f  %6u  %5u  %7.1f  %s\n",
+             cfg.mtu, res.blkSize, res.window, res.timeUs / 1e6,
+             image->len / 1024.0 / (res.timeUs / 1e6), res.events,
+             res.flash.pageProgs, res.flash.busyUs / 1e3,
+             res.status == STATUS_SUCCESS && res.imageOk ? "ok" :
+             statusName(res.status));
+    }
+  }
+}
+
+static int runSelftest(const simCfg_t *base)
+{
+  struct
+  {
+    const char *name;
+    uint16_t mtu;
+    uint8_t  window;
+    bool     largeBlock;
+    uint8_t  codec;
+    double   drop;
+    double   corrupt;
+    double   truncate;
+    uint32_t disconnectAt;
+    int      expect;
+  } tests[] =
+  {
+    { "lock-step",              23,  0, false, 0, 0,    0,    0,    0,    0 },
+    { "lock-step, drops",       23,  0, false, 0, 0.05, 0,    0,    0,    0 },
+    { "windowed",               23,  8, false, 0, 0,    0,    0,    0,    0 },
+    { "large block",            247, 1, true,  0, 0,    0,    0,    0,    0 },
+    { "large block, window",    247, 16, true, 0, 0,    0,    0,    0,    0 },
+    { "windowed, drops",        135, 16, true, 0, 0.05, 0,    0,    0,    0 },
+    { "short writes",           135, 16, true, 0, 0,    0,    0.05, 0,    0 },
+    { "resume",                 23,  8, false, 0, 0,    0,    0,    1500, 0 },
+    { "resume, lock-step",      23,  0, false, 0, 0,    0,    0,    1500, 0 },
+    { "corrupt block",          23,  8, false, 0, 0,    0.01, 0,    0,    1 },
+    { "compressed",             135, 8, true,
+      OAD_FEATURE_COMPRESSED,         0,    0,    0,    0,    0 },
+    { "compressed, drops",      135, 8, true,
+      OAD_FEATURE_COMPRESSED,         0.05, 0,    0,    0,    0 },
+    { "delta",                  247, 8, true,
+      OAD_FEATURE_DELTA,              0,    0,    0,    0,    0 },
+  };
+  buf_t running;
+  buf_t image;
+  buf_t lz;
+  buf_t delta;
+  int failed = 0;
+  uint8_t i;
+
+  rngState = 1;
+  imageMake(&running, DEFAULT_IMAGE_SIZE);
+  imagePatch(&image, &running);
+  lzssEncode(&lz, &image);
+  deltaEncode(&delta, &image, &running);
+  memcpy(simIntFlash + APP_IMAGE_START, running.data, running.len);
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+  {
+    simCfg_t cfg = *base;
+    simResult_t res;
+    const buf_t *payload = &image;
+    bool pass;
+
+    cfg.mtu = tests[i].mtu;
+    cfg.window = tests[i].window;
+    cfg.largeBlock = tests[i].largeBlock;
+    cfg.codec = tests[i].codec;
+    cfg.drop = tests[i].drop;
+    cfg.corrupt = tests[i].corrupt;
+    cfg.truncate = tests[i].truncate;
+    cfg.disconnectAt = tests[i].disconnectAt;
+
+    if (cfg.codec == OAD_FEATURE_COMPRESSED)
+    {
+      payload = &lz;
+    }
+    else if (cfg.codec == OAD_FEATURE_DELTA)
+    {
+      payload = &delta;
+    }
+
+    runTransfer(&cfg, &image, payload, &res);
+
+    pass = res.status == tests[i].expect &&
+           (res.status != STATUS_SUCCESS || res.imageOk) &&
+           (!cfg.disconnectAt || res.resumedAt > 0) &&
+           res.rejected == res.truncated;
+    failed += !pass;
+
+    printf("%-4s %-22s %-16s %7.2f s  %6u writes\n", pass ? "ok" : "FAIL",
+           tests[i].name, statusName(res.status), res.timeUs / 1e6,
+           res.writes);
+  }
+
+  printf("%d of %u failed\n", failed, (unsigned)(sizeof(tests) /
+                                                  sizeof(tests[0])));
+
+  return failed ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+    "usage: %s [options] [image.bin]\n"
+    "  -m, --mtu N          ATT MTU (23)\n"
+    "  -w, --window N       windowed transfer, N blocks outstanding\n"
+    "  -l, --large-block    block size from the MTU\n"
+    "  -i, --interval MS    connection interval (15)\n"
+    "  -p, --pkts N         block writes per connection event (4)\n"
+    "      --compressed     send the image LZSS compressed\n"
+    "      --delta          send the image as a delta\n"
+    "      --payload FILE   encoded payload from oad_pack.py\n"
+    "      --base FILE      running image the delta applies to\n"
+    "      --size N         size of the made up image (65536)\n"
+    "      --drop P         probability a block write is lost\n"
+    "      --corrupt P      probability a block has a bit flipped\n"
+    "      --truncate P     probability a block write is a byte short\n"
+    "      --disconnect N   drop the link after N block writes\n"
+    "      --seed N         random seed\n"
+    "      --flash FILE     flash backing file (" DEFAULT_FLASH_FILE ")\n"
+    "      --keep           keep the flash contents\n"
+    "  -v, --verbose        print notifications\n"
+    "      --bench          transfer time by block size and window\n"
+    "      --selftest       run the built in scenarios\n", prog);
+  exit(2);
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+int main(int argc, char **argv)
+{
+  enum
+  {
+    OPT_COMPRESSED = 256, OPT_DELTA, OPT_PAYLOAD, OPT_BASE, OPT_SIZE,
+    OPT_DROP, OPT_CORRUPT, OPT_TRUNCATE, OPT_DISCONNECT, OPT_SEED, OPT_FLASH, OPT_KEEP,
+    OPT_BENCH, OPT_SELFTEST
+  };
+  static const struct option opts[] =
+  {
+    { "mtu",         required_argument, NULL, 'm' },
+    { "window",      required_argument, NULL, 'w' },
+    { "large-block", no_argument,       NULL, 'l' },
+    { "interval",    required_argument, NULL, 'i' },
+    { "pkts",        required_argument, NULL, 'p' },
+    { "verbose",     no_argument,       NULL, 'v' },
+    { "compressed",  no_argument,       NULL, OPT_COMPRESSED },
+    { "delta",       no_argument,       NULL, OPT_DELTA },
+    { "payload",     required_argument, NULL, OPT_PAYLOAD },
+    { "base",        required_argument, NULL, OPT_BASE },
+    { "size",        required_argument, NULL, OPT_SIZE },
+    { "drop",        required_argument, NULL, OPT_DROP },
+    { "corrupt",     required_argument, NULL, OPT_CORRUPT },
+    { "truncate",    required_argument, NULL, OPT_TRUNCATE },
+    { "disconnect",  required_argument, NULL, OPT_DISCONNECT },
+    { "seed",        required_argument, NULL, OPT_SEED },
+    { "flash",       required_argument, NULL, OPT_FLASH },
+    { "keep",        no_argument,       NULL, OPT_KEEP },
+    { "bench",       no_argument,       NULL, OPT_BENCH },
+    { "selftest",    no_argument,       NULL, OPT_SELFTEST },
+    { NULL, 0, NULL, 0 }
+  };
+  simCfg_t cfg =
+  {
+    23, 0, false, 0, 15000, 4, 0, 0, 0, 0, 1, false, false
+  };
+  const char *payloadFile = NULL;
+  const char *baseFile = NULL;
+  const char *flashFile = DEFAULT_FLASH_FILE;
+  uint32_t size = DEFAULT_IMAGE_SIZE;
+  bool bench = false;
+  bool selftest = false;
+  buf_t image;
+  buf_t base = { NULL, 0 };
+  buf_t payload;
+  simResult_t res;
+  int opt;
+  int ret = 0;
+
+  while ((opt = getopt_long(argc, argv, "m:w:li:p:v", opts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'm': cfg.mtu = atoi(optarg); break;
+      case 'w': cfg.window = atoi(optarg); break;
+      case 'l': cfg.largeBlock = true; break;
+      case 'i': cfg.intervalUs = atof(optarg) * 1000; break;
+      case 'p': cfg.pkts = atoi(optarg); break;
+      case 'v': cfg.verbose = true; break;
+      case OPT_COMPRESSED: cfg.codec = OAD_FEATURE_COMPRESSED; break;
+      case OPT_DELTA: cfg.codec = OAD_FEATURE_DELTA; break;
+      case OPT_PAYLOAD: payloadFile = optarg; break;
+      case OPT_BASE: baseFile = optarg; break;
+      case OPT_SIZE: size = strtoul(optarg, NULL, 0); break;
+      case OPT_DROP: cfg.drop = atof(optarg); break;
+      case OPT_CORRUPT: cfg.corrupt = atof(optarg); break;
+      case OPT_TRUNCATE: cfg.truncate = atof(optarg); break;
+      case OPT_DISCONNECT: cfg.disconnectAt = atoi(optarg); break;
+      case OPT_SEED: cfg.seed = atoi(optarg); break;
+      case OPT_FLASH: flashFile = optarg; break;
+      case OPT_KEEP: cfg.keep = true; break;
+      case OPT_BENCH: bench = true; break;
+      case OPT_SELFTEST: selftest = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (optind < argc - 1 || cfg.intervalUs == 0 || cfg.pkts == 0 ||
+      cfg.mtu < 23 || (payloadFile && !cfg.codec))
+  {
+    usage(argv[0]);
+  }
+
+  if (SimFlash_map(flashFile, cfg.keep) < 0)
+  {
+    return 2;
+  }
+
+  OAD_addService();
+  OAD_register(&simOadCBs);
+
+  if (selftest)
+  {
+    ret = runSelftest(&cfg);
+    SimFlash_unmap();
+    return ret;
+  }
+
+  rngState = cfg.seed;
+  memset(simIntFlash, 0xFF, SIM_INT_FLASH_SIZE);
+
+  if (baseFile && bufRead(&base, baseFile) < 0)
+  {
+    return 2;
+  }
+
+  if (optind < argc)
+  {
+    if (bufRead(&image, argv[optind]) < 0)
+    {
+      return 2;
+    }
+    if (image.len <= IMG_ID_SIZE || image.len % HAL_FLASH_WORD_SIZE)
+    {
+      fprintf(stderr, "%s: not an OAD image\n", argv[optind]);
+      return 2;
+    }
+  }
+  else if (cfg.codec == OAD_FEATURE_DELTA && !baseFile)
+  {
+    imageMake(&base, size);
+    imagePatch(&image, &base);
+  }
+  else
+  {
+    imageMake(&image, size);
+  }
+
+  if (cfg.codec == OAD_FEATURE_DELTA)
+  {
+    if (!base.data)
+    {
+      fprintf(stderr, "a delta needs --base with an image\n");
+      return 2;
+    }
+    if (base.len > SIM_INT_FLASH_SIZE - APP_IMAGE_START)
+    {
+      base.len = SIM_INT_FLASH_SIZE - APP_IMAGE_START;
+    }
+    memcpy(simIntFlash + APP_IMAGE_START, base.data, base.len);
+  }
+
+  if (payloadFile)
+  {
+    if (bufRead(&payload, payloadFile) < 0)
+    {
+      return 2;
+    }
+  }
+  else if (cfg.codec == OAD_FEATURE_COMPRESSED)
+  {
+    lzssEncode(&payload, &image);
+  }
+  else if (cfg.codec == OAD_FEATURE_DELTA)
+  {
+    deltaEncode(&payload, &image, &base);
+  }
+  else
+  {
+    payload = image;
+  }
+
+  if (bench)
+  {
+    runBench(&cfg, &image, &payload);
+  }
+  else
+  {
+    runTransfer(&cfg, &image, &payload, &res);
+    printResult(&cfg, &res, image.len);
+    ret = (res.status == STATUS_SUCCESS && res.imageOk) ? 0 : 1;
+  }
+
+  SimFlash_unmap();
+
+  return ret;
+}
@@ -0,0 +1,88 @@
+/*
+ * Host OAD simulator internals shared by the flash model, the stack
+ * stand-ins and the scripted central.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include "sim_stack.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Connection the central is on.
+#define SIM_CONN_HANDLE           0
+
+// Notifications the stack holds for the central at most.
+#define SIM_NOTI_MAX              64
+#define SIM_NOTI_LEN_MAX          32
+
+// Internal flash size.
+#define SIM_INT_FLASH_SIZE        0x20000
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// External flash timing, in microseconds.
+typedef struct
+{
+  uint32_t cmdUs;        // Per command: chip select, opcode and address
+  uint32_t byteUs;       // Per byte clocked over SPI
+  uint32_t pageProgUs;   // Page program, 256 bytes at most
+  uint32_t sectorEraseUs; // 4 kB sector erase
+} simFlashTiming_t;
+
+// External flash activity.
+typedef struct
+{
+  uint32_t reads;
+  uint32_t writes;       // ExtFlash_write calls
+  uint32_t pageProgs;    // Program commands issued
+  uint32_t erases;       // Sectors erased
+  uint32_t bitErrors;    // Programs that tried to turn a 0 bit into a 1
+  uint64_t busyUs;       // Time the CPU waited on the flash
+} simFlashStats_t;
+
+// Notification sent to the central.
+typedef struct
+{
+  uint16_t handle;
+  uint16_t len;
+  uint8_t  data[SIM_NOTI_LEN_MAX];
+} simNoti_t;
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+
+// Simulated time, advanced by the flash model and the central.
+extern uint64_t simNowUs;
+
+extern simFlashTiming_t simFlashTiming;
+extern simFlashStats_t simFlashStats;
+
+extern uint16_t simMtu;
+extern uint32_t simResets;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+// flash_sim.c
+extern int SimFlash_map(const char *path, bool keep);
+extern void SimFlash_unmap(void);
+extern uint8_t *SimFlash_data(void);
+extern void SimFlash_resetStats(void);
+
+// stack_sim.c
+extern bStatus_t SimStack_write(gattAttribute_t *pAttr, uint8_t *pValue,
+                                uint16_t len);
+extern gattAttribute_t *SimStack_findChar(uint16_t uuid);
+extern gattAttribute_t *SimStack_findCCC(uint16_t uuid);
+extern uint8_t SimStack_getNoti(simNoti_t *pNoti);
+extern void SimStack_flushNoti(void);
+extern void SimStack_clearSnv(void);
+
+#endif /* SIM_H */
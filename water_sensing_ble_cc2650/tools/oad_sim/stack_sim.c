@@ -0,0 +1,392 @@
+/*
+ * BLE stack stand-ins for the host OAD simulator: GATT server attribute
+ * handling, notifications, SNV and ICall heap.
+ *
+ * One connection and one registered service, the OAD service. Writes from
+ * the central go straight to the service's write callback, notifications
+ * are queued until the central collects them on the next connection event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define SNV_ITEMS                 16
+#define SNV_ITEM_LEN_MAX          255
+
+// osal_snv_read status for an item never written.
+#define NV_OPER_FAILED            0x0A
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+
+const uint8_t primaryServiceUUID[ATT_BT_UUID_SIZE] = { 0x00, 0x28 };
+const uint8_t characterUUID[ATT_BT_UUID_SIZE] = { 0x03, 0x28 };
+const uint8_t clientCharCfgUUID[ATT_BT_UUID_SIZE] = { 0x02, 0x29 };
+const uint8_t charUserDescUUID[ATT_BT_UUID_SIZE] = { 0x01, 0x29 };
+
+uint8_t linkDBNumConns = 1;
+
+uint16_t simMtu = 23;
+uint32_t simResets = 0;
+
+uint8_t simIntFlash[SIM_INT_FLASH_SIZE];
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static gattAttribute_t *svcAttrs = NULL;
+static uint16_t svcNumAttrs = 0;
+static CONST gattServiceCBs_t *svcCBs = NULL;
+
+static simNoti_t notiQueue[SIM_NOTI_MAX];
+static uint8_t notiHead = 0;
+static uint8_t notiCount = 0;
+
+static struct
+{
+  bool valid;
+  uint8_t len;
+  uint8_t data[SNV_ITEM_LEN_MAX];
+} snv[SNV_ITEMS];
+
+/*********************************************************************
+ * GATT server
+ */
+
+bStatus_t GATTServApp_RegisterService(gattAttribute_t *pAttrs,
+                                      uint16_t numAttrs, uint8_t encKeySize,
+                                      CONST gattServiceCBs_t *pCBs)
+{
+  uint16_t i;
+
+  (void)encKeySize;
+
+  for (i = 0; i < numAttrs; i++)
+  {
+    pAttrs[i].handle = i + 1;
+  }
+
+  svcAttrs = pAttrs;
+  svcNumAttrs = numAttrs;
+  svcCBs = pCBs;
+
+  return SUCCESS;
+}
+
+void GATTServApp_InitCharCfg(uint16_t connHandle, gattCharCfg_t *charCfgTbl)
+{
+  uint8_t i;
+
+  for (i = 0; i < linkDBNumConns; i++)
+  {
+    if (connHandle == INVALID_CONNHANDLE ||
+        charCfgTbl[i].connHandle == connHandle)
+    {
+      charCfgTbl[i].connHandle = INVALID_CONNHANDLE;
+      charCfgTbl[i].value = 0;
+    }
+  }
+}
+
+uint16_t GATTServApp_ReadCharCfg(uint16_t connHandle,
+                                 gattCharCfg_t *charCfgTbl)
+{
+  uint8_t i;
+
+  for (i = 0; i < linkDBNumConns; i++)
+  {
+    if (charCfgTbl[i].connHandle == connHandle)
+    {
+      return charCfgTbl[i].value;
+    }
+  }
+
+  return 0;
+}
+
+bStatus_t GATTServApp_ProcessCCCWriteReq(uint16_t connHandle,
+                                         gattAttribute_t *pAttr,
+                                         uint8_t *pValue, uint16_t len,
+                                         uint16_t offset, uint16_t validCfg)
+{
+  gattCharCfg_t *charCfgTbl = *(gattCharCfg_t **)pAttr->pValue;
+  uint16_t value;
+  uint8_t i;
+
+  if (offset != 0 || len != 2)
+  {
+    return ATT_ERR_INVALID_VALUE_SIZE;
+  }
+
+  value = BUILD_UINT16(pValue[0], pValue[1]);
+  if (value != 0 && value != validCfg)
+  {
+    return ATT_ERR_INVALID_VALUE;
+  }
+
+  for (i = 0; i < linkDBNumConns; i++)
+  {
+    if (charCfgTbl[i].connHandle == connHandle ||
+        charCfgTbl[i].connHandle == INVALID_CONNHANDLE)
+    {
+      charCfgTbl[i].connHandle = connHandle;
+      charCfgTbl[i].value = (uint8_t)value;
+      return SUCCESS;
+    }
+  }
+
+  return ATT_ERR_INVALID_VALUE;
+}
+
+gattAttribute_t *GATTServApp_FindAttr(gattAttribute_t *pAttrTbl,
+                                      uint16_t numAttrs, uint8_t *pValue)
+{
+  uint16_t i;
+
+  for (i = 0; i < numAttrs; i++)
+  {
+    if (pAttrTbl[i].pValue == pValue)
+    {
+      return &pAttrTbl[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * ATT / GATT client side
+ */
+
+uint16_t ATT_GetMTU(uint16_t connHandle)
+{
+  (void)connHandle;
+
+  return simMtu;
+}
+
+void *GATT_bm_alloc(uint16_t connHandle, uint8_t opcode, uint16_t size,
+                    uint16_t *pSizeAlloc)
+{
+  (void)connHandle;
+  (void)opcode;
+
+  if (pSizeAlloc)
+  {
+    *pSizeAlloc = size;
+  }
+
+  return malloc(size);
+}
+
+void GATT_bm_free(gattMsg_t *pMsg, uint8_t opcode)
+{
+  (void)opcode;
+
+  free(pMsg->handleValueNoti.pValue);
+  pMsg->handleValueNoti.pValue = NULL;
+}
+
+bStatus_t GATT_Notification(uint16_t connHandle, attHandleValueNoti_t *pNoti,
+                            uint8_t authenticated)
+{
+  simNoti_t *pSlot;
+
+  (void)connHandle;
+  (void)authenticated;
+
+  // Out of stack buffers, the caller frees the notification.
+  if (notiCount == SIM_NOTI_MAX || pNoti->len > SIM_NOTI_LEN_MAX)
+  {
+    return MSG_BUFFER_NOT_AVAIL;
+  }
+
+  pSlot = &notiQueue[(notiHead + notiCount) % SIM_NOTI_MAX];
+  pSlot->handle = pNoti->handle;
+  pSlot->len = pNoti->len;
+  memcpy(pSlot->data, pNoti->pValue, pNoti->len);
+  notiCount++;
+
+  // The stack owns the buffer once the notification is queued.
+  free(pNoti->pValue);
+
+  return SUCCESS;
+}
+
+/*********************************************************************
+ * OSAL / ICall / HAL
+ */
+
+uint8_t osal_snv_read(uint8_t id, uint8_t len, void *pBuf)
+{
+  uint8_t i = id - BLE_NVID_CUST_START;
+
+  if (i >= SNV_ITEMS || !snv[i].valid || snv[i].len != len)
+  {
+    return NV_OPER_FAILED;
+  }
+
+  memcpy(pBuf, snv[i].data, len);
+
+  return SUCCESS;
+}
+
+uint8_t osal_snv_write(uint8_t id, uint8_t len, void *pBuf)
+{
+  uint8_t i = id - BLE_NVID_CUST_START;
+
+  if (i >= SNV_ITEMS)
+  {
+    return NV_OPER_FAILED;
+  }
+
+  snv[i].valid = true;
+  snv[i].len = len;
+  memcpy(snv[i].data, pBuf, len);
+
+  return SUCCESS;
+}
+
+void *ICall_malloc(uint32_t size)
+{
+  return malloc(size);
+}
+
+void ICall_free(void *msg)
+{
+  free(msg);
+}
+
+void simSystemReset(void)
+{
+  simResets++;
+}
+
+/*********************************************************************
+ * Central side
+ */
+
+/*********************************************************************
+ * @fn      SimStack_write
+ *
+ * @brief   Deliver a write command from the central.
+ *
+ * @param   pAttr  - attribute written
+ * @param   pValue - value
+ * @param   len    - value length
+ *
+ * @return  Status from the service.
+ */
+bStatus_t SimStack_write(gattAttribute_t *pAttr, uint8_t *pValue,
+                         uint16_t len)
+{
+  return svcCBs->pfnWriteAttrCB(SIM_CONN_HANDLE, pAttr, pValue, len, 0,
+                                ATT_WRITE_CMD);
+}
+
+/*********************************************************************
+ * @fn      SimStack_findChar
+ *
+ * @brief   Find a characteristic value of the service by its 16 bit
+ *          short form in the TI base UUID.
+ *
+ * @param   uuid - short UUID
+ *
+ * @return  The attribute, NULL if not found.
+ */
+gattAttribute_t *SimStack_findChar(uint16_t uuid)
+{
+  uint16_t i;
+
+  for (i = 0; i < svcNumAttrs; i++)
+  {
+    if (svcAttrs[i].type.len == ATT_UUID_SIZE &&
+        BUILD_UINT16(svcAttrs[i].type.uuid[12],
+                     svcAttrs[i].type.uuid[13]) == uuid)
+    {
+      return &svcAttrs[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * @fn      SimStack_findCCC
+ *
+ * @brief   Find the client configuration of a characteristic.
+ *
+ * @param   uuid - short UUID of the characteristic
+ *
+ * @return  The attribute, NULL if the characteristic has none.
+ */
+gattAttribute_t *SimStack_findCCC(uint16_t uuid)
+{
+  gattAttribute_t *pAttr = SimStack_findChar(uuid);
+
+  if (pAttr && pAttr + 1 < svcAttrs + svcNumAttrs &&
+      pAttr[1].type.len == ATT_BT_UUID_SIZE &&
+      !memcmp(pAttr[1].type.uuid, clientCharCfgUUID, ATT_BT_UUID_SIZE))
+  {
+    return pAttr + 1;
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * @fn      SimStack_getNoti
+ *
+ * @brief   Take the oldest notification sent to the central.
+ *
+ * @param   pNoti - notification
+ *
+ * @return  TRUE if there was one.
+ */
+uint8_t SimStack_getNoti(simNoti_t *pNoti)
+{
+  if (notiCount == 0)
+  {
+    return FALSE;
+  }
+
+  *pNoti = notiQueue[notiHead];
+  notiHead = (notiHead + 1) % SIM_NOTI_MAX;
+  notiCount--;
+
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      SimStack_flushNoti
+ *
+ * @brief   Drop the notifications not delivered, as on a link loss.
+ *
+ * @return  None.
+ */
+void SimStack_flushNoti(void)
+{
+  notiHead = 0;
+  notiCount = 0;
+}
+
+/*********************************************************************
+ * @fn      SimStack_clearSnv
+ *
+ * @brief   Forget all SNV items.
+ *
+ * @return  None.
+ */
+void SimStack_clearSnv(void)
+{
+  memset(snv, 0, sizeof(snv));
+}
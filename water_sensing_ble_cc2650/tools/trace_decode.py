@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Decode a binary trace dump from the water sensing node.
+
+The dump is the raw trace_buf_t from Application/trace.h, as read from the
+trace characteristic of the diagnostics service (UUID 0xC22C).
+Event messages are taken from the TRACE_EVENTS list in trace.h, so the
+decoder always matches the firmware it is run next to.
+
+Usage:
+    trace_decode.py dump.bin
+    trace_decode.py --hex "2000 2000 0000 0100 ..."
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              os.pardir, "Application", "trace.h")
+
+HDR_FMT = "<HHI"
+REC_FMT = "<IHHI"
+
+
+def load_events(header):
+    """Return the list of (name, message) in trace_id_t order."""
+    with open(header) as f:
+        text = f.read()
+    ring = re.search(r"#define\s+TRACE_RING_SIZE\s+(\d+)", text)
+    events = re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)
+    if not ring or not events:
+        sys.exit("could not parse %s" % header)
+    return int(ring.group(1)), events
+
+
+def decode(data, ring_size, events):
+    hdr_len = struct.calcsize(HDR_FMT)
+    rec_len = struct.calcsize(REC_FMT)
+    if len(data) < hdr_len + ring_size * rec_len:
+        sys.exit("dump is %d bytes, expected %d"
+                 % (len(data), hdr_len + ring_size * rec_len))
+
+    head, count, freq = struct.unpack_from(HDR_FMT, data)
+    freq = freq or 1
+    first = (head - count) & 0xFFFF
+
+    records = []
+    for n in range(count):
+        idx = (first + n) & (ring_size - 1)
+        records.append(struct.unpack_from(REC_FMT, data,
+                                          hdr_len + idx * rec_len))
+
+    if not records:
+        return []
+
+    lines = []
+    t0 = records[0][0]
+    for ts, ev, arg0, arg1 in records:
+        dt = ((ts - t0) & 0xFFFFFFFF) / float(freq)
+        if ev < len(events):
+            name, msg = events[ev]
+            nargs = len(re.findall(r"%[-+ #0]*\d*[diouxXc]", msg))
+            try:
+                text = msg % (arg0, arg1)[:nargs]
+            except (TypeError, ValueError):
+                text = "%s (%d, %d)" % (msg, arg0, arg1)
+        else:
+            name, text = "UNKNOWN_%d" % ev, "(%d, %d)" % (arg0, arg1)
+        lines.append("%12.6f  %-24s %s" % (dt, name, text))
+    return lines
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("dump", nargs="?", help="binary dump file")
+    ap.add_argument("--hex", help="dump as a hex string, e.g. from a BLE app")
+    ap.add_argument("--header", default=DEFAULT_HEADER,
+                    help="trace.h to take event messages from")
+    args = ap.parse_args()
+
+    if args.hex:
+        data = bytes.fromhex(re.sub(r"[^0-9a-fA-F]", "", args.hex))
+    elif args.dump:
+        with open(args.dump, "rb") as f:
+            data = f.read()
+    else:
+        ap.error("need a dump file or --hex")
+
+    ring_size, events = load_events(args.header)
+    for line in decode(data, ring_size, events):
+        print(line)
+
+
+if __name__ == "__main__":
+    main()